@@ -8,6 +8,14 @@ using namespace std;
 
 namespace zero {
 
+    /**
+     * the frame of a call begins at the end of the frame of the caller. the caller leaves this many free slots there,
+     * then the function reference and the arguments, which become the first slots of the context of the callee.
+     * the free slots are the header of the new frame: the return ip, the caller context, the return index and
+     * the base and stack pointers of the caller
+     */
+    static const unsigned int FRAME_HEADER_SIZE = 4;
+
     enum Opcode {
         NO_OPCODE,
         LABEL,
@@ -16,17 +24,29 @@ namespace zero {
         JMP,
         JMP_TRUE,
         JMP_FALSE,
+        // fused compare and jump, op1 and op2: values to compare, dest: jump address
+        JMP_EQ,
+        JMP_NEQ,
+        JMP_GT_INT,
+        JMP_GT_DECIMAL,
+        JMP_LT_INT,
+        JMP_LT_DECIMAL,
+        JMP_GTE_INT,
+        JMP_GTE_DECIMAL,
+        JMP_LTE_INT,
+        JMP_LTE_DECIMAL,
         MOV,
         MOV_FNC,
         MOV_INT,
         MOV_NULL,
         MOV_BOOLEAN,
         MOV_DECIMAL,
-        MOV_STRING,
-        CALL,
-        CALL_NATIVE,
+        MOV_STRING, // op1: index in the string constants of the program
+        CALL, // op1: index of the function reference, followed by the arguments, op2: argument count, dest: return index
+        CALL_NATIVE, // same operands as CALL
         ADD_INT,
         ADD_STRING,
+        CONCAT_N, // op1: index of the first piece, followed by the others, op2: number of pieces
         ADD_DECIMAL,
         SUB_INT,
         SUB_DECIMAL,
@@ -51,10 +71,17 @@ namespace zero {
         NEG_DECIMAL,
         PUSH,
         POP,
-        ARG_READ, // read an argument from the stack. pop wont work here because we need to take element relative to the base pointer
-        GET_IN_PARENT, // to get an index in a parent context into current context. op1: depth, op2: index
+        // closures. a function reaches the variables of the enclosing functions through the captures of its reference
+        GET_UPVALUE, // op1: capture index, dest: index in current context
+        GET_UPVALUE_CELL, // read through a captured cell. op1: capture index, dest: index in current context
+        SET_UPVALUE_CELL, // write through a captured cell. op1: capture index, op2: value index in current context
+        CAPTURE, // copy a value into the captures of a new function reference. op1: capture index, op2: value index, dest: function reference index
+        CAPTURE_CELL, // same, but captures the address of the slot at op2
+        CAPTURE_UPVALUE, // same, but copies op2th capture of the current function
+        MOV_BOX, // move the value at dest into a new box, and the address of the box into dest
+        GET_CELL, // op1: index of the cell address in current context, dest: index in current context
+        SET_CELL, // op1: value index in current context, dest: index of the cell address in current context
         GET_IN_OBJECT, // to get an index in a an object into current context. op1: object index in current context, op2: index
-        SET_IN_PARENT, // to set an index in a parent context from current context. op1: depth, op2: current value index, dest: index at parent
         SET_IN_OBJECT, // to set an index in a an object from current context. op1: object index in current context, op2: value in current context, dest: index at object
         RET
     };
@@ -85,10 +112,16 @@ namespace zero {
     static const map<int, InstructionDescriptor> instructionDescriptionTable = {
             {RET,             {OTHER,          UNUSED,      UNUSED,  IMM_INT}},
             {SET_IN_OBJECT,   {OTHER,          IMM_INT,     IMM_INT, INDEX}},
-            {SET_IN_PARENT,   {OTHER,          IMM_INT,     INDEX,   INDEX}},
             {GET_IN_OBJECT,   {OTHER,          INDEX,       INDEX,   INDEX}},
-            {GET_IN_PARENT,   {OTHER,          IMM_INT,     IMM_INT, INDEX}},
-            {ARG_READ,        {OTHER,          IMM_INT,     UNUSED,  INDEX}},
+            {SET_CELL,        {OTHER,          INDEX,       UNUSED,  INDEX}},
+            {GET_CELL,        {OTHER,          INDEX,       UNUSED,  INDEX}},
+            {MOV_BOX,         {OTHER,          UNUSED,      UNUSED,  INDEX}},
+            {CAPTURE_UPVALUE, {OTHER,          IMM_INT,     IMM_INT, INDEX}},
+            {CAPTURE_CELL,    {OTHER,          IMM_INT,     INDEX,   INDEX}},
+            {CAPTURE,         {OTHER,          IMM_INT,     INDEX,   INDEX}},
+            {SET_UPVALUE_CELL, {OTHER,          IMM_INT,     INDEX,   UNUSED}},
+            {GET_UPVALUE_CELL, {OTHER,          IMM_INT,     UNUSED,  INDEX}},
+            {GET_UPVALUE,     {OTHER,          IMM_INT,     UNUSED,  INDEX}},
             {PUSH,            {OTHER,          INDEX,       UNUSED,  UNUSED}},
             {POP,             {OTHER,          INDEX,       UNUSED,  UNUSED}},
             {NEG_DECIMAL,     {OTHER,          INDEX,       UNUSED,  INDEX}},
@@ -113,12 +146,13 @@ namespace zero {
             {SUB_DECIMAL,     {OTHER,          INDEX,       INDEX,   INDEX}},
             {SUB_INT,         {OTHER,          INDEX,       INDEX,   INDEX}},
             {ADD_DECIMAL,     {OTHER,          INDEX,       INDEX,   INDEX}},
+            {CONCAT_N,        {OTHER,          INDEX,       IMM_INT, INDEX}},
             {ADD_STRING,      {OTHER,          INDEX,       INDEX,   INDEX}},
             {ADD_INT,         {OTHER,          INDEX,       INDEX,   INDEX}},
-            {CALL_NATIVE,     {OTHER,          INDEX,       INDEX,   INDEX}},
+            {CALL_NATIVE,     {OTHER,          INDEX,       IMM_INT, INDEX}},
             {CALL,            {OTHER,          IMM_INT,     IMM_INT, IMM_INT}},
             {MOV,             {OTHER,          INDEX,       UNUSED,  INDEX}},
-            {MOV_FNC,         {OTHER,          IMM_ADDRESS, UNUSED,  INDEX}},
+            {MOV_FNC,         {OTHER,          IMM_ADDRESS, IMM_INT, INDEX}},
             {MOV_NULL,        {OTHER,          UNUSED,      UNUSED,  INDEX}},
             {MOV_INT,         {OTHER,          IMM_INT,     UNUSED,  INDEX}},
             {MOV_BOOLEAN,     {OTHER,          IMM_INT,     UNUSED,  INDEX}},
@@ -127,8 +161,18 @@ namespace zero {
             {JMP_TRUE,        {JUMP,           INDEX,       UNUSED,  IMM_ADDRESS}},
             {JMP_FALSE,       {JUMP,           INDEX,       UNUSED,  IMM_ADDRESS}},
             {JMP,             {JUMP,           UNUSED,      UNUSED,  IMM_ADDRESS}},
-            {FN_ENTER_STACK,  {FUNCTION_ENTER, IMM_INT,     UNUSED,  UNUSED}},
-            {FN_ENTER_HEAP,   {FUNCTION_ENTER, IMM_INT,     UNUSED,  UNUSED}}
+            {JMP_EQ,          {JUMP,           INDEX,       INDEX,   IMM_ADDRESS}},
+            {JMP_NEQ,         {JUMP,           INDEX,       INDEX,   IMM_ADDRESS}},
+            {JMP_GT_INT,      {JUMP,           INDEX,       INDEX,   IMM_ADDRESS}},
+            {JMP_GT_DECIMAL,  {JUMP,           INDEX,       INDEX,   IMM_ADDRESS}},
+            {JMP_LT_INT,      {JUMP,           INDEX,       INDEX,   IMM_ADDRESS}},
+            {JMP_LT_DECIMAL,  {JUMP,           INDEX,       INDEX,   IMM_ADDRESS}},
+            {JMP_GTE_INT,     {JUMP,           INDEX,       INDEX,   IMM_ADDRESS}},
+            {JMP_GTE_DECIMAL, {JUMP,           INDEX,       INDEX,   IMM_ADDRESS}},
+            {JMP_LTE_INT,     {JUMP,           INDEX,       INDEX,   IMM_ADDRESS}},
+            {JMP_LTE_DECIMAL, {JUMP,           INDEX,       INDEX,   IMM_ADDRESS}},
+            {FN_ENTER_STACK,  {FUNCTION_ENTER, IMM_INT,     IMM_INT, UNUSED}},
+            {FN_ENTER_HEAP,   {FUNCTION_ENTER, IMM_INT,     IMM_INT, UNUSED}}
     };
 
     class Instruction {
@@ -159,7 +203,7 @@ namespace zero {
 
         Instruction *withOp1(string *label);
 
-        Instruction *withOp1(float decimal);
+        Instruction *withOp1(double decimal);
 
         Instruction *withOp2(unsigned int op);
 
@@ -175,12 +219,22 @@ namespace zero {
         Impl *impl;
     };
 
+    // a variable of the root function, the embedding looks the functions up by these
+    typedef struct {
+        string name;
+        uint64_t index;     // its slot in the context of the root function
+        bool isBoxed;       // the slot holds a box with the value, the functions that capture the variable share it
+    } GlobalSymbol;
+
     class Program {
     public:
         class Impl;
 
         explicit Program(string fileName);
 
+        // with its instructions
+        ~Program();
+
         void addInstruction(Instruction *instruction);
 
         // insert at a specific position
@@ -192,10 +246,27 @@ namespace zero {
 
         string toString();
 
+        // both are built once and kept until the program changes. a program run by several vm instances at the
+        // same time must have been laid out before
         char *toBytes();
 
         vector<Instruction *> getInstructions();
 
+        // the instructions with the labels among them, as they were added. the optimizer rewrites them in place
+        vector<Instruction *> getLabeledInstructions();
+
+        void setLabeledInstructions(const vector<Instruction *> &instructions);
+
+        // renumbers the slots from `first` on to start at `to`, in the operands that are slots
+        void moveSlots(uint64_t first, uint64_t to);
+
+        // the distinct MOV_STRING literals. toBytes and getInstructions replace the operands with indexes in this
+        vector<string *> getStringConstants();
+
+        void addGlobal(const GlobalSymbol &global);
+
+        const vector<GlobalSymbol> &getGlobals();
+
     private:
         Impl *impl;
     };
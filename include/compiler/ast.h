@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <set>
 
 #include "ZParser.h"
 
@@ -101,6 +102,8 @@ namespace zero {
         static const int TYPE_STRING = 4;
         static const int TYPE_FUNCTION = 5;
         static const int TYPE_NULL = 6;
+
+        int upvalueIndex = -1; // for identifiers in an enclosing function, index in the captures of the current one
     };
 
     class VariableAstNode : public BaseAstNode {
@@ -154,6 +157,9 @@ namespace zero {
 
         string contextObjectTypeName;
 
+        // for function bodies, the variables that children capture by their addresses, set by the closure converter
+        set<unsigned int> cellSlots;
+
         static ProgramAstNode *from(ZParser::ProgramContext *programContext, string fileName);
 
         string toString() override;
@@ -180,6 +186,13 @@ namespace zero {
         string toString() override;
     };
 
+    // where a function reference gets one of its captures from, when its parent creates it
+    struct UpvalueAstNode {
+        unsigned int sourceIndex; // index in the parent's context, or in the parent's own captures
+        int fromParentUpvalues;
+        int isCell; // the address of the variable is captured, not its value
+    };
+
     class FunctionAstNode : public AtomicExpressionAstNode {
     public:
         ProgramAstNode *program;
@@ -189,13 +202,16 @@ namespace zero {
 
         // this one is important, let me explain:
         // if a function has a function definition inside, it is perfectly legal for the child function to access variables in the "upper" scope
-        // in that case, we cannot simply destroy the parent function context. it is a well-known pattern of memory leak in js
-        // however, if the function does not have any functions defined inside, this possibility is eliminated
-        // and we can alloc local variables from the stack rather than the heap area
-        // this variable simply says is the function is a "leaf", meaning that does not have any child functions
-        int isLeafFunction;
+        // the child captures the variables that may change by their addresses. if the child outlives the call, these addresses cannot be
+        // in the frame of the function, so the variables are moved to boxes on the heap
+        // however, if the children are only called while the function runs, this possibility is eliminated
+        // and the children can point to the frame directly
+        // this variable says if a child may outlive the call, and is set by the escape analyzer
+        int hasEscapingChildren = true;
         string name;
 
+        vector<UpvalueAstNode> upvalues; // captures of the references to this function, set by the closure converter
+
         static FunctionAstNode *from(ZParser::FunctionContext *functionContext, string fileName);
     };
 }
\ No newline at end of file
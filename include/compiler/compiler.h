@@ -7,20 +7,132 @@
 
 using namespace std;
 
+// bump whenever the same source compiles to different code, so the cached programs are compiled again
+#define COMPILER_VERSION 1
+
 namespace zero {
 
+    /**
+     * compiled programs, in files named after the hash of everything they were compiled from. the files keep all of
+     * it too, so that a program with the same hash is not taken for another one. the least recently used ones are
+     * deleted when the directory grows past its limit.
+     * hits, misses and evictions are counted in the directory, across runs
+     */
+    class CompileCache {
+    public:
+        class Impl;
+
+        CompileCache(const string &directory, uint64_t maxSize);
+
+        // null if it is not there, or can not be run anymore
+        Program *load(const string &key, const string &fileName);
+
+        void store(const string &key, Program *program);
+
+        void logStatistics();
+
+    private:
+        Impl *impl;
+    };
+
+    /**
+     * a rewrite of the instructions of a generated program, before it is run or written
+     */
+    class OptimizerPass {
+    public:
+        virtual ~OptimizerPass() = default;
+
+        virtual string name() = 0;
+
+        virtual void run(Program *program) = 0;
+    };
+
+    /**
+     * runs its passes over every compiled program, in the order they were added, and counts the instructions each
+     * of them removed. level 0 has no passes, level 1 only removes jumps and unreachable code, level 2 also folds
+     * constants, propagates copies and removes dead stores, and repeats them all while they find something
+     */
+    class Optimizer {
+    public:
+        class Impl;
+
+        static const int DEFAULT_LEVEL = 2;
+
+        explicit Optimizer(int level);
+
+        ~Optimizer();
+
+        // the optimizer deletes its passes
+        void addPass(OptimizerPass *pass);
+
+        void optimize(Program *program);
+
+        // the passes in order, the compile cache keys the programs with it
+        string describe();
+
+        void logStatistics();
+
+    private:
+        Impl *impl;
+    };
+
     class Compiler {
     public:
         class Impl;
 
         Compiler();
 
+        ~Compiler();
+
         Program *compileFile(const string& fileName);
 
+        // the file name is only for the messages
+        Program *compileSource(const string &source, const string &fileName);
+
+        // the source, the compiler version and the natives are looked up before compiling
+        void useCache(CompileCache *cache);
+
+        // instead of the one of the default level. it is not deleted with the compiler
+        void useOptimizer(Optimizer *optimizer);
+
     private:
         Impl* impl;
     };
 
+    /**
+     * decides which functions can let their children capture variables from the frame
+     */
+    class EscapeAnalyzer {
+    public:
+        class Impl;
+
+        void analyze(ProgramAstNode *programAstNode);
+
+        EscapeAnalyzer();
+
+        ~EscapeAnalyzer();
+
+    private:
+        Impl *impl;
+    };
+
+    /**
+     * decides what each function captures from its parent, and which variables are captured by their addresses
+     */
+    class ClosureConverter {
+    public:
+        class Impl;
+
+        void convert(ProgramAstNode *programAstNode);
+
+        ClosureConverter();
+
+        ~ClosureConverter();
+
+    private:
+        Impl *impl;
+    };
+
     class ByteCodeGenerator {
     public:
         class Impl;
@@ -29,6 +141,8 @@ namespace zero {
 
         ByteCodeGenerator();
 
+        ~ByteCodeGenerator();
+
     private:
         Impl* impl;
     };
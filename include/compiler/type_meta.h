@@ -40,6 +40,8 @@ namespace zero {
 
         explicit TypeInfoExtractor();
 
+        ~TypeInfoExtractor();
+
     private:
         Impl *impl;
     };
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vm/vm.h>
+
+using namespace std;
+
+/**
+ * a .zbc file is a compiled program that can be run without the compiler. it is the header below, followed by
+ * the sections it points at, each beginning at a multiple of 8 bytes:
+ *      - instructions, 4 words each in the same layout as Program::toBytes, operands are indexes only
+ *      - functions, the instruction index of every FN_ENTER_*
+ *      - strings, the MOV_STRING constants in the order their indexes refer to
+ *      - natives, the names of the natives the program was compiled against. their indexes are in the code, so
+ *        they must be registered in the same order to run it
+ *      - globals, the variables of the root function for the embedding: the slot, 1 if it is boxed, and the name
+ *      - key, a string with everything a compile cache compiled the program from, empty in the other files
+ * a string is its length in a word, followed by its characters, padded to a word.
+ * words are written as the machine has them, the files are not meant to move between architectures
+ */
+#define ZBC_MAGIC 0x0043425au // "ZBC\0"
+#define ZBC_VERSION 3         // bump whenever the opcodes, their operands or this layout change
+
+namespace zero {
+
+    typedef struct {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t file_size;
+        uint64_t instruction_count;
+        uint64_t instructions_offset;
+        uint64_t function_count;
+        uint64_t functions_offset;
+        uint64_t string_count;
+        uint64_t strings_offset;
+        uint64_t native_count;
+        uint64_t natives_offset;
+        uint64_t global_count;
+        uint64_t globals_offset;
+        uint64_t key_offset;
+    } zbc_header_t;
+
+    void bytecode_write_file(Program *program, const string &file_name);
+
+    // false instead of exiting when the file can not be written
+    bool bytecode_try_write_file(Program *program, const string &file_name, const string &key = "");
+
+    // the file is mapped privately, so the instructions can be prepared for the interpreter right where they are.
+    // exits if it is not a file this vm can run
+    zbc_header_t *bytecode_map_file(const string &file_name);
+
+    // null instead of exiting when the file can not be read or run
+    zbc_header_t *bytecode_try_map_file(const string &file_name);
+
+    void bytecode_unmap_file(zbc_header_t *image);
+
+    // a program with the same instructions, for the tiers that compile from a Program
+    Program *bytecode_load_program(zbc_header_t *image, const string &file_name);
+
+    inline uint64_t *bytecode_instructions_of(zbc_header_t *image) {
+        return (uint64_t *) ((char *) image + image->instructions_offset);
+    }
+
+    vector<string> bytecode_strings_of(zbc_header_t *image);
+
+    string bytecode_key_of(zbc_header_t *image);
+}
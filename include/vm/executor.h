@@ -0,0 +1,39 @@
+#pragma once
+
+#include <functional>
+
+#include <vm/vm.h>
+
+using namespace std;
+
+namespace zero {
+
+    /**
+     * runs independent programs on a pool of worker threads. every worker has a vm instance of its own and a deque of
+     * programs, it takes the last one it was given and steals the first ones of the others when it runs out.
+     * the output of a program is written at once when it returns, so the jobs never interleave their prints.
+     * a vm error still exits the whole process, as it does for a single program
+     */
+    class Executor {
+    public:
+        class Impl;
+
+        // the workers start here and create their instances, so the natives must be registered before
+        Executor(uint64_t workerCount, const function<void(Program *)> &run);
+
+        // waits for the submitted programs, then stops the workers
+        ~Executor();
+
+        // from the thread that created the executor. the same program can be submitted any number of times, its
+        // compiled form is shared by the runs
+        void submit(Program *program);
+
+        // until every submitted program has run
+        void wait();
+
+        void logStatistics();
+
+    private:
+        Impl *impl;
+    };
+}
@@ -15,6 +15,14 @@ namespace zero {
         double decimal_value;
     } z_op_t;
 
+    // MOV_DECIMAL carries the bits of a double, this is how the value stack holds it
+    inline uint64_t jit_encode_decimal(uint64_t bits) {
+        if ((bits & 0x7fffffffffffffffull) > 0x7ff0000000000000ull) {
+            bits = 0x7ff8000000000000ull; // every nan is the same nan
+        }
+        return bits + DOUBLE_ENCODE_OFFSET;
+    }
+
     // Signature of the generated function.
     typedef int (*z_jit_fnc)();
 
@@ -25,4 +33,33 @@ namespace zero {
     // compiles fast and un optimised code
     z_jit_fnc baseline_jit(Program* program, z_opcode_handler** handlers);
 
+    // second tier. splits every function into basic blocks, keeps the hottest int and boolean slots in registers
+    // and compiles the arithmetic, comparisons and jumps on them without calling the handlers
+    z_jit_fnc optimizing_jit(Program* program, z_opcode_handler** handlers);
+
+    // compiles only the function that starts at the given FN_ENTER_*, for the tiered execution.
+    // function refs created by it hold instruction indexes, just like the interpreter's
+    z_jit_fnc optimizing_jit_function(Program* program, uint64_t entry_index, z_opcode_handler** handlers);
+
+    // compiles the function for an on stack replacement, the generated code starts at the given loop header.
+    // it continues the interpreted frame as it is, with its context in r12
+    z_jit_fnc optimizing_jit_osr(Program* program, uint64_t entry_index, uint64_t loop_header_index,
+                                 z_opcode_handler** handlers);
+
+    // tiered execution glue between the interpreter and the generated code
+
+    // compiles the function with the handlers of the tiered mode
+    void *vm_jit_compile_function(Program *program, uint64_t entry_index);
+
+    // runs a generated function. the caller has already pushed its frame
+    void vm_jit_invoke(void *entry);
+
+    void *vm_jit_compile_osr(Program *program, uint64_t entry_index, uint64_t loop_header_index);
+
+    // continues an interpreted function in the code compiled by vm_jit_compile_osr
+    void vm_jit_invoke_osr(void *entry, z_value_t *context, int64_t frame_base_pointer, uint64_t frame_call_depth);
+
+    // where a call from the generated code should go: native code, or the interpreter bridge
+    void *vm_tiered_call_target(uint64_t instruction_index);
+
 }
\ No newline at end of file
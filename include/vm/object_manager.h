@@ -12,20 +12,42 @@ using namespace std;
  */
 namespace zero {
 
+    /**
+     * a function reference carries the values its function uses from the enclosing functions, so called the captures.
+     * they follow the struct, their count is the size in the object header. a capture is either a copy of the value,
+     * or the address of a cell holding the variable, when the variable may change after it was captured.
+     * upon a call, the reference itself is pushed to the stack and becomes the 0th slot of the callee's context
+     */
     typedef struct {
-        // because parent and callee are not always the same!.
-        // the context, which creates the function reference, by MOV_FNC, is the parent of the function that was referred to!
-        // let's say the function A contains function B and B requires some variable in A's context
-        // in that case, B, has to have a reference to A's context, and this is how it is achieved
-        // A creates a z_value of type function_ref, and this ref contains both the index and the A's reference to it
-        // when some other function, say C, calls B, it has to use the value created by A, because there is no other way for it to access B
-        // and this way, upon calling B, C pushes parent context, which is A to the stack
-        void* parent_context_ptr;
         uint64_t instruction_index; // not the pointer but the index, like 54th instruction
     } z_fnc_ref_t;
 
+    /**
+     * a concatenation that was not copied yet, so that building a string piece by piece stays linear.
+     * the characters are only put together when they are needed. flattening keeps the result in left
+     * and drops the pieces, right becomes null
+     */
+    typedef struct {
+        z_value_t left; // string or rope
+        z_value_t right;
+        uint64_t length;
+    } z_rope_t;
+
     typedef int z_object_type_info;
 
+    // every heap object is preceded by this header. pointers handed out by the object manager point right after it,
+    // so the type of any object is a single load away
+    typedef struct z_object_header {
+        uint16_t type; // z_object_type_info
+        uint16_t flags;
+        uint32_t size; // number of slots for contexts, boxes and ropes, number of captures for function references
+        struct z_object_header *next; // old objects are chained for the sweep phase, young ones point to their copy
+    } z_object_header_t;
+
+    static const uint16_t OBJECT_FLAG_MARKED = 1;
+    static const uint16_t OBJECT_FLAG_FORWARDED = 2; // young object that was copied to the old space
+    static const uint16_t OBJECT_FLAG_REMEMBERED = 4; // box or rope that may point to young objects
+
     static const int VM_VALUE_TYPE_INT = PRIMITIVE_TYPE_INT;
     static const int VM_VALUE_TYPE_DECIMAL = PRIMITIVE_TYPE_DOUBLE;
     static const int VM_VALUE_TYPE_BOOLEAN = PRIMITIVE_TYPE_BOOLEAN;
@@ -33,10 +55,114 @@ namespace zero {
     static const int VM_VALUE_TYPE_STRING = PRIMITIVE_TYPE_NULL + 1;
     static const int VM_VALUE_TYPE_FUNCTION_REF = VM_VALUE_TYPE_STRING + 1;
     static const int VM_VALUE_TYPE_TYPE_OBJECT = VM_VALUE_TYPE_FUNCTION_REF + 1;
+    static const int VM_VALUE_TYPE_CONTEXT = VM_VALUE_TYPE_TYPE_OBJECT + 1;
+    static const int VM_VALUE_TYPE_BOX = VM_VALUE_TYPE_CONTEXT + 1; // a captured variable that outlives its frame
+    static const int VM_VALUE_TYPE_ROPE = VM_VALUE_TYPE_BOX + 1; // a string for the language
+    static const int VM_VALUE_TYPE_NATIVE_REF = VM_VALUE_TYPE_ROPE + 1; // not an object, the index of a native
+
+    inline z_object_header_t *object_manager_header_of(void *object) {
+        return ((z_object_header_t *) object) - 1;
+    }
+
+    inline z_value_t *object_manager_captures_of(z_fnc_ref_t *fnc_ref) {
+        return (z_value_t *) (fnc_ref + 1);
+    }
+
+    static const uint32_t MAX_POOLED_CONTEXT_SIZE = 64; // slots
+
+    // the objects of an instance
+    typedef struct z_heap {
+        // old space
+        z_object_header_t *all_objects;
+        uint64_t object_count;
+        uint64_t bytes_since_collection;
+        uint64_t collection_threshold;
+
+        // young space. strings, ropes and function references are bump allocated in the nursery,
+        // contexts and boxes never move
+        uintptr_t nursery_start;
+        uintptr_t nursery_end;
+        uintptr_t nursery_top;
+        uint64_t *nursery_object_starts; // one bit per word of the nursery, set where an object starts
+
+        vector<z_value_t *> active_contexts;
+        vector<z_value_t *> remembered_objects;
+        vector<z_object_header_t *> promoted_objects; // function references and ropes, their slots are evacuated later
+
+        // contexts, free lists are indexed by the number of slots and chained through the header
+        z_object_header_t *context_free_lists[MAX_POOLED_CONTEXT_SIZE + 1];
+        vector<void *> context_slabs;
+        uint64_t context_allocations;
+        uint64_t context_pool_hits;
+        uint64_t context_slab_refills;
+        uint64_t contexts_released_on_return;
+    } z_heap_t;
+
+    z_heap_t *object_manager_create_heap();
+
+    // frees every object, the heap must not be in use
+    void object_manager_destroy_heap(z_heap_t *heap);
+
+    inline bool object_manager_is_young(z_value_t value) {
+        auto heap = vm_instance->heap;
+        return (value.uint_value & 7) == 0 && value.uint_value >= heap->nursery_start &&
+               value.uint_value < heap->nursery_end;
+    }
+
+    void object_manager_remember(z_value_t *cell);
+
+    /**
+     * must be called when a value is stored through a cell, which is either a box or a slot of a frame on the stack,
+     * and when a rope is flattened. the contexts of the active functions are scanned in every minor collection anyway
+     */
+    inline void object_manager_write_barrier(z_value_t *cell, z_value_t value) {
+        if (object_manager_is_young(value)) {
+            object_manager_remember(cell);
+        }
+    }
+
+    // called by FN_ENTER_HEAP and RET, so that the minor collection knows the active contexts.
+    // nothing refers to a context once its function returns, so leaving it gives it back to the pool
+    void object_manager_enter_context(z_value_t *context_object);
+
+    void object_manager_leave_context(z_value_t *context_object);
+
+    /**
+     * allocating functions may run a collection first. the roots are the value stack and the given context,
+     * which has to be the context of the running function
+     */
+    z_fnc_ref_t* object_manager_create_fn_ref(uint64_t instruction_index, uint32_t capture_count,
+                                              z_value_t *context_object);
+
+    string *object_manager_create_string(string value, z_value_t *context_object);
+
+    // the operands are read after the allocation, so they must be in the roots, like the slots of the context
+    z_value_t object_manager_concat(z_value_t *left, z_value_t *right, z_value_t *context_object);
+
+    // the pieces of a longer chain of concatenations, copied together at once. they are used as scratch space,
+    // so they must be in the roots and not needed afterwards, like the pushed operands on the value stack
+    z_value_t object_manager_concat_n(z_value_t *values, uint64_t count, z_value_t *context_object);
+
+    // a string or a rope, which is flattened in place. the value must be in the roots as well
+    string *object_manager_flatten(z_value_t *value, z_value_t *context_object);
+
+    // strings of the program itself. they are neither young nor old, so the collector never moves or frees them
+    string *object_manager_create_constant_string(const string &value);
+
+    void object_manager_free_constant_string(string *value);
+
+    z_value_t *object_manager_create_context(unsigned int size, z_value_t *context_object);
+
+    z_value_t *object_manager_create_box(z_value_t *context_object);
+
+    void object_manager_collect_garbage(z_value_t *context_object);
+
+    void object_manager_collect_young(z_value_t *context_object);
 
-    z_fnc_ref_t* object_manager_create_fn_ref(uint64_t instruction_index, z_value_t *context_object);
+    // at the end of every run, at debug level unless they were asked for
+    void object_manager_log_statistics();
 
-    void object_manager_register_string(z_value_t value);
+    void object_manager_enable_statistics(bool enabled);
 
     z_value_t* object_manager_create_object(string *type_ident, unsigned int size);
 
@@ -7,13 +7,13 @@
  */
 namespace zero {
 
-    z_value_t native_print();
+    z_value_t native_print(z_value_t *arguments, uint64_t argument_count);
 
     inline void push(z_value_t value);
 
     inline z_value_t pop();
 
-    inline z_value_t *alloc(unsigned int size);
+    inline z_value_t *alloc(unsigned int size, z_value_t *context_object);
 
     inline z_value_t uvalue(uint64_t _val);
 
@@ -21,18 +21,33 @@ namespace zero {
 
     inline z_value_t bvalue(int32_t _val);
 
-    inline z_value_t dvalue(float _val);
+    inline z_value_t dvalue(double _val);
+
+    inline double decimal_of(z_value_t *value);
 
     inline z_value_t pvalue(void *_val);
 
     inline z_value_t svalue(string *_val);
 
-    inline z_value_t fvalue(unsigned int instruction_index, z_value_t *context_object);
+    inline z_value_t fvalue(uint64_t instruction_index, uint32_t capture_count, z_value_t *context_object);
+
+    inline z_value_t nfvalue(uint32_t native_index);
+
+    z_native_fnc_t get_native_fnc_of(z_value_t native);
+
+    // gives the calling thread an instance if it has none, and empties its stack for a run from the root function
+    void begin_run();
+
+    // the root function returns its context here
+    void leave_root_context(z_value_t *context_object);
+
+    // the tiered execution's part of the instance
+    void free_tiering(z_vm_instance_t *instance);
 
-    void init_native_functions();
+    void init_string_constants(Program *program);
 
-    z_native_fnc_t get_native_fnc_at(uint64_t index);
+    void init_string_constants(const vector<string> &values);
 
-    vector<z_native_fnc_t> get_native_functions();
+    string *get_string_constant_at(uint64_t index);
 
 }
\ No newline at end of file
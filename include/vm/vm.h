@@ -3,27 +3,44 @@
 #include <common/program.h>
 #include <common/logger.h>
 
-#define STACK_MAX 10000
+// in values. the stack is reserved at once and mapped as it is used, see vm_create_instance
+#define STACK_MAX (1 << 24)
+// in bytes, left unmapped on each side of the stack
+#define STACK_GUARD_SIZE (1 << 20)
 
 #define PRIMITIVE_TYPE_INT 1
 #define PRIMITIVE_TYPE_DOUBLE 2
 #define PRIMITIVE_TYPE_BOOLEAN 3
 #define PRIMITIVE_TYPE_NULL 4
 
+// values are nan-boxed. a pointer is stored as it is, its top 16 bits are always 0. ints, booleans, null and the
+// indexes of native functions keep their payload in the low 32 bits and one of these in the high 32 bits. a double
+// is stored with DOUBLE_ENCODE_OFFSET added to its bits, which moves every double out of these two ranges. the tags
+// are nans that are never produced by the arithmetic, as it is only done on the decoded doubles and nans are
+// canonicalized
+#define VALUE_TAG_INT 0xffff0000u
+#define VALUE_TAG_BOOLEAN 0xfffe0000u
+#define VALUE_TAG_NULL 0xfffd0000u
+#define VALUE_TAG_NATIVE 0xfffc0000u
+#define DOUBLE_ENCODE_OFFSET (1ull << 49)
+
+// thread_local goes through a wrapper function when it is used from another file, __thread does not
+#ifdef __GNUC__
+#define VM_THREAD_LOCAL __thread
+#else
+#define VM_THREAD_LOCAL thread_local
+#endif
+
 namespace zero {
 
     typedef struct {
         union {
             uint64_t uint_value;
-            int32_t int_value;
             struct {
                 // TODO: endianness !!!!!
-                uint32_t primitive_type;
-                union {
-                    // DO NOT USE THEM EXCEPT FOR CALCULATIONS
-                    int32_t arithmetic_int_value;
-                    float arithmetic_decimal_value;
-                };
+                // DO NOT USE IT EXCEPT FOR CALCULATIONS
+                int32_t arithmetic_int_value;
+                uint32_t tag;
             };
             string *string_value;
             void *ptr_value;
@@ -45,14 +62,112 @@ namespace zero {
 
     extern Logger vm_log;
 
-    // for parameter passing, return address etc
-    extern int64_t stack_pointer;
-    extern z_value_t value_stack[STACK_MAX];
+    // a native function reads its arguments where the caller has put them, they are not popped
+    typedef z_value_t (*z_native_fnc_t)(z_value_t *arguments, uint64_t argument_count);
+
+    struct z_heap;
+    struct z_vm_tiering;
+
+    /**
+     * everything a running program owns. an instance runs on one thread at a time, and different instances can run
+     * on different threads at once. the run functions below use the instance of the calling thread
+     */
+    typedef struct z_vm_instance {
+        // for parameter passing, return address etc
+        int64_t stack_pointer;
+        z_value_t *value_stack; // STACK_MAX values, it never moves
+        uint64_t stack_mapped; // the values of the stack that can be used, touching the next ones maps more
+        struct z_heap *heap; // the object manager's
+        vector<z_native_fnc_t> natives;
+        vector<string *> string_constants;
+        vector<uint64_t> code; // the instructions prepared for the interpreters
+        char *output_buffer;
+        size_t output_length;
+        size_t output_capacity;
+        bool output_held; // the buffer grows instead of going out, see vm_hold_output
+        bool output_line_buffered; // every print goes out right away, see vm_set_output_line_buffered
+        struct z_vm_tiering *tiering; // the tiered execution's, null until it runs
+        bool keeps_globals; // the context of the root function outlives its return, for vm_call
+        z_value_t *globals; // that context, once the root function returned
+        vector<z_value_t> handles; // the objects vm_call returned to the host, roots until vm_release
+    } z_vm_instance_t;
+
+    extern VM_THREAD_LOCAL z_vm_instance_t *vm_instance;
+
+    // it has the natives registered until now
+    z_vm_instance_t *vm_create_instance();
+
+    // flushes its output and frees everything it owns. it must not be running
+    void vm_destroy_instance(z_vm_instance_t *instance);
+
+    // the instance the calling thread runs the programs in, from now on. a thread that runs a program without one
+    // is given its own
+    void vm_use_instance(z_vm_instance_t *instance);
+
+    class TypeInfo;
+
+    typedef struct {
+        string name;
+        vector<TypeInfo *> parameter_types;
+        TypeInfo *return_type;
+        z_native_fnc_t handler;
+    } z_native_fnc_info_t;
+
+    /**
+     * natives are declared as the first globals, in the order they are registered, so they have to be registered
+     * before the program is compiled, and before the instances that run it are created. print is always there
+     */
+    void vm_register_native(const string &name, const vector<TypeInfo *> &parameter_types, TypeInfo *return_type,
+                            z_native_fnc_t handler);
 
-    // a native function manages stack manually. no calling convention yet
-    typedef z_value_t (*z_native_fnc_t)();
+    const vector<z_native_fnc_info_t> &vm_get_natives();
 
-    void vm_run(Program *program);
+    enum JitTier {
+        JIT_TIER_BASELINE,   // context threaded, every opcode calls its handler
+        JIT_TIER_OPTIMIZING  // register allocated slots, inlined arithmetic and branches
+    };
+
+    // print is buffered in the instance until the buffer is full or the program ends. line buffered output goes out
+    // on every print, for interactive use. it is set for the instance of the calling thread
+    void vm_set_output_line_buffered(bool line_buffered);
+
+    // the counters of the collector are logged at info level at the end of every run, instead of at debug level.
+    // it is set for the whole process, before the programs run
+    void vm_set_gc_statistics(bool enabled);
+
+    // the output of the instance of the calling thread
+    void vm_flush_output();
+
+    // keeps the output of the calling thread's instance, however long it gets, until vm_release_output writes it
+    // at once. the executor uses it so that the output of the jobs running at the same time does not interleave
+    void vm_hold_output();
+
+    void vm_release_output();
+
+    void vm_run(Program *program, JitTier tier = JIT_TIER_OPTIMIZING);
 
     void vm_interpret(Program *program);
+
+    // runs a file written by --emit-bytecode, without compiling anything. see vm/bytecode.h
+    void vm_interpret_bytecode(const string &file_name);
+
+    // the same interpreter on 32 bit words, with the unused operands left out. denser, but cannot tier up
+    void vm_interpret_compact(Program *program);
+
+    // starts in the interpreter, and compiles the functions that are called or loop more than the threshold
+    void vm_run_tiered(Program *program, uint64_t hot_threshold);
+
+    /**
+     * runs the top level of the program in the instance of the calling thread and keeps its globals, so that the
+     * functions it defines can be called with vm_call. interpreted, or tiered when the threshold is not 0. once per
+     * instance
+     */
+    void vm_load(Program *program, uint64_t hot_threshold);
+
+    // calls a function reference of the loaded program, in the same tier. the functions compiled by a call stay
+    // compiled for the next ones. an object in the result stays alive, and where it is, until it is released
+    z_value_t vm_call(z_value_t function, const z_value_t *arguments, uint64_t argument_count);
+
+    // the collector can free an object vm_call returned again. anything else is ignored
+    void vm_release(z_value_t value);
 }
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <common/program.h>
+#include <vm/vm.h>
+
+using namespace std;
+
+/**
+ * running zero from a host program: a script is compiled once, an instance runs its top level and keeps its globals,
+ * and the functions it defined are then called from c++ as many times as needed, without compiling anything again.
+ * the natives have to be registered before the first script is compiled, see vm_register_native
+ */
+namespace zero {
+
+    class Script {
+    public:
+        class Impl;
+
+        static Script *compileFile(const string &fileName);
+
+        // the file name is only for the messages
+        static Script *compileSource(const string &source, const string &fileName);
+
+        // with its program
+        ~Script();
+
+        // a variable declared at the top level, null if there is none with that name
+        const GlobalSymbol *lookup(const string &name);
+
+        Program *getProgram();
+
+    private:
+        explicit Script(Program *program);
+
+        Impl *impl;
+    };
+
+    /**
+     * a vm instance with the top level of a script run in it. it runs on one thread at a time, the instances of the
+     * same script can run on different threads at once. the script must outlive its instances
+     */
+    class ScriptInstance {
+    public:
+        class Impl;
+
+        // tiered like the command line, or only interpreted when the threshold is 0
+        explicit ScriptInstance(Script *script, uint64_t jitThreshold = 1000);
+
+        ~ScriptInstance();
+
+        // a vm error still exits the process, as it does for a whole program, and so does a global lookup did not
+        // find. an object in the result is kept until it is released
+        z_value_t call(const GlobalSymbol *function, const vector<z_value_t> &arguments);
+
+        void release(z_value_t result);
+
+        z_value_t get(const GlobalSymbol *global);
+
+        // how print would write it
+        string stringOf(z_value_t value);
+
+        // print goes out on every call instead of when the buffer of the instance is full
+        void setLineBuffered(bool lineBuffered);
+
+    private:
+        Impl *impl;
+    };
+
+    z_value_t int_value(int32_t value);
+
+    z_value_t decimal_value(double value);
+
+    z_value_t boolean_value(bool value);
+
+    z_value_t null_value();
+
+    int32_t value_as_int(z_value_t value);
+
+    double value_as_decimal(z_value_t value);
+
+    bool value_as_boolean(z_value_t value);
+
+    bool value_is_null(z_value_t value);
+}
@@ -0,0 +1,39 @@
+#!/bin/bash
+
+# compares the wide and the compact bytecode of the interpreter on every test file, the table is also written
+# into bench_output.txt
+
+binary=./cmake-build-debug-mingw/zero.exe
+binary_linux=./cmake-build-debug-remote-host/zero
+
+runs=${RUNS:-5}
+
+# best of the runs, in seconds
+measure() {
+  local best=""
+  for ((i = 0; i < runs; i++)); do
+    local begin=$(date +%s%N)
+    $binary "$@" >/dev/null 2>&1
+    local end=$(date +%s%N)
+    local elapsed=$((end - begin))
+    if [ -z "$best" ] || [ $elapsed -lt $best ]; then
+      best=$elapsed
+    fi
+  done
+  awk "BEGIN { printf \"%.4f\", $best / 1000000000 }"
+}
+
+if [[ "$OSTYPE" == "linux-gnu"* ]]; then
+  binary=$binary_linux
+fi
+
+{
+  printf "%-24s %10s %10s %8s\n" "test" "wide" "compact" "speedup"
+  for test_file_path in test_files/*.ze; do
+    name=$(basename "$test_file_path" .ze)
+    wide=$(measure "$test_file_path" --interpret)
+    compact=$(measure "$test_file_path" --compact)
+    speedup=$(awk "BEGIN { if ($compact > 0) printf \"%.2f\", $wide / $compact; else print \"-\" }")
+    printf "%-24s %10s %10s %8s\n" "$name" "$wide" "$compact" "$speedup"
+  done
+} | tee bench_output.txt
@@ -2,8 +2,28 @@
 
 binary=./cmake-build-debug-mingw/zero.exe
 binary_linux=./cmake-build-debug-remote-host/zero
+host_binary=./cmake-build-debug-mingw/zero_embedding_test.exe
+host_binary_linux=./cmake-build-debug-remote-host/zero_embedding_test
 
 
+run_mode() {
+  local mode_name="$1"
+  local test_file_path="$2"
+  local expected_content_path="$3"
+  local expected_content="$4"
+  shift 4
+
+  $binary "$test_file_path" "$@" 2>/dev/null | tr -d '\r' > tmp.txt
+  local result="$(cat tmp.txt)"
+
+  if [ "$expected_content" = "$result" ]; then
+      echo " Passed ($mode_name)"
+  else
+      echo " FAILED ($mode_name)"
+      diff "$expected_content_path" tmp.txt
+  fi
+}
+
 test() {
   echo "=============================================================="
   echo "testing $1 ... ($binary)"
@@ -12,31 +32,51 @@ test() {
   local expected_content_path="test_expected/$1.txt"
   local expected_content="$(cat $expected_content_path  | tr -d '\r')"
 
-  $binary "$test_file_path" --interpret 2>/dev/null | tr -d '\r' > tmp.txt
-  local result="$(cat tmp.txt)"
+  run_mode "interpreted mode" "$test_file_path" "$expected_content_path" "$expected_content" --interpret
+  run_mode "unoptimized interpreted mode" "$test_file_path" "$expected_content_path" "$expected_content" -O0 --interpret
+  run_mode "jump optimized interpreted mode" "$test_file_path" "$expected_content_path" "$expected_content" -O1 --interpret
+  run_mode "compact interpreted mode" "$test_file_path" "$expected_content_path" "$expected_content" --compact
+  $binary "$test_file_path" --emit-bytecode=tmp.zbc 2>/dev/null
+  run_mode "bytecode file mode" tmp.zbc "$expected_content_path" "$expected_content" --interpret
+  run_mode "tiered bytecode file mode" tmp.zbc "$expected_content_path" "$expected_content" --jit-threshold=1
+  $binary "$test_file_path" --interpret --cache-dir=tmp_cache >/dev/null 2>&1
+  run_mode "compile cache mode" "$test_file_path" "$expected_content_path" "$expected_content" --cache-dir=tmp_cache
+  run_mode "tiered mode" "$test_file_path" "$expected_content_path" "$expected_content"
+  run_mode "tiered mode, compile at first call" "$test_file_path" "$expected_content_path" "$expected_content" --jit-threshold=1
+  run_mode "jit mode" "$test_file_path" "$expected_content_path" "$expected_content" --jit
+  run_mode "baseline jit mode" "$test_file_path" "$expected_content_path" "$expected_content" --baseline-jit
+  # the same program 4 times on 2 threads, the outputs must come one after another
+  printf '%s\n%s\n%s\n%s\n' "$expected_content" "$expected_content" "$expected_content" "$expected_content" > tmp_jobs.txt
+  run_mode "jobs mode" "$test_file_path" tmp_jobs.txt "$(cat tmp_jobs.txt)" --jobs 2 --interpret \
+    "$test_file_path" "$test_file_path" "$test_file_path"
+  run_mode "tiered jobs mode" "$test_file_path" tmp_jobs.txt "$(cat tmp_jobs.txt)" --jobs 2 --jit-threshold=1 \
+    "$test_file_path" "$test_file_path" "$test_file_path"
 
-  if [ "$expected_content" = "$result" ]; then
-      echo " Passed (interpreted mode)"
-  else
-      echo " FAILED (interpreted mode)"
-      diff "$expected_content_path" tmp.txt
-  fi
-
-  $binary "$test_file_path" 2>/dev/null | tr -d '\r' > tmp.txt
-  local result="$(cat tmp.txt)"
+  rm -r tmp.txt tmp.zbc tmp_cache tmp_jobs.txt
+}
 
-  if [ "$expected_content" = "$result" ]; then
-      echo " Passed (jit mode)"
-  else
-      echo " FAILED (jit mode)"
-      diff "$expected_content_path" tmp.txt
-  fi
+# test_host/embedding.cpp, with the jit threshold it is given
+test_embedding() {
+  echo "=============================================================="
+  echo "testing embedding ... ($host_binary)"
 
+  local expected_content_path="test_expected/embedding.txt"
+  local expected_content="$(cat $expected_content_path  | tr -d '\r')"
+  for threshold in 0 1 1000; do
+    $host_binary $threshold 2>/dev/null | tr -d '\r' > tmp.txt
+    if [ "$expected_content" = "$(cat tmp.txt)" ]; then
+        echo " Passed (jit threshold $threshold)"
+    else
+        echo " FAILED (jit threshold $threshold)"
+        diff "$expected_content_path" tmp.txt
+    fi
+  done
   rm tmp.txt
 }
 
 if [[ "$OSTYPE" == "linux-gnu"* ]]; then
   binary=$binary_linux
+  host_binary=$host_binary_linux
 fi
 
 test "hello"
@@ -47,3 +87,15 @@ test "functions"
 test "recursive"
 test "type_parameters"
 test "named_functions"
+test "comparisons"
+test "garbage_collection"
+test "escape_analysis"
+test "closures"
+test "string_building"
+test "calling_convention"
+test "decimals"
+test "deep_recursion"
+test "constant_folding"
+test "tiered_root"
+test "native_references"
+test_embedding
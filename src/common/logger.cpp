@@ -14,13 +14,24 @@ namespace zero {
         void doLog(int priority, const char *format, va_list args) const {
             if (priority >= level) {
                 time_t now = time(nullptr);
-                tm *localTime = localtime(&now);
-                string timeStr = string(asctime(localTime));
-                timeStr.pop_back();
-                fprintf(stderr, "%s, %s, [%s]: ", timeStr.c_str(), name.c_str(), LOG_LEVEL_MAP[priority].c_str());
-                vfprintf(stderr, format, args);
+                tm localTime{};
+                // the reentrant ones, vm instances log from their own threads
+#ifdef _WIN32
+                localtime_s(&localTime, &now);
+#else
+                localtime_r(&now, &localTime);
+#endif
+                char timeStr[32];
+                strftime(timeStr, sizeof(timeStr), "%a %b %e %H:%M:%S %Y", &localTime);
+                // a line is written at once, the lines of different threads do not mix
+                va_list measured;
+                va_copy(measured, args);
+                string message(vsnprintf(nullptr, 0, format, measured), '\0');
+                va_end(measured);
+                vsnprintf(&message[0], message.size() + 1, format, args);
                 va_end(args);
-                fprintf(stderr, "\n");
+                fprintf(stderr, "%s, %s, [%s]: %s\n", timeStr, name.c_str(), LOG_LEVEL_MAP[priority].c_str(),
+                        message.c_str());
             }
         }
     };
@@ -4,6 +4,7 @@
 #include <compiler/op.h>
 
 #include <map>
+#include <set>
 
 using namespace std;
 
@@ -44,6 +45,34 @@ namespace zero {
         }
     };
 
+    /**
+     * slots at the end of the frame, where calls put the function reference and the arguments for the callee frame.
+     * they are numbered from WINDOW_BEGIN while the function is generated, since the size of the frame is not known
+     * until its end, and moved right after the other slots then
+     */
+    class WindowAllocator {
+    private:
+        unsigned int top = 0;
+        unsigned int maxSize = 0;
+    public:
+        static const unsigned int WINDOW_BEGIN = 1 << 24;
+
+        unsigned int alloc(unsigned int count) {
+            unsigned int index = WINDOW_BEGIN + top;
+            top += count;
+            maxSize = max(maxSize, top);
+            return index;
+        }
+
+        void release(unsigned int count) {
+            top -= count;
+        }
+
+        unsigned int size() const {
+            return maxSize;
+        }
+    };
+
     static string *programEntryLabel = new string(" .programEntry");
 
     class ByteCodeGenerator::Impl {
@@ -75,6 +104,7 @@ namespace zero {
         vector<LoopLabelInfoStruct> loopsStack; // this is useful to generate break and continue codes
 
         map<string, TempVariableAllocator *> tempVariableAllocatorMap;
+        map<string, WindowAllocator *> windowAllocatorMap;
 
         void errorExit(const string &error) {
             log.error(error.c_str());
@@ -101,10 +131,21 @@ namespace zero {
             return tempVariableAllocatorMap[currentContextType];
         }
 
+        WindowAllocator *currentWindowAllocator() {
+            auto currentContextType = currentFunctionAst()->program->contextObjectTypeName;
+            return windowAllocatorMap[currentContextType];
+        }
+
         TypeInfo *type(const string &name) const {
             return typeInfoRepository->findTypeByName(name);
         }
 
+        // captured by the children through a box on the heap, rather than the address of the slot
+        bool isBoxed(unsigned int memoryIndex) {
+            return currentFunctionAst()->hasEscapingChildren &&
+                   currentFunctionAst()->program->cellSlots.count(memoryIndex);
+        }
+
         static Operator *getOp(string name, int operandCount) {
             return Operator::getBy(std::move(name), operandCount);
         }
@@ -116,6 +157,7 @@ namespace zero {
             globalFnc->fileName = programAstNode->fileName;
             globalFnc->line = 0;
             globalFnc->pos = 0;
+            globalFnc->hasEscapingChildren = true; // globals live as long as the program
 
             visitFunction(globalFnc);
 
@@ -123,28 +165,36 @@ namespace zero {
             for (auto &sub: subroutinePrograms) {
                 rootProgram->merge(sub);
             }
+            addGlobals(programAstNode);
 
             return rootProgram;
         }
 
 
-        Program *onFunctionEnter(FunctionAstNode *functionAstNode, string *label) {
-            auto parentFunction = currentFunctionAst();
-            if (parentFunction != nullptr) {
-                // the parent does have a child, we (unfortunately) have to alloc its temporary variables from the heap!
-                parentFunction->isLeafFunction = false;
+        // the variables the source declares at the top level, not the natives, the immediates or the temporaries
+        void addGlobals(ProgramAstNode *programAstNode) {
+            auto contextObjectType = type(programAstNode->contextObjectTypeName);
+            for (auto &property: contextObjectType->getProperties()) {
+                if (property.first.empty() || property.first[0] == '$') continue;
+                for (auto &overload: property.second->allOverloads()) {
+                    if (overload.type->isNative) continue;
+                    auto index = (uint64_t) overload.index;
+                    rootProgram->addGlobal({property.first, index, programAstNode->cellSlots.count(index) != 0});
+                }
             }
+        }
 
+        Program *onFunctionEnter(FunctionAstNode *functionAstNode, string *label) {
             auto sub = new Program(functionAstNode->fileName);
             sub->addLabel(label);
             sub->addLabel(programEntryLabel);
             subroutinePrograms.push_back(sub);
             programsStack.push_back(sub);
             functionAstStack.push_back(functionAstNode);
-            functionAstNode->isLeafFunction = true; // set it as leaf for now
 
             tempVariableAllocatorMap[functionAstNode->program->contextObjectTypeName] =
                     (new TempVariableAllocator(type(functionAstNode->program->contextObjectTypeName)));
+            windowAllocatorMap[functionAstNode->program->contextObjectTypeName] = new WindowAllocator();
 
             return sub;
         }
@@ -169,7 +219,7 @@ namespace zero {
             } else if (typeName == TypeInfo::DECIMAL.name) {
                 currentProgram()->addInstruction(
                         (new Instruction())->withOpCode(MOV_DECIMAL)
-                                ->withOp1((float) atof(immediateData.c_str()))
+                                ->withOp1(atof(immediateData.c_str()))
                                 ->withDestination(preferredIndex)
                                 ->withComment("load decimal into index " + to_string(preferredIndex) +
                                               " in the current frame - " + immediateData)
@@ -207,10 +257,12 @@ namespace zero {
                 parentProgram->addInstruction(
                         (new Instruction())->withOpCode(MOV_FNC)
                                 ->withOp1(fnLabel)
+                                ->withOp2((unsigned int) function->upvalues.size())
                                 ->withDestination(preferredIndex)
                                 ->withComment("mov function address to index " + to_string(preferredIndex) +
                                               " in the current frame")
                 );
+                generateCaptures(function, preferredIndex);
             }
             onFunctionEnter(function, fnLabel);
 
@@ -218,29 +270,30 @@ namespace zero {
             generateImmediates(contextObjectType);
 
             // --- function body
-            for (int i = 0; i < function->arguments->size(); i++) {
-                auto argPair = function->arguments->at(i);
-                auto argIndex = contextObjectType->getProperty(argPair.first)->firstOverload().index;
-                currentProgram()->addInstruction(
-                        (new Instruction())
-                                ->withOpCode(ARG_READ)
-                                ->withOp1((unsigned int) (function->arguments->size() - i - 1))
-                                ->withDestination(argIndex)
-                                ->withComment(
-                                        "getting argument at index " + to_string(i) + " into " + to_string(argIndex))
-                );
+            // the arguments are already in the frame, the caller has put them right after the function reference
+            for (unsigned int i = 0; i < function->arguments->size(); i++) {
+                auto argIndex = contextObjectType->getProperty(function->arguments->at(i).first)->firstOverload().index;
+                if (argIndex != i + 1) {
+                    errorExit("argument " + function->arguments->at(i).first + " is not at its place in the frame");
+                }
             }
 
+            generateBoxes(function);
+
             visitProgram(function->program);
 
             // ----- exit
 
             unsigned int functionContextObjectSize = contextObjectType->getPropertyCount();
+            currentProgram()->moveSlots(WindowAllocator::WINDOW_BEGIN, functionContextObjectSize);
+            functionContextObjectSize += currentWindowAllocator()->size();
 
+            // nothing points to the frame after the call but the children that run during it.
+            // only the globals are kept in the heap, for the natives that call back
             currentProgram()->addInstructionAt(
-                    (new Instruction())->withOpCode(
-                                    currentFunctionAst()->isLeafFunction ? FN_ENTER_STACK : FN_ENTER_HEAP)
+                    (new Instruction())->withOpCode(functionAstStack.size() == 1 ? FN_ENTER_HEAP : FN_ENTER_STACK)
                             ->withOp1(functionContextObjectSize)
+                            ->withOp2((unsigned int) function->arguments->size())
                             ->withComment("allocate call frame that is " + to_string(functionContextObjectSize) +
                                           " values big"),
                     *programEntryLabel);
@@ -256,6 +309,76 @@ namespace zero {
             return preferredIndex;
         }
 
+        // fills the captures of the new function reference at index functionIndex, in the parent
+        void generateCaptures(FunctionAstNode *function, unsigned int functionIndex) {
+            for (unsigned int i = 0; i < function->upvalues.size(); i++) {
+                auto upvalue = function->upvalues[i];
+                unsigned short opCode;
+                if (upvalue.fromParentUpvalues) {
+                    opCode = CAPTURE_UPVALUE;
+                } else if (upvalue.isCell && !isBoxed(upvalue.sourceIndex)) {
+                    opCode = CAPTURE_CELL;
+                } else {
+                    // a value, or the address of a box
+                    opCode = CAPTURE;
+                }
+                currentProgram()->addInstruction(
+                        (new Instruction())->withOpCode(opCode)
+                                ->withOp1(i)
+                                ->withOp2(upvalue.sourceIndex)
+                                ->withDestination(functionIndex)
+                                ->withComment("capture " + to_string(upvalue.sourceIndex) +
+                                              (upvalue.fromParentUpvalues ? " of the captures" : " of the current frame") +
+                                              " into the function at index " + to_string(functionIndex))
+                );
+            }
+        }
+
+        // moves the variables that escaping children capture into boxes, at the beginning of the function
+        void generateBoxes(FunctionAstNode *function) {
+            if (!function->hasEscapingChildren) return;
+            TypeInfo *contextObjectType = type(function->program->contextObjectTypeName);
+            set<unsigned int> argumentIndexes;
+            for (auto &argPair: *function->arguments) {
+                argumentIndexes.insert(contextObjectType->getProperty(argPair.first)->firstOverload().index);
+            }
+            for (auto cellIndex: function->program->cellSlots) {
+                if (!argumentIndexes.count(cellIndex)) {
+                    currentProgram()->addInstruction(
+                            (new Instruction())->withOpCode(MOV_NULL)
+                                    ->withDestination(cellIndex)
+                                    ->withComment("null value for the box at index " + to_string(cellIndex))
+                    );
+                }
+                currentProgram()->addInstruction(
+                        (new Instruction())->withOpCode(MOV_BOX)
+                                ->withDestination(cellIndex)
+                                ->withComment("box the value at index " + to_string(cellIndex))
+                );
+            }
+        }
+
+        // writes the value at valueIndex into a boxed variable of the current function, or a captured cell
+        void generateSetCell(AtomicExpressionAstNode *target, unsigned int valueIndex) {
+            if (target->memoryDepth == 0) {
+                currentProgram()->addInstruction(
+                        (new Instruction())->withOpCode(SET_CELL)
+                                ->withOp1(valueIndex)
+                                ->withDestination(target->memoryIndex)
+                                ->withComment("set value at index " + to_string(valueIndex) + " into the box at index " +
+                                              to_string(target->memoryIndex) + " (" + target->data + ")")
+                );
+            } else {
+                currentProgram()->addInstruction(
+                        (new Instruction())->withOpCode(SET_UPVALUE_CELL)
+                                ->withOp1((unsigned int) target->upvalueIndex)
+                                ->withOp2(valueIndex)
+                                ->withComment("set value at index " + to_string(valueIndex) + " into captured cell " +
+                                              to_string(target->upvalueIndex) + " (" + target->data + ")")
+                );
+            }
+        }
+
         unsigned int visitAtom(AtomicExpressionAstNode *atomic,
                                unsigned int preferredIndex = 0,
                                TypeInfo *preferredOverload = nullptr
@@ -287,20 +410,31 @@ namespace zero {
                             memoryIndex = atomic->propertyInfo->indexOfOverloadOrMinusOne(preferredOverload);
                         }
                     }
-                    if (atomic->memoryDepth == 0) {
+                    if (atomic->memoryDepth == 0 && !isBoxed(memoryIndex)) {
                         // in the current frame, simple, say its address relative to current frame
                         return memoryIndex;
+                    } else if (atomic->memoryDepth == 0) {
+                        // in a box that the current frame points to
+                        currentProgram()->addInstruction(
+                                (new Instruction())
+                                        ->withOpCode(GET_CELL)
+                                        ->withOp1(memoryIndex)
+                                        ->withDestination(preferredIndex)
+                                        ->withComment(
+                                                "getting the value in the box at index " + to_string(memoryIndex) +
+                                                " into index " + to_string(preferredIndex) + " (" + atomic->data + ")")
+                        );
+                        return preferredIndex;
                     } else {
-                        // in a parent frame
+                        // in a parent frame, captured by the function reference
+                        auto upvalue = currentFunctionAst()->upvalues[atomic->upvalueIndex];
                         currentProgram()->addInstruction(
                                 (new Instruction())
-                                        ->withOpCode(GET_IN_PARENT)
-                                        ->withOp1(atomic->memoryDepth)
-                                        ->withOp2(memoryIndex)
+                                        ->withOpCode(upvalue.isCell ? GET_UPVALUE_CELL : GET_UPVALUE)
+                                        ->withOp1((unsigned int) atomic->upvalueIndex)
                                         ->withDestination(preferredIndex)
                                         ->withComment(
-                                                "getting the value at index " + to_string(memoryIndex)
-                                                + " at parent with depth " + to_string(atomic->memoryDepth) +
+                                                "getting the captured value " + to_string(atomic->upvalueIndex) +
                                                 " into index " + to_string(preferredIndex) + " in the current frame (" +
                                                 atomic->data + ")"
                                         )
@@ -321,31 +455,46 @@ namespace zero {
             return atomic->memoryIndex;
         }
 
-        unsigned int visitFunctionCall(FunctionCallExpressionAstNode *functionCall,
-                                       unsigned int preferredIndex
-        ) {
-            unsigned int tempIndex = currentTempVariableAllocator()->alloc();
-            for (unsigned int i = 0; i < functionCall->params->size(); i++) {
-                ExpressionAstNode *param = functionCall->params->at(i);
-                unsigned int paramValueIndex = visitExpression(param, tempIndex);
+        // evaluates the expression into the given index, rather than wherever it happens to be
+        void visitExpressionInto(ExpressionAstNode *expression, unsigned int index,
+                                 TypeInfo *preferredOverload = nullptr) {
+            unsigned int valueIndex = visitExpression(expression, index, preferredOverload);
+            if (valueIndex != index) {
                 currentProgram()->addInstruction(
-                        (new Instruction())->withOpCode(PUSH)
-                                ->withOp1(paramValueIndex)
-                                ->withComment("pushing param number " + to_string(i) + " which is at index " +
-                                              to_string(paramValueIndex))
+                        (new Instruction())->withOpCode(MOV)
+                                ->withOp1(valueIndex)
+                                ->withDestination(index)
+                                ->withComment("mov value at index " + to_string(valueIndex) + " into index " +
+                                              to_string(index) + " in the current frame")
                 );
             }
-            currentTempVariableAllocator()->release(tempIndex);
+        }
+
+        unsigned int visitFunctionCall(FunctionCallExpressionAstNode *functionCall,
+                                       unsigned int preferredIndex
+        ) {
+            unsigned int paramCount = functionCall->params->size();
             auto functionType = functionCall->preferredCalleeOverload;
             auto opCode = functionType->isNative ? CALL_NATIVE : CALL;
+            // the function reference and the params. the callee frame begins with them, after its header.
+            // natives read them in place and have no frame
+            unsigned int headerSize = functionType->isNative ? 0 : FRAME_HEADER_SIZE;
+            unsigned int windowSize = headerSize + 1 + paramCount;
+            unsigned int windowIndex = currentWindowAllocator()->alloc(windowSize);
+            unsigned int functionIndex = windowIndex + headerSize;
+            for (unsigned int i = 0; i < paramCount; i++) {
+                visitExpressionInto(functionCall->params->at(i), functionIndex + 1 + i);
+            }
+            visitExpressionInto(functionCall->left, functionIndex, functionType);
+            currentWindowAllocator()->release(windowSize);
 
-            unsigned int functionIndex = visitExpression(functionCall->left, preferredIndex, functionType);
             currentProgram()->addInstruction(
                     (new Instruction())->withOpCode(opCode)
                             ->withOp1(functionIndex)
-                            ->withOp2(functionCall->params->size())
+                            ->withOp2(paramCount)
                             ->withDestination(preferredIndex)
-                            ->withComment("calling functionCall at index " + to_string(functionIndex))
+                            ->withComment("calling function at index " + to_string(functionIndex) + " with " +
+                                          to_string(paramCount) + " params after it")
             );
 
             return preferredIndex;
@@ -358,10 +507,9 @@ namespace zero {
                 unsigned int memoryDepth = binary->left->memoryDepth;
                 unsigned int memoryIndex = binary->left->memoryIndex;
 
-                unsigned int valueIndex = visitExpression(binary->right, memoryIndex);
-
-                if (memoryDepth == 0) {
+                if (memoryDepth == 0 && !isBoxed(memoryIndex)) {
                     // set in current context
+                    unsigned int valueIndex = visitExpression(binary->right, memoryIndex);
                     if (valueIndex != memoryIndex) {
                         currentProgram()->addInstruction(
                                 (new Instruction())->withOpCode(MOV)
@@ -372,16 +520,11 @@ namespace zero {
                         );
                     }
                 } else {
-                    // set in parent context
-                    currentProgram()->addInstruction(
-                            (new Instruction())->withOpCode(SET_IN_PARENT)
-                                    ->withOp1(memoryDepth)
-                                    ->withOp2(valueIndex)
-                                    ->withDestination(memoryIndex)
-                                    ->withComment("set value at parent index with depth " +
-                                                  to_string(memoryDepth) + " and index " + to_string(memoryIndex) +
-                                                  " from index " + to_string(valueIndex) + " in the current frame")
-                    );
+                    // set through a box, or a cell captured from a parent frame
+                    unsigned int tempIndex = currentTempVariableAllocator()->alloc();
+                    unsigned int valueIndex = visitExpression(binary->right, tempIndex);
+                    generateSetCell((AtomicExpressionAstNode *) binary->left, valueIndex);
+                    currentTempVariableAllocator()->release(tempIndex);
                 }
             } else {
                 // DOT assign
@@ -485,109 +628,178 @@ namespace zero {
                 return visitAnd(binary, preferredIndex);
             } else if (op == &Operator::OR) {
                 return visitOr(binary, preferredIndex);
+            } else if (isConcatenation(binary)) {
+                return visitConcatenation(binary, preferredIndex);
+            } else {
+                return visitArithmetic(binary, op, preferredIndex);
+            }
+
+            return 0;
+        }
+
+        static bool isConcatenation(ExpressionAstNode *expression) {
+            return expression->expressionType == ExpressionAstNode::TYPE_BINARY &&
+                   ((BinaryExpressionAstNode *) expression)->opName == "+" &&
+                   expression->resolvedType == &TypeInfo::STRING;
+        }
+
+        static void collectConcatenated(ExpressionAstNode *expression, vector<ExpressionAstNode *> &pieces) {
+            if (isConcatenation(expression)) {
+                auto binary = (BinaryExpressionAstNode *) expression;
+                collectConcatenated(binary->left, pieces);
+                collectConcatenated(binary->right, pieces);
             } else {
-                unsigned int tempValueIndex1 = currentTempVariableAllocator()->alloc();
-                unsigned int tempValueIndex2 = currentTempVariableAllocator()->alloc();
-                unsigned int decimalTempIndex = currentTempVariableAllocator()->alloc();
+                pieces.push_back(expression);
+            }
+        }
+
+        // a chain of string additions is evaluated into consecutive slots and put together by a single instruction,
+        // instead of creating a new string for every addition
+        unsigned int visitConcatenation(BinaryExpressionAstNode *binary, unsigned int preferredIndex) {
+            vector<ExpressionAstNode *> pieces;
+            collectConcatenated(binary, pieces);
+            unsigned int count = pieces.size();
+            if (count < 3) {
+                return visitArithmetic(binary, &Operator::ADD, preferredIndex);
+            }
+            unsigned int windowIndex = currentWindowAllocator()->alloc(count);
+            for (unsigned int i = 0; i < count; i++) {
+                visitExpressionInto(pieces[i], windowIndex + i);
+            }
+            currentWindowAllocator()->release(count);
+            currentProgram()->addInstruction(
+                    (new Instruction())->withOpCode(CONCAT_N)
+                            ->withOp1(windowIndex)
+                            ->withOp2(count)
+                            ->withDestination(preferredIndex)
+                            ->withComment("concatenating " + to_string(count) + " pieces into index " +
+                                          to_string(preferredIndex))
+            );
+            return preferredIndex;
+        }
 
-                unsigned int actualValueIndex1 = visitExpression(binary->left, tempValueIndex1);
-                unsigned int actualValueIndex2 = visitExpression(binary->right, tempValueIndex2);
+        // arithmetic and comparisons. when a jump label is given, the comparison is not stored anywhere but
+        // emitted as a fused compare and jump to the label
+        unsigned int visitArithmetic(BinaryExpressionAstNode *binary, Operator *op,
+                                     unsigned int preferredIndex = 0,
+                                     string *jumpLabel = nullptr,
+                                     bool jumpIfTrue = true
+        ) {
+            unsigned int tempValueIndex1 = currentTempVariableAllocator()->alloc();
+            unsigned int tempValueIndex2 = currentTempVariableAllocator()->alloc();
+            unsigned int decimalTempIndex = currentTempVariableAllocator()->alloc();
 
-                unsigned short opCode = 0;
-                auto typeOfBinary = binary->resolvedType;
-                auto isDecimalOp = binary->left->resolvedType->name == TypeInfo::DECIMAL.name ||
-                                   binary->right->resolvedType->name == TypeInfo::DECIMAL.name;
+            unsigned int actualValueIndex1 = visitExpression(binary->left, tempValueIndex1);
+            unsigned int actualValueIndex2 = visitExpression(binary->right, tempValueIndex2);
 
-                if (isDecimalOp) {
-                    // auto casting
-                    if (binary->left->resolvedType->name == TypeInfo::INT.name) {
-                        currentProgram()->addInstruction(
-                                (new Instruction())->withOpCode(CAST_DECIMAL)
-                                        ->withOp1(actualValueIndex1)
-                                        ->withDestination(decimalTempIndex)
-                                        ->withComment("auto cast from int to decimal")
-                        );
-                        if (actualValueIndex1 != tempValueIndex1) {
-                            currentTempVariableAllocator()->release(tempValueIndex1);
-                        }
-                        actualValueIndex1 = decimalTempIndex;
+            unsigned short opCode = 0;
+            auto typeOfBinary = binary->resolvedType;
+            auto isDecimalOp = binary->left->resolvedType->name == TypeInfo::DECIMAL.name ||
+                               binary->right->resolvedType->name == TypeInfo::DECIMAL.name;
+
+            if (isDecimalOp) {
+                // auto casting
+                if (binary->left->resolvedType->name == TypeInfo::INT.name) {
+                    currentProgram()->addInstruction(
+                            (new Instruction())->withOpCode(CAST_DECIMAL)
+                                    ->withOp1(actualValueIndex1)
+                                    ->withDestination(decimalTempIndex)
+                                    ->withComment("auto cast from int to decimal")
+                    );
+                    if (actualValueIndex1 != tempValueIndex1) {
+                        currentTempVariableAllocator()->release(tempValueIndex1);
                     }
-                    if (binary->right->resolvedType->name == TypeInfo::INT.name) {
-                        currentProgram()->addInstruction(
-                                (new Instruction())->withOpCode(CAST_DECIMAL)
-                                        ->withOp1(actualValueIndex2)
-                                        ->withDestination(decimalTempIndex)
-                                        ->withComment("auto cast from int to decimal")
-                        );
-                        if (actualValueIndex1 != tempValueIndex1) {
-                            currentTempVariableAllocator()->release(tempValueIndex2);
-                        }
-                        actualValueIndex2 = decimalTempIndex;
+                    actualValueIndex1 = decimalTempIndex;
+                }
+                if (binary->right->resolvedType->name == TypeInfo::INT.name) {
+                    currentProgram()->addInstruction(
+                            (new Instruction())->withOpCode(CAST_DECIMAL)
+                                    ->withOp1(actualValueIndex2)
+                                    ->withDestination(decimalTempIndex)
+                                    ->withComment("auto cast from int to decimal")
+                    );
+                    if (actualValueIndex1 != tempValueIndex1) {
+                        currentTempVariableAllocator()->release(tempValueIndex2);
                     }
+                    actualValueIndex2 = decimalTempIndex;
                 }
+            }
 
-                if (op == &Operator::ADD) {
-                    if (typeOfBinary == &TypeInfo::DECIMAL) {
-                        opCode = ADD_DECIMAL;
-                    } else if (typeOfBinary == &TypeInfo::STRING) {
-                        opCode = ADD_STRING;
-                    } else {
-                        opCode = ADD_INT;
-                    }
-                } else if (op == &Operator::SUB) {
-                    if (typeOfBinary == &TypeInfo::DECIMAL) {
-                        opCode = SUB_DECIMAL;
-                    } else {
-                        opCode = SUB_INT;
-                    }
-                } else if (op == &Operator::DIV) {
-                    if (typeOfBinary == &TypeInfo::DECIMAL) {
-                        opCode = DIV_DECIMAL;
-                    } else {
-                        opCode = DIV_INT;
-                    }
-                } else if (op == &Operator::MUL) {
-                    if (typeOfBinary == &TypeInfo::DECIMAL) {
-                        opCode = MUL_DECIMAL;
-                    } else {
-                        opCode = MUL_INT;
-                    }
-                } else if (op == &Operator::MOD) {
-                    if (typeOfBinary == &TypeInfo::DECIMAL) {
-                        opCode = MOD_DECIMAL;
-                    } else {
-                        opCode = MOD_INT;
-                    }
-                } else if (op == &Operator::CMP_E) {
-                    opCode = CMP_EQ;
-                } else if (op == &Operator::CMP_NE) {
-                    opCode = CMP_NEQ;
-                } else if (op == &Operator::GT) {
-                    if (isDecimalOp) {
-                        opCode = CMP_GT_DECIMAL;
-                    } else {
-                        opCode = CMP_GT_INT;
-                    }
-                } else if (op == &Operator::GTE) {
-                    if (isDecimalOp) {
-                        opCode = CMP_GTE_DECIMAL;
-                    } else {
-                        opCode = CMP_GTE_INT;
-                    }
-                } else if (op == &Operator::LT) {
-                    if (isDecimalOp) {
-                        opCode = CMP_LT_DECIMAL;
-                    } else {
-                        opCode = CMP_LT_INT;
-                    }
-                } else if (op == &Operator::LTE) {
-                    if (isDecimalOp) {
-                        opCode = CMP_LTE_DECIMAL;
-                    } else {
-                        opCode = CMP_LTE_INT;
-                    }
+            if (op == &Operator::ADD) {
+                if (typeOfBinary == &TypeInfo::DECIMAL) {
+                    opCode = ADD_DECIMAL;
+                } else if (typeOfBinary == &TypeInfo::STRING) {
+                    opCode = ADD_STRING;
+                } else {
+                    opCode = ADD_INT;
+                }
+            } else if (op == &Operator::SUB) {
+                if (typeOfBinary == &TypeInfo::DECIMAL) {
+                    opCode = SUB_DECIMAL;
+                } else {
+                    opCode = SUB_INT;
+                }
+            } else if (op == &Operator::DIV) {
+                if (typeOfBinary == &TypeInfo::DECIMAL) {
+                    opCode = DIV_DECIMAL;
+                } else {
+                    opCode = DIV_INT;
+                }
+            } else if (op == &Operator::MUL) {
+                if (typeOfBinary == &TypeInfo::DECIMAL) {
+                    opCode = MUL_DECIMAL;
+                } else {
+                    opCode = MUL_INT;
                 }
+            } else if (op == &Operator::MOD) {
+                if (typeOfBinary == &TypeInfo::DECIMAL) {
+                    opCode = MOD_DECIMAL;
+                } else {
+                    opCode = MOD_INT;
+                }
+            } else if (op == &Operator::CMP_E) {
+                opCode = CMP_EQ;
+            } else if (op == &Operator::CMP_NE) {
+                opCode = CMP_NEQ;
+            } else if (op == &Operator::GT) {
+                if (isDecimalOp) {
+                    opCode = CMP_GT_DECIMAL;
+                } else {
+                    opCode = CMP_GT_INT;
+                }
+            } else if (op == &Operator::GTE) {
+                if (isDecimalOp) {
+                    opCode = CMP_GTE_DECIMAL;
+                } else {
+                    opCode = CMP_GTE_INT;
+                }
+            } else if (op == &Operator::LT) {
+                if (isDecimalOp) {
+                    opCode = CMP_LT_DECIMAL;
+                } else {
+                    opCode = CMP_LT_INT;
+                }
+            } else if (op == &Operator::LTE) {
+                if (isDecimalOp) {
+                    opCode = CMP_LTE_DECIMAL;
+                } else {
+                    opCode = CMP_LTE_INT;
+                }
+            }
 
+            if (jumpLabel != nullptr) {
+                currentProgram()->addInstruction(
+                        (new Instruction())
+                                ->withOpCode(toConditionalJump(opCode, jumpIfTrue))
+                                ->withOp1(actualValueIndex1)
+                                ->withOp2(actualValueIndex2)
+                                ->withDestination(jumpLabel)
+                                ->withComment(
+                                        "jmp if " + op->name + " of values at indexes " +
+                                        to_string(actualValueIndex1) + " and " + to_string(actualValueIndex2) +
+                                        " is " + (jumpIfTrue ? "true" : "false"))
+                );
+            } else {
                 currentProgram()->addInstruction(
                         (new Instruction())
                                 ->withOpCode(opCode)
@@ -598,18 +810,95 @@ namespace zero {
                                         op->name + " 2 values at indexes " + to_string(actualValueIndex1) + " and " +
                                         to_string(actualValueIndex2) + " into " + to_string(preferredIndex))
                 );
+            }
 
-                if (actualValueIndex1 != tempValueIndex1) {
-                    currentTempVariableAllocator()->release(tempValueIndex1);
-                }
-                if (actualValueIndex2 != tempValueIndex2) {
-                    currentTempVariableAllocator()->release(tempValueIndex2);
+            if (actualValueIndex1 != tempValueIndex1) {
+                currentTempVariableAllocator()->release(tempValueIndex1);
+            }
+            if (actualValueIndex2 != tempValueIndex2) {
+                currentTempVariableAllocator()->release(tempValueIndex2);
+            }
+            currentTempVariableAllocator()->release(decimalTempIndex);
+            return preferredIndex;
+        }
+
+        static bool isComparison(Operator *op) {
+            return op == &Operator::CMP_E || op == &Operator::CMP_NE || op == &Operator::LT ||
+                   op == &Operator::LTE || op == &Operator::GT || op == &Operator::GTE;
+        }
+
+        static unsigned short toConditionalJump(unsigned short comparisonOpCode, bool jumpIfTrue) {
+            if (!jumpIfTrue) {
+                // only int comparisons and equality are negated. see canFuseIntoJump
+                switch (comparisonOpCode) {
+                    case CMP_EQ:
+                        return JMP_NEQ;
+                    case CMP_NEQ:
+                        return JMP_EQ;
+                    case CMP_GT_INT:
+                        return JMP_LTE_INT;
+                    case CMP_LT_INT:
+                        return JMP_GTE_INT;
+                    case CMP_GTE_INT:
+                        return JMP_LT_INT;
+                    case CMP_LTE_INT:
+                        return JMP_GT_INT;
+                    default:
+                        return NO_OPCODE;
                 }
-                currentTempVariableAllocator()->release(decimalTempIndex);
-                return preferredIndex;
             }
+            switch (comparisonOpCode) {
+                case CMP_EQ:
+                    return JMP_EQ;
+                case CMP_NEQ:
+                    return JMP_NEQ;
+                case CMP_GT_INT:
+                    return JMP_GT_INT;
+                case CMP_GT_DECIMAL:
+                    return JMP_GT_DECIMAL;
+                case CMP_LT_INT:
+                    return JMP_LT_INT;
+                case CMP_LT_DECIMAL:
+                    return JMP_LT_DECIMAL;
+                case CMP_GTE_INT:
+                    return JMP_GTE_INT;
+                case CMP_GTE_DECIMAL:
+                    return JMP_GTE_DECIMAL;
+                case CMP_LTE_INT:
+                    return JMP_LTE_INT;
+                case CMP_LTE_DECIMAL:
+                    return JMP_LTE_DECIMAL;
+                default:
+                    return NO_OPCODE;
+            }
+        }
 
-            return 0;
+        bool canFuseIntoJump(ExpressionAstNode *condition, bool jumpIfTrue) {
+            if (condition->expressionType != ExpressionAstNode::TYPE_BINARY) return false;
+            auto binary = (BinaryExpressionAstNode *) condition;
+            auto op = getOp(binary->opName, 2);
+            if (!isComparison(op)) return false;
+            if (jumpIfTrue || op == &Operator::CMP_E || op == &Operator::CMP_NE) return true;
+            // !(a < b) is not (a >= b) when one of them is NaN, negated decimal comparisons are not fused
+            return binary->left->resolvedType->name != TypeInfo::DECIMAL.name &&
+                   binary->right->resolvedType->name != TypeInfo::DECIMAL.name;
+        }
+
+        // jumps to the label when the condition evaluates to jumpIfTrue
+        void visitConditionalJump(ExpressionAstNode *condition, string *label, bool jumpIfTrue,
+                                  unsigned int preferredIndex, const string &comment) {
+            if (canFuseIntoJump(condition, jumpIfTrue)) {
+                auto binary = (BinaryExpressionAstNode *) condition;
+                visitArithmetic(binary, getOp(binary->opName, 2), preferredIndex, label, jumpIfTrue);
+                return;
+            }
+            unsigned int valueIndex = visitExpression(condition, preferredIndex);
+            currentProgram()->addInstruction(
+                    (new Instruction())->withOpCode(jumpIfTrue ? JMP_TRUE : JMP_FALSE)
+                            ->withOp1(valueIndex)
+                            ->withDestination(label)
+                            ->withComment(comment)
+            );
         }
 
         unsigned int visitPrefix(PrefixExpressionAstNode *prefix,
@@ -694,7 +983,9 @@ namespace zero {
         }
 
         void visitVariable(VariableAstNode *variable) {
-            auto destinationIndex = variable->memoryIndex;
+            // a boxed variable is initialized in a temp, then moved into its box
+            auto isBoxedVariable = isBoxed(variable->memoryIndex);
+            auto destinationIndex = isBoxedVariable ? currentTempVariableAllocator()->alloc() : variable->memoryIndex;
             auto expectedType = variable->resolvedType;
 
             if (variable->initialValue != nullptr) {
@@ -722,7 +1013,7 @@ namespace zero {
                 if (typeObj->name == TypeInfo::DECIMAL.name) {
                     currentProgram()->addInstruction(
                             (new Instruction())->withOpCode(MOV_DECIMAL)
-                                    ->withOp1(0.0f)
+                                    ->withOp1(0.0)
                                     ->withDestination(destinationIndex)
                                     ->withComment(comment)
                     );
@@ -741,6 +1032,18 @@ namespace zero {
                     );
                 }
             }
+
+            if (isBoxedVariable) {
+                currentProgram()->addInstruction(
+                        (new Instruction())->withOpCode(SET_CELL)
+                                ->withOp1(destinationIndex)
+                                ->withDestination(variable->memoryIndex)
+                                ->withComment("set value at index " + to_string(destinationIndex) +
+                                              " into the box at index " + to_string(variable->memoryIndex) +
+                                              " (" + variable->identifier + ")")
+                );
+                currentTempVariableAllocator()->release(destinationIndex);
+            }
         }
 
         void visitIfStatement(IfStatementAstNode *ifStatementAstNode) {
@@ -750,14 +1053,7 @@ namespace zero {
                     "__if_end__" + to_string(ifStatementAstNode->line) + "_" + to_string(ifStatementAstNode->pos));
 
             unsigned tempIndex = currentTempVariableAllocator()->alloc();
-            unsigned int expressionValueIndex = visitExpression(ifStatementAstNode->expression, tempIndex);
-
-            currentProgram()->addInstruction(
-                    (new Instruction())->withOpCode(JMP_FALSE)
-                            ->withOp1(expressionValueIndex)
-                            ->withDestination(ifFalseLabel)
-                            ->withComment("if condition check")
-            );
+            visitConditionalJump(ifStatementAstNode->expression, ifFalseLabel, false, tempIndex, "if condition check");
             currentTempVariableAllocator()->release(tempIndex);
 
             visitProgram(ifStatementAstNode->program);
@@ -813,15 +1109,16 @@ namespace zero {
 
             currentProgram()->addLabel(loopConditionLabel);
             if (loop->loopConditionExpression != nullptr) {
-                actualLoopConditionIndex = visitExpression(loop->loopConditionExpression, loopConditionTempIndex);
+                visitConditionalJump(loop->loopConditionExpression, loopBodyLabel, true, loopConditionTempIndex,
+                                     "loop condition check");
+            } else {
+                currentProgram()->addInstruction(
+                        (new Instruction())->withOpCode(JMP_TRUE)
+                                ->withOp1(actualLoopConditionIndex)
+                                ->withDestination(loopBodyLabel)
+                );
             }
 
-            currentProgram()->addInstruction(
-                    (new Instruction())->withOpCode(JMP_TRUE)
-                            ->withOp1(actualLoopConditionIndex)
-                            ->withDestination(loopBodyLabel)
-            );
-
             currentProgram()->addLabel(loopEndLabel);
 
             loopsStack.pop_back();
@@ -879,8 +1176,22 @@ namespace zero {
         void visitNamedFunctions(ProgramAstNode *program) {
             auto statements = program->statements;
             for (auto stmt: statements) {
-                if (stmt->type == StatementAstNode::TYPE_NAMED_FUNCTION) {
-                    visitFunction(stmt->namedFunction, stmt->namedFunction->memoryIndex);
+                if (stmt->type != StatementAstNode::TYPE_NAMED_FUNCTION) continue;
+                auto memoryIndex = stmt->namedFunction->memoryIndex;
+                if (isBoxed(memoryIndex)) {
+                    unsigned int tempIndex = currentTempVariableAllocator()->alloc();
+                    visitFunction(stmt->namedFunction, tempIndex);
+                    currentProgram()->addInstruction(
+                            (new Instruction())->withOpCode(SET_CELL)
+                                    ->withOp1(tempIndex)
+                                    ->withDestination(memoryIndex)
+                                    ->withComment("set function at index " + to_string(tempIndex) +
+                                                  " into the box at index " + to_string(memoryIndex) +
+                                                  " (" + stmt->namedFunction->name + ")")
+                    );
+                    currentTempVariableAllocator()->release(tempIndex);
+                } else {
+                    visitFunction(stmt->namedFunction, memoryIndex);
                 }
             }
         }
@@ -902,4 +1213,9 @@ namespace zero {
         this->impl = new ByteCodeGenerator::Impl();
         this->impl->typeInfoRepository = TypeInfoRepository::getInstance();
     }
+
+    ByteCodeGenerator::~ByteCodeGenerator() {
+        // the programs and the labels it made belong to the caller now
+        delete impl;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,238 @@
+#include <compiler/compiler.h>
+#include <common/logger.h>
+
+#include <map>
+
+using namespace std;
+
+namespace zero {
+
+    /**
+     * a function reference carries copies of the variables its function uses from the enclosing functions.
+     * a copy is only correct if the variable cannot change after the reference is created, so a captured variable
+     * is captured by its address (as a cell) if it is
+     *      - assigned anywhere, by its own function or by a nested one
+     *      - declared inside a loop, since every iteration assigns it again
+     *      - captured before it is declared, like the named functions that call themselves or each other
+     * the nested functions reach the variables of their grandparents through the captures of their parents
+     */
+    class ClosureConverter::Impl {
+    private:
+        struct VariableState {
+            bool captured = false;
+            bool needsCell = false;
+        };
+
+        struct Scope {
+            FunctionAstNode *function; // null for the global scope
+            ProgramAstNode *program;
+            map<unsigned int, VariableState> variables; // by index in the context
+            map<pair<unsigned int, unsigned int>, unsigned int> upvalueIndexes; // (owner level, index) -> capture index
+            int loopDepth = 0;
+        };
+
+        struct PendingUpvalue {
+            FunctionAstNode *function;
+            unsigned int upvalueIndex;
+            ProgramAstNode *owner;
+            unsigned int variableIndex;
+        };
+
+        Logger log = Logger("closure_converter");
+
+        vector<Scope> scopes;
+        vector<PendingUpvalue> pendingUpvalues; // cells are only known after the owner is done
+
+        unsigned int currentLevel() {
+            return scopes.size() - 1;
+        }
+
+        unsigned int capture(unsigned int level, unsigned int ownerLevel, unsigned int variableIndex) {
+            auto key = make_pair(ownerLevel, variableIndex);
+            auto found = scopes[level].upvalueIndexes.find(key);
+            if (found != scopes[level].upvalueIndexes.end()) {
+                return found->second;
+            }
+            UpvalueAstNode upvalue{};
+            if (ownerLevel == level - 1) {
+                scopes[ownerLevel].variables[variableIndex].captured = true;
+                upvalue = {variableIndex, false, false};
+            } else {
+                upvalue = {capture(level - 1, ownerLevel, variableIndex), true, false};
+            }
+            auto function = scopes[level].function;
+            unsigned int index = function->upvalues.size();
+            function->upvalues.push_back(upvalue);
+            scopes[level].upvalueIndexes[key] = index;
+            pendingUpvalues.push_back({function, index, scopes[ownerLevel].program, variableIndex});
+            return index;
+        }
+
+        void pushScope(FunctionAstNode *function, ProgramAstNode *program) {
+            Scope scope;
+            scope.function = function;
+            scope.program = program;
+            scopes.push_back(scope);
+        }
+
+        void declare(unsigned int variableIndex) {
+            auto &variable = scopes.back().variables[variableIndex];
+            if (variable.captured || scopes.back().loopDepth > 0) {
+                variable.needsCell = true;
+            }
+        }
+
+        void assign(AtomicExpressionAstNode *atomic) {
+            auto ownerLevel = currentLevel() - atomic->memoryDepth;
+            scopes[ownerLevel].variables[atomic->memoryIndex].needsCell = true;
+            if (atomic->memoryDepth > 0) {
+                atomic->upvalueIndex = capture(currentLevel(), ownerLevel, atomic->memoryIndex);
+            }
+        }
+
+        void visitFunction(FunctionAstNode *function) {
+            pushScope(function, function->program);
+            visitProgram(function->program);
+            finishScope();
+        }
+
+        void finishScope() {
+            auto &scope = scopes.back();
+            for (auto &entry: scope.variables) {
+                if (entry.second.captured && entry.second.needsCell) {
+                    scope.program->cellSlots.insert(entry.first);
+                }
+            }
+            if (scope.function != nullptr) {
+                log.debug("function `%s` at line %d captures %d variables", scope.function->name.c_str(),
+                          scope.function->line, (int) scope.function->upvalues.size());
+            }
+            scopes.pop_back();
+        }
+
+        void visitIdentifier(AtomicExpressionAstNode *atomic, TypeInfo *preferredOverload) {
+            if (atomic->memoryDepth == 0) return;
+            // same overload selection as the generator
+            auto memoryIndex = atomic->memoryIndex;
+            if (preferredOverload != nullptr && atomic->propertyInfo != nullptr) {
+                memoryIndex = atomic->propertyInfo->indexOfOverloadOrMinusOne(preferredOverload);
+            }
+            atomic->upvalueIndex = capture(currentLevel(), currentLevel() - atomic->memoryDepth, memoryIndex);
+        }
+
+        void visitExpression(ExpressionAstNode *expression, TypeInfo *preferredOverload = nullptr) {
+            if (expression == nullptr) return;
+            switch (expression->expressionType) {
+                case ExpressionAstNode::TYPE_ATOMIC: {
+                    auto atomic = (AtomicExpressionAstNode *) expression;
+                    if (atomic->atomicType == AtomicExpressionAstNode::TYPE_FUNCTION) {
+                        visitFunction((FunctionAstNode *) atomic);
+                    } else if (atomic->atomicType == AtomicExpressionAstNode::TYPE_IDENTIFIER) {
+                        visitIdentifier(atomic, preferredOverload);
+                    }
+                    break;
+                }
+                case ExpressionAstNode::TYPE_BINARY: {
+                    auto binary = (BinaryExpressionAstNode *) expression;
+                    if (binary->opName == ".") {
+                        // no code is generated for the member access yet
+                        break;
+                    }
+                    visitExpression(binary->right);
+                    if (binary->opName == "=" && binary->left->expressionType == ExpressionAstNode::TYPE_ATOMIC) {
+                        assign((AtomicExpressionAstNode *) binary->left);
+                    } else {
+                        visitExpression(binary->left);
+                    }
+                    break;
+                }
+                case ExpressionAstNode::TYPE_UNARY:
+                    visitExpression(((PrefixExpressionAstNode *) expression)->right);
+                    break;
+                case ExpressionAstNode::TYPE_FUNCTION_CALL: {
+                    auto call = (FunctionCallExpressionAstNode *) expression;
+                    for (auto param: *call->params) {
+                        visitExpression(param);
+                    }
+                    visitExpression(call->left, call->preferredCalleeOverload);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+
+        void visitVariable(VariableAstNode *variable) {
+            visitExpression(variable->initialValue);
+            declare(variable->memoryIndex);
+        }
+
+        void visitStatement(StatementAstNode *stmt) {
+            switch (stmt->type) {
+                case StatementAstNode::TYPE_EXPRESSION:
+                case StatementAstNode::TYPE_RETURN:
+                    visitExpression(stmt->expression);
+                    break;
+                case StatementAstNode::TYPE_VARIABLE_DECLARATION:
+                    visitVariable(stmt->variable);
+                    break;
+                case StatementAstNode::TYPE_IF:
+                    visitExpression(stmt->ifStatement->expression);
+                    visitProgram(stmt->ifStatement->program);
+                    visitProgram(stmt->ifStatement->elseProgram);
+                    break;
+                case StatementAstNode::TYPE_LOOP:
+                    // in the order of the generated code. the loop variable is declared once, before the loop
+                    if (stmt->loop->loopVariable != nullptr) {
+                        visitVariable(stmt->loop->loopVariable);
+                    }
+                    scopes.back().loopDepth++;
+                    visitProgram(stmt->loop->program);
+                    visitExpression(stmt->loop->loopIterationExpression);
+                    visitExpression(stmt->loop->loopConditionExpression);
+                    scopes.back().loopDepth--;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        void visitProgram(ProgramAstNode *program) {
+            if (program == nullptr) return;
+            // named functions are created before the statements of their block
+            for (auto stmt: program->statements) {
+                if (stmt->type == StatementAstNode::TYPE_NAMED_FUNCTION) {
+                    visitFunction(stmt->namedFunction);
+                    declare(stmt->namedFunction->memoryIndex);
+                }
+            }
+            for (auto stmt: program->statements) {
+                visitStatement(stmt);
+            }
+        }
+
+    public:
+        void convert(ProgramAstNode *program) {
+            pushScope(nullptr, program);
+            visitProgram(program);
+            finishScope();
+            for (auto &pending: pendingUpvalues) {
+                pending.function->upvalues[pending.upvalueIndex].isCell =
+                        pending.owner->cellSlots.count(pending.variableIndex);
+            }
+            pendingUpvalues.clear();
+        }
+    };
+
+    void ClosureConverter::convert(ProgramAstNode *programAstNode) {
+        impl->convert(programAstNode);
+    }
+
+    ClosureConverter::ClosureConverter() {
+        this->impl = new ClosureConverter::Impl();
+    }
+
+    ClosureConverter::~ClosureConverter() {
+        delete impl;
+    }
+}
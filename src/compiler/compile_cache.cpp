@@ -0,0 +1,213 @@
+#include <compiler/compiler.h>
+#include <common/logger.h>
+#include <vm/bytecode.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <utime.h>
+
+#ifdef _WIN32
+
+#include <direct.h>
+#include <process.h>
+
+#define getpid _getpid
+#else
+
+#include <unistd.h>
+
+#endif
+
+using namespace std;
+
+namespace zero {
+
+    //// --- IMPL
+
+    class CompileCache::Impl {
+    public:
+        Impl(const string &directory, uint64_t maxSize) {
+            this->directory = directory;
+            this->maxSize = maxSize;
+        }
+
+        Program *load(const string &key, const string &fileName) {
+            auto path = pathOf(key);
+            auto image = bytecode_try_map_file(path);
+            if (image == nullptr) {
+                log.debug("no compiled program for '%s' in %s", fileName.c_str(), directory.c_str());
+                count("misses");
+                return nullptr;
+            }
+            if (bytecode_key_of(image) != key) {
+                // the file names are only hashes, this one was compiled from something else
+                log.debug("the compiled program at %s is not the one for '%s'", path.c_str(), fileName.c_str());
+                bytecode_unmap_file(image);
+                count("misses");
+                return nullptr;
+            }
+            auto program = bytecode_load_program(image, fileName);
+            bytecode_unmap_file(image);
+            // the modification time is the last use, the eviction goes by it
+            utime(path.c_str(), nullptr);
+            log.debug("using the compiled program for '%s' at %s", fileName.c_str(), path.c_str());
+            count("hits");
+            return program;
+        }
+
+        void store(const string &key, Program *program) {
+            if (!makeDirectory()) {
+                log.warn("could not create the cache directory %s", directory.c_str());
+                return;
+            }
+            auto path = pathOf(key);
+            // written aside and renamed, so that other runs never map a half written file
+            auto temporary = path + "." + to_string(getpid()) + ".tmp";
+            bool written = bytecode_try_write_file(program, temporary, key);
+#ifdef _WIN32
+            if (written) remove(path.c_str());
+#endif
+            if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+                log.warn("could not write %s", path.c_str());
+                remove(temporary.c_str());
+                return;
+            }
+            evict();
+        }
+
+        void logStatistics() {
+            auto entries = listEntries();
+            uint64_t size = 0;
+            for (auto &entry: entries) {
+                size += entry.size;
+            }
+            auto hits = readCount("hits");
+            auto misses = readCount("misses");
+            auto lookups = hits + misses;
+            log.info("compile cache at %s: %llu hits, %llu misses (%.1f%% hit rate), %llu evictions, "
+                     "%d programs in %llu of %llu bytes", directory.c_str(), (unsigned long long) hits,
+                     (unsigned long long) misses, lookups == 0 ? 0.0 : 100.0 * hits / lookups,
+                     (unsigned long long) readCount("evictions"), (int) entries.size(), (unsigned long long) size,
+                     (unsigned long long) maxSize);
+        }
+
+    private:
+        typedef struct {
+            string path;
+            uint64_t size;
+            time_t lastUse;
+        } Entry;
+
+        Logger log = Logger("compile_cache");
+        string directory;
+        uint64_t maxSize;
+
+        // fnv-1a, it only has to spread the keys over the file names
+        static uint64_t hashOf(const string &key) {
+            uint64_t hash = 14695981039346656037ull;
+            for (unsigned char c: key) {
+                hash ^= c;
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+
+        string pathOf(const string &key) {
+            char name[32];
+            snprintf(name, sizeof(name), "%016llx.zbc", (unsigned long long) hashOf(key));
+            return directory + "/" + name;
+        }
+
+        bool makeDirectory() {
+            // the parents too, one by one
+            for (size_t end = directory.find('/', 1);; end = directory.find('/', end + 1)) {
+                auto parent = directory.substr(0, end);
+#ifdef _WIN32
+                _mkdir(parent.c_str());
+#else
+                mkdir(parent.c_str(), 0755);
+#endif
+                if (end == string::npos) break;
+            }
+            struct stat info{};
+            return stat(directory.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+        }
+
+        vector<Entry> listEntries() {
+            vector<Entry> entries;
+            DIR *dir = opendir(directory.c_str());
+            if (dir == nullptr) return entries;
+            while (dirent *item = readdir(dir)) {
+                string name = item->d_name;
+                if (name.size() < 4 || name.compare(name.size() - 4, 4, ".zbc") != 0) continue;
+                auto path = directory + "/" + name;
+                struct stat info{};
+                if (stat(path.c_str(), &info) == 0) {
+                    entries.push_back({path, (uint64_t) info.st_size, info.st_mtime});
+                }
+            }
+            closedir(dir);
+            return entries;
+        }
+
+        void evict() {
+            auto entries = listEntries();
+            uint64_t size = 0;
+            for (auto &entry: entries) {
+                size += entry.size;
+            }
+            if (size <= maxSize) return;
+
+            sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+                return a.lastUse < b.lastUse;
+            });
+            uint64_t evicted = 0;
+            for (auto &entry: entries) {
+                if (size <= maxSize) break;
+                if (remove(entry.path.c_str()) == 0) {
+                    size -= entry.size;
+                    evicted++;
+                }
+            }
+            log.debug("evicted %d compiled programs from %s", (int) evicted, directory.c_str());
+            count("evictions", evicted);
+        }
+
+        uint64_t readCount(const string &name) {
+            uint64_t value = 0;
+            ifstream file(directory + "/" + name);
+            file >> value;
+            return value;
+        }
+
+        // a file per counter. runs at the same time can lose each other's updates, the counts are not exact
+        void count(const string &name, uint64_t amount = 1) {
+            if (amount == 0 || !makeDirectory()) return;
+            auto value = readCount(name) + amount;
+            ofstream file(directory + "/" + name);
+            file << value;
+        }
+    };
+
+    //// --- PUBLIC
+    CompileCache::CompileCache(const string &directory, uint64_t maxSize) {
+        impl = new CompileCache::Impl(directory, maxSize);
+    }
+
+    Program *CompileCache::load(const string &key, const string &fileName) {
+        return impl->load(key, fileName);
+    }
+
+    void CompileCache::store(const string &key, Program *program) {
+        impl->store(key, program);
+    }
+
+    void CompileCache::logStatistics() {
+        impl->logStatistics();
+    }
+}
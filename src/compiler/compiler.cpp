@@ -8,6 +8,7 @@
 #include <compiler/compiler.h>
 #include <compiler/ast.h>
 #include <compiler/type_meta.h>
+#include <vm/vm.h>
 
 using namespace std;
 using namespace antlr4;
@@ -18,42 +19,69 @@ namespace zero {
 
     class Compiler::Impl {
     public:
+        CompileCache *cache = nullptr;
+        Optimizer defaultOptimizer{Optimizer::DEFAULT_LEVEL};
+        Optimizer *optimizer = &defaultOptimizer; // the default one, or the one of useOptimizer
+
         Program *compileFile(const string &fileName) {
             log.debug("compile called for '%s'", fileName.c_str());
-            log.debug("contents:\n %s", readFile(fileName).c_str());
+            return compileSource(readFile(fileName), fileName);
+        }
 
-            std::ifstream stream;
-            stream.open(fileName);
+        Program *compileSource(const string &contents, const string &fileName) {
+            log.debug("contents:\n %s", contents.c_str());
 
-            ANTLRInputStream input(stream);
+            string cacheKey;
+            if (cache != nullptr) {
+                cacheKey = cacheKeyOf(contents);
+                auto program = cache->load(cacheKey, fileName);
+                if (program != nullptr) {
+                    return program;
+                }
+            }
+
+            ANTLRInputStream input(contents);
             ZLexer lexer(&input);
             CommonTokenStream tokens(&lexer);
             ZParser parser(&tokens);
 
             ZParser::RootContext *root = parser.root();
             ProgramAstNode *programAst = ProgramAstNode::from(root->program(), fileName);
-            return doCompile(programAst);
+            auto program = doCompile(programAst);
+            if (cache != nullptr) {
+                cache->store(cacheKey, program);
+            }
+            return program;
         }
 
     private:
         Logger log = Logger("compiler");
-        TypeInfoExtractor metadataExtractor = TypeInfoExtractor();
-        ByteCodeGenerator byteCodeGenerator = ByteCodeGenerator();
 
+        // new passes for every file, they keep what they found in the previous one
         Program* doCompile(ProgramAstNode *programAst) {
-            extractAndRegisterTypeMetadata(programAst);
+            TypeInfoExtractor().extractAndRegister(programAst);
+            EscapeAnalyzer().analyze(programAst);
+            ClosureConverter().convert(programAst);
             log.debug("\nast :\n%s", programAst->toString().c_str());
-            auto program = generateByteCode(programAst);
+            auto program = ByteCodeGenerator().generate(programAst);
+            optimizer->optimize(program);
             log.debug("\nprogram :\n%s", program->toString().c_str());
             return program;
         }
 
-        void extractAndRegisterTypeMetadata(ProgramAstNode *program) {
-            metadataExtractor.extractAndRegister(program);
-        }
-
-        Program *generateByteCode(ProgramAstNode *pNode) {
-            return byteCodeGenerator.generate(pNode);
+        // everything the code depends on: the source, the compiler, its optimizer and the natives, which are typed globals
+        string cacheKeyOf(const string &contents) {
+            string key = contents;
+            key += "\n#compiler " + to_string(COMPILER_VERSION);
+            key += "\n#optimizer " + optimizer->describe();
+            for (auto &native: vm_get_natives()) {
+                key += "\n#native " + native.name;
+                for (auto parameterType: native.parameter_types) {
+                    key += " " + parameterType->toString();
+                }
+                key += " : " + native.return_type->toString();
+            }
+            return key;
         }
 
         static string readFile(const string &fileName) {
@@ -69,7 +97,23 @@ namespace zero {
         impl = new Compiler::Impl();
     }
 
+    Compiler::~Compiler() {
+        delete impl;
+    }
+
     Program *Compiler::compileFile(const string &fileName) {
         return impl->compileFile(fileName);
     }
+
+    Program *Compiler::compileSource(const string &source, const string &fileName) {
+        return impl->compileSource(source, fileName);
+    }
+
+    void Compiler::useCache(CompileCache *cache) {
+        impl->cache = cache;
+    }
+
+    void Compiler::useOptimizer(Optimizer *optimizer) {
+        impl->optimizer = optimizer;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,242 @@
+#include <compiler/compiler.h>
+#include <common/logger.h>
+
+#include <set>
+
+using namespace std;
+
+namespace zero {
+
+    /**
+     * children capture the variables of a function by their addresses in the frame, unless a child outlives the call,
+     * in which case the variables are moved to boxes. a function keeps the variables in its frame if every child function
+     *      - is only stored in local variables, or called right away
+     *      - is only read to be called, from anywhere in the function
+     *      - has no escaping children itself, otherwise the escaping grandchildren would reach us
+     * anything else, like returning a child or passing it as an argument, is assumed to escape
+     */
+    class EscapeAnalyzer::Impl {
+    private:
+        enum Usage {
+            USAGE_VALUE, USAGE_CALLEE
+        };
+
+        struct Scope {
+            set<string> localFunctions; // names of the local variables that hold child functions
+            bool escapes = false;
+        };
+
+        Logger log = Logger("escape_analyzer");
+
+        static bool isFunctionLiteral(ExpressionAstNode *expression) {
+            return expression->expressionType == ExpressionAstNode::TYPE_ATOMIC &&
+                   ((AtomicExpressionAstNode *) expression)->atomicType == AtomicExpressionAstNode::TYPE_FUNCTION;
+        }
+
+        static bool isIdentifier(ExpressionAstNode *expression) {
+            return expression->expressionType == ExpressionAstNode::TYPE_ATOMIC &&
+                   ((AtomicExpressionAstNode *) expression)->atomicType == AtomicExpressionAstNode::TYPE_IDENTIFIER;
+        }
+
+        static bool isAssignment(ExpressionAstNode *expression) {
+            return expression->expressionType == ExpressionAstNode::TYPE_BINARY &&
+                   ((BinaryExpressionAstNode *) expression)->opName == "=";
+        }
+
+        bool analyzeBody(ProgramAstNode *program) {
+            Scope scope;
+            collectChildren(program, scope);
+            if (!scope.escapes) {
+                checkUses(program, 0, scope);
+            }
+            return scope.escapes;
+        }
+
+        void analyzeFunction(FunctionAstNode *function, Scope &scope) {
+            function->hasEscapingChildren = analyzeBody(function->program);
+            if (function->hasEscapingChildren) {
+                scope.escapes = true;
+            }
+            log.debug("function `%s` at line %d %s", function->name.c_str(), function->line,
+                      function->hasEscapingChildren ? "boxes its captured variables" : "lets its children capture the frame");
+        }
+
+        // ---- first pass, finds the child functions and where they are stored
+
+        void collectLocalFunction(const string &name, FunctionAstNode *function, Scope &scope) {
+            analyzeFunction(function, scope);
+            scope.localFunctions.insert(name);
+        }
+
+        void collectChildren(VariableAstNode *variable, Scope &scope) {
+            if (variable->initialValue == nullptr) return;
+            if (isFunctionLiteral(variable->initialValue)) {
+                collectLocalFunction(variable->identifier, (FunctionAstNode *) variable->initialValue, scope);
+            } else {
+                collectChildren(variable->initialValue, USAGE_VALUE, scope);
+            }
+        }
+
+        void collectChildren(ExpressionAstNode *expression, Usage usage, Scope &scope) {
+            if (expression == nullptr) return;
+            switch (expression->expressionType) {
+                case ExpressionAstNode::TYPE_ATOMIC:
+                    if (isFunctionLiteral(expression)) {
+                        analyzeFunction((FunctionAstNode *) expression, scope);
+                        if (usage != USAGE_CALLEE) {
+                            scope.escapes = true;
+                        }
+                    }
+                    break;
+                case ExpressionAstNode::TYPE_BINARY: {
+                    auto binary = (BinaryExpressionAstNode *) expression;
+                    if (isAssignment(binary) && isFunctionLiteral(binary->right) && isIdentifier(binary->left) &&
+                        binary->left->memoryDepth == 0) {
+                        collectLocalFunction(((AtomicExpressionAstNode *) binary->left)->data,
+                                             (FunctionAstNode *) binary->right, scope);
+                    } else {
+                        collectChildren(binary->left, USAGE_VALUE, scope);
+                        collectChildren(binary->right, USAGE_VALUE, scope);
+                    }
+                    break;
+                }
+                case ExpressionAstNode::TYPE_UNARY:
+                    collectChildren(((PrefixExpressionAstNode *) expression)->right, USAGE_VALUE, scope);
+                    break;
+                case ExpressionAstNode::TYPE_FUNCTION_CALL: {
+                    auto call = (FunctionCallExpressionAstNode *) expression;
+                    collectChildren(call->left, USAGE_CALLEE, scope);
+                    for (auto param: *call->params) {
+                        collectChildren(param, USAGE_VALUE, scope);
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+
+        void collectChildren(ProgramAstNode *program, Scope &scope) {
+            if (program == nullptr) return;
+            for (auto stmt: program->statements) {
+                switch (stmt->type) {
+                    case StatementAstNode::TYPE_EXPRESSION:
+                    case StatementAstNode::TYPE_RETURN:
+                        collectChildren(stmt->expression, USAGE_VALUE, scope);
+                        break;
+                    case StatementAstNode::TYPE_VARIABLE_DECLARATION:
+                        collectChildren(stmt->variable, scope);
+                        break;
+                    case StatementAstNode::TYPE_IF:
+                        collectChildren(stmt->ifStatement->expression, USAGE_VALUE, scope);
+                        collectChildren(stmt->ifStatement->program, scope);
+                        collectChildren(stmt->ifStatement->elseProgram, scope);
+                        break;
+                    case StatementAstNode::TYPE_LOOP:
+                        if (stmt->loop->loopVariable != nullptr) {
+                            collectChildren(stmt->loop->loopVariable, scope);
+                        }
+                        collectChildren(stmt->loop->loopConditionExpression, USAGE_VALUE, scope);
+                        collectChildren(stmt->loop->loopIterationExpression, USAGE_VALUE, scope);
+                        collectChildren(stmt->loop->program, scope);
+                        break;
+                    case StatementAstNode::TYPE_NAMED_FUNCTION:
+                        collectLocalFunction(stmt->namedFunction->name, stmt->namedFunction, scope);
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+
+        // ---- second pass, the local functions can only be read to be called, even by the nested functions
+
+        void checkUses(ExpressionAstNode *expression, Usage usage, int level, Scope &scope) {
+            if (expression == nullptr || scope.escapes) return;
+            switch (expression->expressionType) {
+                case ExpressionAstNode::TYPE_ATOMIC: {
+                    auto atomic = (AtomicExpressionAstNode *) expression;
+                    if (atomic->atomicType == AtomicExpressionAstNode::TYPE_FUNCTION) {
+                        checkUses(((FunctionAstNode *) atomic)->program, level + 1, scope);
+                    } else if (atomic->atomicType == AtomicExpressionAstNode::TYPE_IDENTIFIER &&
+                               atomic->memoryDepth == level && usage != USAGE_CALLEE &&
+                               scope.localFunctions.count(atomic->data)) {
+                        scope.escapes = true;
+                    }
+                    break;
+                }
+                case ExpressionAstNode::TYPE_BINARY: {
+                    auto binary = (BinaryExpressionAstNode *) expression;
+                    if (!isAssignment(binary) || !isIdentifier(binary->left)) {
+                        checkUses(binary->left, USAGE_VALUE, level, scope);
+                    }
+                    checkUses(binary->right, USAGE_VALUE, level, scope);
+                    break;
+                }
+                case ExpressionAstNode::TYPE_UNARY:
+                    checkUses(((PrefixExpressionAstNode *) expression)->right, USAGE_VALUE, level, scope);
+                    break;
+                case ExpressionAstNode::TYPE_FUNCTION_CALL: {
+                    auto call = (FunctionCallExpressionAstNode *) expression;
+                    checkUses(call->left, USAGE_CALLEE, level, scope);
+                    for (auto param: *call->params) {
+                        checkUses(param, USAGE_VALUE, level, scope);
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+
+        void checkUses(ProgramAstNode *program, int level, Scope &scope) {
+            if (program == nullptr) return;
+            for (auto stmt: program->statements) {
+                switch (stmt->type) {
+                    case StatementAstNode::TYPE_EXPRESSION:
+                    case StatementAstNode::TYPE_RETURN:
+                        checkUses(stmt->expression, USAGE_VALUE, level, scope);
+                        break;
+                    case StatementAstNode::TYPE_VARIABLE_DECLARATION:
+                        checkUses(stmt->variable->initialValue, USAGE_VALUE, level, scope);
+                        break;
+                    case StatementAstNode::TYPE_IF:
+                        checkUses(stmt->ifStatement->expression, USAGE_VALUE, level, scope);
+                        checkUses(stmt->ifStatement->program, level, scope);
+                        checkUses(stmt->ifStatement->elseProgram, level, scope);
+                        break;
+                    case StatementAstNode::TYPE_LOOP:
+                        if (stmt->loop->loopVariable != nullptr) {
+                            checkUses(stmt->loop->loopVariable->initialValue, USAGE_VALUE, level, scope);
+                        }
+                        checkUses(stmt->loop->loopConditionExpression, USAGE_VALUE, level, scope);
+                        checkUses(stmt->loop->loopIterationExpression, USAGE_VALUE, level, scope);
+                        checkUses(stmt->loop->program, level, scope);
+                        break;
+                    case StatementAstNode::TYPE_NAMED_FUNCTION:
+                        checkUses(stmt->namedFunction->program, level + 1, scope);
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+
+    public:
+        void analyze(ProgramAstNode *program) {
+            analyzeBody(program);
+        }
+    };
+
+    void EscapeAnalyzer::analyze(ProgramAstNode *programAstNode) {
+        impl->analyze(programAstNode);
+    }
+
+    EscapeAnalyzer::EscapeAnalyzer() {
+        this->impl = new EscapeAnalyzer::Impl();
+    }
+
+    EscapeAnalyzer::~EscapeAnalyzer() {
+        delete impl;
+    }
+}
@@ -0,0 +1,975 @@
+#include <compiler/compiler.h>
+#include <common/logger.h>
+
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <set>
+
+using namespace std;
+
+namespace zero {
+
+    static const uint64_t NO_SLOT = UINT64_MAX;
+
+    /**
+     * what an instruction does with the slots of its frame. besides its operands, a call reads the arguments after
+     * the function reference and the callee frame overwrites everything from its header on. a concatenation uses
+     * its pieces as scratch space
+     */
+    typedef struct {
+        vector<uint64_t> reads;
+        vector<uint64_t> writes;
+        uint64_t clobberedFrom; // these may change too, up to clobberedTo (exclusive)
+        uint64_t clobberedTo;
+        bool readsGlobals; // a return from the root function, the embedding reads them afterwards
+        bool removable; // it does nothing but its writes
+    } SlotEffects;
+
+    typedef struct {
+        size_t begin; // a label, or the FN_ENTER_*
+        size_t end;
+        vector<size_t> successors;
+    } Block;
+
+    /**
+     * a function is its FN_ENTER_* and what follows, up to the labels of the next one.
+     * the slots whose addresses are captured can be changed by a child function on any call, they are left alone
+     */
+    typedef struct {
+        size_t begin;
+        size_t end;
+        bool isRoot;
+        bool isValid; // every jump lands inside
+        vector<Block> blocks;
+        set<uint64_t> cellSlots;
+        uint64_t slotCount;
+    } Function;
+
+    typedef vector<bool> SlotSet;
+
+    static bool isLabel(Instruction *instruction) {
+        return instruction->opCode == LABEL;
+    }
+
+    static InstructionDescriptor describe(Instruction *instruction) {
+        return instructionDescriptionTable.find(instruction->opCode)->second;
+    }
+
+    static bool isJump(Instruction *instruction) {
+        return !isLabel(instruction) && describe(instruction).opcodeType == JUMP;
+    }
+
+    static bool isFunctionEnter(Instruction *instruction) {
+        return instruction->opCode == FN_ENTER_HEAP || instruction->opCode == FN_ENTER_STACK;
+    }
+
+    static bool isConstant(Instruction *instruction) {
+        switch (instruction->opCode) {
+            case MOV_INT:
+            case MOV_BOOLEAN:
+            case MOV_DECIMAL:
+            case MOV_NULL:
+            case MOV_STRING:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    static SlotEffects effectsOf(Instruction *instruction, bool inRoot) {
+        SlotEffects effects{{}, {}, NO_SLOT, NO_SLOT, false, false};
+        auto op1 = instruction->operand1;
+        auto op2 = instruction->operand2;
+        auto destination = instruction->destination;
+        switch (instruction->opCode) {
+            case LABEL:
+            case JMP:
+            case GET_IN_OBJECT:
+            case SET_IN_OBJECT:
+                break;
+            case FN_ENTER_HEAP:
+            case FN_ENTER_STACK:
+                // the function reference and the arguments
+                for (uint64_t slot = 0; slot <= op2; slot++) {
+                    effects.writes.push_back(slot);
+                }
+                break;
+            case RET:
+                if (destination != 0) effects.reads.push_back(destination);
+                effects.readsGlobals = inRoot;
+                break;
+            case CALL:
+            case CALL_NATIVE:
+                for (uint64_t slot = op1; slot <= op1 + op2; slot++) {
+                    effects.reads.push_back(slot);
+                }
+                effects.writes.push_back(destination);
+                if (instruction->opCode == CALL) {
+                    effects.clobberedFrom = op1 >= FRAME_HEADER_SIZE ? op1 - FRAME_HEADER_SIZE : 0;
+                } else {
+                    // a native gets the address of its arguments
+                    effects.clobberedFrom = op1;
+                    effects.clobberedTo = op1 + op2 + 1;
+                }
+                break;
+            case CONCAT_N:
+                for (uint64_t slot = op1; slot < op1 + op2; slot++) {
+                    effects.reads.push_back(slot);
+                }
+                effects.writes.push_back(destination);
+                effects.clobberedFrom = op1;
+                effects.clobberedTo = op1 + op2;
+                break;
+            case MOV_BOX:
+                effects.reads.push_back(destination);
+                effects.writes.push_back(destination);
+                break;
+            case CAPTURE:
+            case CAPTURE_CELL:
+                effects.reads.push_back(op2);
+                effects.reads.push_back(destination);
+                break;
+            case CAPTURE_UPVALUE:
+                effects.reads.push_back(0);
+                effects.reads.push_back(destination);
+                break;
+            case GET_UPVALUE:
+            case GET_UPVALUE_CELL:
+                // the captures are in the function reference
+                effects.reads.push_back(0);
+                effects.writes.push_back(destination);
+                effects.removable = true;
+                break;
+            case SET_UPVALUE_CELL:
+                effects.reads.push_back(0);
+                effects.reads.push_back(op2);
+                break;
+            case SET_CELL:
+                effects.reads.push_back(op1);
+                effects.reads.push_back(destination);
+                break;
+            case PUSH:
+                effects.reads.push_back(op1);
+                break;
+            case POP:
+                effects.writes.push_back(op1);
+                break;
+            default: {
+                auto descriptor = describe(instruction);
+                if (descriptor.op1Type == INDEX) effects.reads.push_back(op1);
+                if (descriptor.op2Type == INDEX) effects.reads.push_back(op2);
+                if (descriptor.destType == INDEX) effects.writes.push_back(destination);
+                // a division by zero stops the program, it has to stay
+                effects.removable = descriptor.opcodeType != JUMP && instruction->opCode != DIV_INT &&
+                                    instruction->opCode != MOD_INT;
+                break;
+            }
+        }
+        return effects;
+    }
+
+    static bool isClobbered(const SlotEffects &effects, uint64_t slot) {
+        return slot >= effects.clobberedFrom && slot < effects.clobberedTo;
+    }
+
+    // the positions of the labels in the code
+    static map<string *, size_t> findLabels(const vector<Instruction *> &code) {
+        map<string *, size_t> labels;
+        for (size_t i = 0; i < code.size(); i++) {
+            if (isLabel(code[i])) labels[code[i]->operand1AsLabel] = i;
+        }
+        return labels;
+    }
+
+    static void findBlocks(const vector<Instruction *> &code, Function &function) {
+        set<size_t> leaders = {function.begin};
+        for (auto i = function.begin; i < function.end; i++) {
+            auto instruction = code[i];
+            if (isLabel(instruction) && !isLabel(code[i - 1])) {
+                leaders.insert(i);
+            }
+            if ((isJump(instruction) || instruction->opCode == RET) && i + 1 < function.end) {
+                leaders.insert(i + 1);
+            }
+        }
+        map<string *, size_t> blockOfLabel;
+        for (auto leader = leaders.begin(); leader != leaders.end(); leader++) {
+            auto next = leader;
+            next++;
+            Block block{*leader, next == leaders.end() ? function.end : *next, {}};
+            for (auto i = block.begin; i < block.end && isLabel(code[i]); i++) {
+                blockOfLabel[code[i]->operand1AsLabel] = function.blocks.size();
+            }
+            function.blocks.push_back(block);
+        }
+        for (size_t index = 0; index < function.blocks.size(); index++) {
+            auto &block = function.blocks[index];
+            auto last = code[block.end - 1];
+            bool fallsThrough = last->opCode != RET && last->opCode != JMP;
+            if (isJump(last)) {
+                auto target = blockOfLabel.find(last->destinationAsLabel);
+                if (target == blockOfLabel.end()) {
+                    function.isValid = false;
+                    return;
+                }
+                block.successors.push_back(target->second);
+            }
+            if (fallsThrough && index + 1 < function.blocks.size()) {
+                block.successors.push_back(index + 1);
+            }
+        }
+    }
+
+    static vector<Function> findFunctions(const vector<Instruction *> &code) {
+        vector<size_t> entries;
+        for (size_t i = 0; i < code.size(); i++) {
+            if (isFunctionEnter(code[i])) entries.push_back(i);
+        }
+        vector<Function> functions;
+        for (size_t k = 0; k < entries.size(); k++) {
+            Function function{entries[k], code.size(), k == 0, true, {}, {}, code[entries[k]]->operand1};
+            if (k + 1 < entries.size()) {
+                function.end = entries[k + 1];
+                // the labels of the next function
+                while (isLabel(code[function.end - 1])) function.end--;
+            }
+            for (auto i = function.begin; i < function.end; i++) {
+                auto instruction = code[i];
+                if (isLabel(instruction)) continue;
+                if (instruction->opCode == CAPTURE_CELL) {
+                    function.cellSlots.insert(instruction->operand2);
+                }
+                auto effects = effectsOf(instruction, function.isRoot);
+                for (auto slot: effects.reads) function.slotCount = max(function.slotCount, slot + 1);
+                for (auto slot: effects.writes) function.slotCount = max(function.slotCount, slot + 1);
+            }
+            findBlocks(code, function);
+            functions.push_back(function);
+        }
+        return functions;
+    }
+
+    static void addReads(SlotSet &live, const SlotEffects &effects, const vector<GlobalSymbol> &globals) {
+        for (auto slot: effects.reads) live[slot] = true;
+        if (effects.readsGlobals) {
+            for (auto &global: globals) {
+                if (global.index < live.size()) live[global.index] = true;
+            }
+        }
+    }
+
+    // live before the instruction, from live after it
+    static void transfer(SlotSet &live, const SlotEffects &effects, const vector<GlobalSymbol> &globals) {
+        for (auto slot: effects.writes) live[slot] = false;
+        addReads(live, effects, globals);
+    }
+
+    // the slots each block leaves to its successors
+    static vector<SlotSet> findLiveOut(const vector<Instruction *> &code, const Function &function,
+                                       const vector<GlobalSymbol> &globals) {
+        auto count = function.blocks.size();
+        vector<SlotSet> liveIn(count, SlotSet(function.slotCount, false));
+        vector<SlotSet> liveOut(count, SlotSet(function.slotCount, false));
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (size_t index = count; index-- > 0;) {
+                auto &block = function.blocks[index];
+                SlotSet live(function.slotCount, false);
+                for (auto successor: block.successors) {
+                    for (uint64_t slot = 0; slot < function.slotCount; slot++) {
+                        if (liveIn[successor][slot]) live[slot] = true;
+                    }
+                }
+                liveOut[index] = live;
+                for (auto i = block.end; i-- > block.begin;) {
+                    if (code[i] == nullptr || isLabel(code[i])) continue;
+                    transfer(live, effectsOf(code[i], function.isRoot), globals);
+                }
+                if (live != liveIn[index]) {
+                    liveIn[index] = live;
+                    changed = true;
+                }
+            }
+        }
+        return liveOut;
+    }
+
+    static vector<Instruction *> withoutRemoved(const vector<Instruction *> &code) {
+        vector<Instruction *> remaining;
+        for (auto instruction: code) {
+            if (instruction != nullptr) remaining.push_back(instruction);
+        }
+        return remaining;
+    }
+
+    //// --- PASSES
+
+    /**
+     * a jump to an unconditional jump goes to where that one goes. a jump to the next instruction is removed.
+     * the direction of a jump is kept, the backward ones are what the tiering and the jit see as loops
+     */
+    class JumpThreading : public OptimizerPass {
+    public:
+        string name() override {
+            return "jump threading";
+        }
+
+        void run(Program *program) override {
+            auto code = program->getLabeledInstructions();
+            auto labels = findLabels(code);
+            auto firstInstructionAt = [&](string *label) {
+                auto position = labels[label];
+                while (position < code.size() && isLabel(code[position])) position++;
+                return position;
+            };
+            for (size_t i = 0; i < code.size(); i++) {
+                auto jump = code[i];
+                if (!isJump(jump) || labels.count(jump->destinationAsLabel) == 0) continue;
+                auto target = jump->destinationAsLabel;
+                bool backward = labels[target] <= i;
+                set<string *> visited = {target};
+                while (true) {
+                    auto position = firstInstructionAt(target);
+                    if (position >= code.size() || code[position]->opCode != JMP) break;
+                    auto next = code[position]->destinationAsLabel;
+                    if (visited.count(next) || labels.count(next) == 0 || (labels[next] <= i) != backward) break;
+                    visited.insert(next);
+                    target = next;
+                }
+                jump->destinationAsLabel = target;
+
+                // the jumps only read their operands, so one that lands where it would fall through can go
+                auto position = labels[target];
+                bool fallsThrough = position > i;
+                for (auto between = i + 1; fallsThrough && between < position; between++) {
+                    fallsThrough = isLabel(code[between]);
+                }
+                if (fallsThrough) code[i] = nullptr;
+            }
+            program->setLabeledInstructions(withoutRemoved(code));
+        }
+    };
+
+    /**
+     * the instructions no path from the entry of their function reaches, like the return the generator adds after
+     * the last one
+     */
+    class UnreachableCode : public OptimizerPass {
+    public:
+        string name() override {
+            return "unreachable code";
+        }
+
+        void run(Program *program) override {
+            auto code = program->getLabeledInstructions();
+            for (auto &function: findFunctions(code)) {
+                if (!function.isValid) continue;
+                vector<bool> reached(function.blocks.size(), false);
+                vector<size_t> pending = {0};
+                reached[0] = true;
+                while (!pending.empty()) {
+                    auto index = pending.back();
+                    pending.pop_back();
+                    for (auto successor: function.blocks[index].successors) {
+                        if (!reached[successor]) {
+                            reached[successor] = true;
+                            pending.push_back(successor);
+                        }
+                    }
+                }
+                for (size_t index = 0; index < function.blocks.size(); index++) {
+                    if (reached[index]) continue;
+                    auto &block = function.blocks[index];
+                    // the labels stay, the removed jumps may have been the only ones to them
+                    for (auto i = block.begin; i < block.end; i++) {
+                        if (!isLabel(code[i])) code[i] = nullptr;
+                    }
+                }
+            }
+            program->setLabeledInstructions(withoutRemoved(code));
+        }
+    };
+
+    /**
+     * computes what only depends on constants. a slot is a constant after a MOV_INT like instruction in the same
+     * block, or everywhere in its function when it is written only once, in the first block, like the immediates
+     * the generator moves at the beginning. a conditional jump on constants becomes a jump, or goes away
+     */
+    class ConstantFolding : public OptimizerPass {
+    public:
+        string name() override {
+            return "constant folding";
+        }
+
+        void run(Program *program) override {
+            auto code = program->getLabeledInstructions();
+            for (auto &function: findFunctions(code)) {
+                if (!function.isValid) continue;
+                auto functionConstants = findFunctionConstants(code, function);
+                for (size_t index = 0; index < function.blocks.size(); index++) {
+                    auto &block = function.blocks[index];
+                    auto constants = index == 0 ? map<uint64_t, Instruction *>() : functionConstants;
+                    for (auto i = block.begin; i < block.end; i++) {
+                        auto instruction = code[i];
+                        if (isLabel(instruction)) continue;
+                        if (!fold(instruction, constants)) {
+                            code[i] = nullptr;
+                            continue;
+                        }
+                        auto effects = effectsOf(instruction, function.isRoot);
+                        for (auto slot: effects.writes) constants.erase(slot);
+                        for (auto it = constants.begin(); it != constants.end();) {
+                            if (isClobbered(effects, it->first)) it = constants.erase(it);
+                            else it++;
+                        }
+                        if (isConstant(instruction) && function.cellSlots.count(instruction->destination) == 0) {
+                            constants[instruction->destination] = instruction;
+                        }
+                    }
+                }
+            }
+            program->setLabeledInstructions(withoutRemoved(code));
+        }
+
+    private:
+        static map<uint64_t, Instruction *> findFunctionConstants(const vector<Instruction *> &code,
+                                                                  const Function &function) {
+            map<uint64_t, int> writeCounts;
+            uint64_t clobberedFrom = NO_SLOT;
+            for (auto i = function.begin; i < function.end; i++) {
+                if (isLabel(code[i])) continue;
+                auto effects = effectsOf(code[i], function.isRoot);
+                for (auto slot: effects.writes) writeCounts[slot]++;
+                if (effects.clobberedTo == NO_SLOT) {
+                    clobberedFrom = min(clobberedFrom, effects.clobberedFrom);
+                } else {
+                    for (auto slot = effects.clobberedFrom; slot < effects.clobberedTo; slot++) writeCounts[slot]++;
+                }
+            }
+            map<uint64_t, Instruction *> constants;
+            auto &entry = function.blocks[0];
+            for (auto i = entry.begin; i < entry.end; i++) {
+                auto instruction = code[i];
+                auto slot = instruction->destination;
+                if (isConstant(instruction) && writeCounts[slot] == 1 && slot < clobberedFrom &&
+                    function.cellSlots.count(slot) == 0) {
+                    constants[slot] = instruction;
+                }
+            }
+            return constants;
+        }
+
+        static bool isKnown(map<uint64_t, Instruction *> &constants, uint64_t slot, int opCode) {
+            auto found = constants.find(slot);
+            return found != constants.end() && found->second->opCode == (uint64_t) opCode;
+        }
+
+        static int32_t intOf(Instruction *constant) {
+            return (int32_t) (uint32_t) constant->operand1;
+        }
+
+        static void becomeInt(Instruction *instruction, int32_t value) {
+            instruction->opCode = MOV_INT;
+            instruction->operand1 = (uint32_t) value;
+            instruction->operand2 = 0;
+            instruction->comment = "folded into " + to_string(value);
+        }
+
+        static void becomeDecimal(Instruction *instruction, double value) {
+            instruction->opCode = MOV_DECIMAL;
+            instruction->operand1AsDecimal = value;
+            instruction->operand2 = 0;
+            instruction->comment = "folded into " + to_string(value);
+        }
+
+        static void becomeBoolean(Instruction *instruction, bool value) {
+            instruction->opCode = MOV_BOOLEAN;
+            instruction->operand1 = value ? 1 : 0;
+            instruction->operand2 = 0;
+            instruction->comment = string("folded into ") + (value ? "true" : "false");
+        }
+
+        // the comparison of the values as the vm compares them, when it is known
+        static bool compare(uint64_t opCode, Instruction *left, Instruction *right, bool &result) {
+            switch (opCode) {
+                case CMP_EQ:
+                case CMP_NEQ:
+                case JMP_EQ:
+                case JMP_NEQ: {
+                    // the bits of the values. strings are compared by their addresses
+                    bool equal;
+                    if (left->opCode == MOV_STRING || right->opCode == MOV_STRING) return false;
+                    if (left->opCode != right->opCode) {
+                        equal = false;
+                    } else if (left->opCode == MOV_NULL) {
+                        equal = true;
+                    } else if (left->opCode == MOV_DECIMAL) {
+                        double a = left->operand1AsDecimal, b = right->operand1AsDecimal;
+                        // the vm has one nan, and keeps the sign of zero
+                        equal = (a != a && b != b) || memcmp(&a, &b, sizeof(double)) == 0;
+                    } else {
+                        equal = (uint32_t) left->operand1 == (uint32_t) right->operand1;
+                    }
+                    result = (opCode == CMP_EQ || opCode == JMP_EQ) == equal;
+                    return true;
+                }
+                default:
+                    break;
+            }
+            bool isDecimal = left->opCode == MOV_DECIMAL && right->opCode == MOV_DECIMAL;
+            bool isInt = left->opCode == MOV_INT && right->opCode == MOV_INT;
+            double a = isDecimal ? left->operand1AsDecimal : intOf(left);
+            double b = isDecimal ? right->operand1AsDecimal : intOf(right);
+            switch (opCode) {
+                case CMP_GT_INT:
+                case JMP_GT_INT:
+                case CMP_LT_INT:
+                case JMP_LT_INT:
+                case CMP_GTE_INT:
+                case JMP_GTE_INT:
+                case CMP_LTE_INT:
+                case JMP_LTE_INT:
+                    if (!isInt) return false;
+                    break;
+                case CMP_GT_DECIMAL:
+                case JMP_GT_DECIMAL:
+                case CMP_LT_DECIMAL:
+                case JMP_LT_DECIMAL:
+                case CMP_GTE_DECIMAL:
+                case JMP_GTE_DECIMAL:
+                case CMP_LTE_DECIMAL:
+                case JMP_LTE_DECIMAL:
+                    if (!isDecimal) return false;
+                    break;
+                default:
+                    return false;
+            }
+            switch (opCode) {
+                case CMP_GT_INT:
+                case JMP_GT_INT:
+                case CMP_GT_DECIMAL:
+                case JMP_GT_DECIMAL:
+                    result = a > b;
+                    break;
+                case CMP_LT_INT:
+                case JMP_LT_INT:
+                case CMP_LT_DECIMAL:
+                case JMP_LT_DECIMAL:
+                    result = a < b;
+                    break;
+                case CMP_GTE_INT:
+                case JMP_GTE_INT:
+                case CMP_GTE_DECIMAL:
+                case JMP_GTE_DECIMAL:
+                    result = a >= b;
+                    break;
+                default:
+                    result = a <= b;
+                    break;
+            }
+            return true;
+        }
+
+        // false if the instruction goes away
+        static bool fold(Instruction *instruction, map<uint64_t, Instruction *> &constants) {
+            auto opCode = instruction->opCode;
+            auto op1 = instruction->operand1;
+            auto op2 = instruction->operand2;
+            auto found1 = constants.find(op1);
+            auto found2 = constants.find(op2);
+            auto descriptor = describe(instruction);
+            bool known1 = descriptor.op1Type == INDEX && found1 != constants.end();
+            bool known2 = descriptor.op2Type == INDEX && found2 != constants.end();
+
+            if (opCode == MOV && known1) {
+                auto constant = found1->second;
+                instruction->opCode = constant->opCode;
+                instruction->operand1 = constant->operand1;
+                instruction->comment = "load the constant of index " + to_string(op1) + " into index " +
+                                       to_string(instruction->destination);
+                return true;
+            }
+            if (opCode == JMP_TRUE || opCode == JMP_FALSE) {
+                if (!known1) return true;
+                auto constant = found1->second;
+                if (constant->opCode != MOV_INT && constant->opCode != MOV_BOOLEAN &&
+                    constant->opCode != MOV_NULL) {
+                    return true;
+                }
+                bool value = constant->opCode != MOV_NULL && (uint32_t) constant->operand1 != 0;
+                return takeOrDrop(instruction, value == (opCode == JMP_TRUE));
+            }
+            if (descriptor.opcodeType == JUMP && known1 && known2) {
+                bool result;
+                if (!compare(opCode, found1->second, found2->second, result)) return true;
+                return takeOrDrop(instruction, result);
+            }
+            if (descriptor.opcodeType == COMPARISON && known1 && known2) {
+                bool result;
+                if (compare(opCode, found1->second, found2->second, result)) {
+                    becomeBoolean(instruction, result);
+                }
+                return true;
+            }
+
+            if (known1 && (opCode == NEG_INT || opCode == CAST_DECIMAL) && found1->second->opCode == MOV_INT) {
+                auto value = intOf(found1->second);
+                if (opCode == NEG_INT) {
+                    becomeInt(instruction, (int32_t) (0u - (uint32_t) value));
+                } else {
+                    becomeDecimal(instruction, (double) value);
+                }
+                return true;
+            }
+            if (known1 && opCode == NEG_DECIMAL && found1->second->opCode == MOV_DECIMAL) {
+                becomeDecimal(instruction, -1 * found1->second->operand1AsDecimal);
+                return true;
+            }
+            if (!known1 || !known2) return true;
+
+            if (isKnown(constants, op1, MOV_INT) && isKnown(constants, op2, MOV_INT)) {
+                // in 32 bits, wrapping like the vm
+                auto a = (uint32_t) intOf(found1->second);
+                auto b = (uint32_t) intOf(found2->second);
+                auto signedA = (int32_t) a;
+                auto signedB = (int32_t) b;
+                switch (opCode) {
+                    case ADD_INT:
+                        becomeInt(instruction, (int32_t) (a + b));
+                        break;
+                    case SUB_INT:
+                        becomeInt(instruction, (int32_t) (a - b));
+                        break;
+                    case MUL_INT:
+                        becomeInt(instruction, (int32_t) (a * b));
+                        break;
+                    case DIV_INT:
+                    case MOD_INT:
+                        // these stop the program at run time
+                        if (signedB == 0 || (signedA == INT32_MIN && signedB == -1)) break;
+                        becomeInt(instruction, opCode == DIV_INT ? signedA / signedB : signedA % signedB);
+                        break;
+                    default:
+                        break;
+                }
+                return true;
+            }
+            if (isKnown(constants, op1, MOV_DECIMAL) && isKnown(constants, op2, MOV_DECIMAL)) {
+                auto a = found1->second->operand1AsDecimal;
+                auto b = found2->second->operand1AsDecimal;
+                switch (opCode) {
+                    case ADD_DECIMAL:
+                        becomeDecimal(instruction, a + b);
+                        break;
+                    case SUB_DECIMAL:
+                        becomeDecimal(instruction, a - b);
+                        break;
+                    case MUL_DECIMAL:
+                        becomeDecimal(instruction, a * b);
+                        break;
+                    case DIV_DECIMAL:
+                        becomeDecimal(instruction, a / b);
+                        break;
+                    case MOD_DECIMAL:
+                        becomeDecimal(instruction, fmod(a, b));
+                        break;
+                    default:
+                        break;
+                }
+            }
+            return true;
+        }
+
+        static bool takeOrDrop(Instruction *jump, bool taken) {
+            if (!taken) return false;
+            jump->opCode = JMP;
+            jump->operand1 = 0;
+            jump->operand2 = 0;
+            jump->comment = "always taken";
+            return true;
+        }
+    };
+
+    /**
+     * reads a slot that holds a copy of another one from the original, while neither of them changes in the block.
+     * a value computed into a slot that is only moved to another one is computed there directly, like the
+     * temporaries the generator moves into the variables
+     */
+    class CopyPropagation : public OptimizerPass {
+    public:
+        string name() override {
+            return "copy propagation";
+        }
+
+        void run(Program *program) override {
+            auto code = program->getLabeledInstructions();
+            auto &globals = program->getGlobals();
+            for (auto &function: findFunctions(code)) {
+                if (!function.isValid) continue;
+                for (auto &block: function.blocks) {
+                    propagate(code, function, block);
+                }
+                auto liveOut = findLiveOut(code, function, globals);
+                for (size_t index = 0; index < function.blocks.size(); index++) {
+                    coalesce(code, function, function.blocks[index], liveOut[index], globals);
+                }
+            }
+            program->setLabeledInstructions(withoutRemoved(code));
+        }
+
+    private:
+        // the operands that read a single slot, and can read another one instead
+        static vector<uint64_t *> renamableReads(Instruction *instruction) {
+            vector<uint64_t *> reads;
+            switch (instruction->opCode) {
+                case RET:
+                    if (instruction->destination != 0) reads.push_back(&instruction->destination);
+                    return reads;
+                case CALL_NATIVE:
+                case CONCAT_N:
+                case CAPTURE_CELL:
+                case POP:
+                    // the first of a range, an address, or a write
+                    return reads;
+                default:
+                    break;
+            }
+            auto descriptor = describe(instruction);
+            if (descriptor.op1Type == INDEX) reads.push_back(&instruction->operand1);
+            if (descriptor.op2Type == INDEX) reads.push_back(&instruction->operand2);
+            return reads;
+        }
+
+        static void propagate(vector<Instruction *> &code, const Function &function, const Block &block) {
+            map<uint64_t, uint64_t> copyOf;
+            for (auto i = block.begin; i < block.end; i++) {
+                auto instruction = code[i];
+                if (isLabel(instruction)) continue;
+                for (auto read: renamableReads(instruction)) {
+                    auto found = copyOf.find(*read);
+                    if (found != copyOf.end()) *read = found->second;
+                }
+                auto effects = effectsOf(instruction, function.isRoot);
+                set<uint64_t> written(effects.writes.begin(), effects.writes.end());
+                for (auto it = copyOf.begin(); it != copyOf.end();) {
+                    bool changed = written.count(it->first) || written.count(it->second) ||
+                                   isClobbered(effects, it->first) || isClobbered(effects, it->second);
+                    if (changed) it = copyOf.erase(it);
+                    else it++;
+                }
+                auto source = instruction->operand1;
+                auto destination = instruction->destination;
+                if (instruction->opCode == MOV && source != destination &&
+                    function.cellSlots.count(source) == 0 && function.cellSlots.count(destination) == 0) {
+                    copyOf[destination] = source;
+                }
+            }
+        }
+
+        // writes nothing but its destination, which it can write anywhere
+        static bool canRetarget(Instruction *instruction) {
+            switch (instruction->opCode) {
+                case MOV_BOX:
+                case CONCAT_N:
+                case POP:
+                    return false;
+                case CALL:
+                case CALL_NATIVE:
+                    return true;
+                default: {
+                    auto descriptor = describe(instruction);
+                    return descriptor.destType == INDEX && descriptor.opcodeType != JUMP &&
+                           descriptor.opcodeType != FUNCTION_ENTER && instruction->opCode != CAPTURE &&
+                           instruction->opCode != CAPTURE_CELL && instruction->opCode != CAPTURE_UPVALUE &&
+                           instruction->opCode != SET_CELL;
+                }
+            }
+        }
+
+        // walks back from the end of the block. retargeting keeps the liveness of every slot before the pair
+        static void coalesce(vector<Instruction *> &code, const Function &function, const Block &block,
+                             SlotSet live, const vector<GlobalSymbol> &globals) {
+            for (auto i = block.end; i-- > block.begin;) {
+                auto instruction = code[i];
+                if (instruction == nullptr || isLabel(instruction)) continue;
+                auto effects = effectsOf(instruction, function.isRoot);
+                if (instruction->opCode == MOV && i > block.begin && code[i - 1] != nullptr &&
+                    !isLabel(code[i - 1])) {
+                    auto temporary = instruction->operand1;
+                    auto variable = instruction->destination;
+                    auto producer = code[i - 1];
+                    if (temporary != variable && !live[temporary] && canRetarget(producer) &&
+                        producer->destination == temporary && function.cellSlots.count(temporary) == 0 &&
+                        function.cellSlots.count(variable) == 0) {
+                        producer->destination = variable;
+                        producer->comment += " (into " + to_string(variable) + ")";
+                        code[i] = nullptr;
+                        // the live slots before the producer are the same, it continues from there
+                        continue;
+                    }
+                }
+                transfer(live, effects, globals);
+            }
+        }
+    };
+
+    /**
+     * instructions that only write slots nothing reads afterwards
+     */
+    class DeadStores : public OptimizerPass {
+    public:
+        string name() override {
+            return "dead stores";
+        }
+
+        void run(Program *program) override {
+            auto code = program->getLabeledInstructions();
+            auto &globals = program->getGlobals();
+            for (auto &function: findFunctions(code)) {
+                if (!function.isValid) continue;
+                bool removed = true;
+                while (removed) {
+                    removed = false;
+                    auto liveOut = findLiveOut(code, function, globals);
+                    for (size_t index = 0; index < function.blocks.size(); index++) {
+                        auto &block = function.blocks[index];
+                        auto live = liveOut[index];
+                        for (auto i = block.end; i-- > block.begin;) {
+                            auto instruction = code[i];
+                            if (instruction == nullptr || isLabel(instruction)) continue;
+                            auto effects = effectsOf(instruction, function.isRoot);
+                            if (isDead(effects, live, function)) {
+                                code[i] = nullptr;
+                                removed = true;
+                                continue;
+                            }
+                            transfer(live, effects, globals);
+                        }
+                    }
+                }
+            }
+            program->setLabeledInstructions(withoutRemoved(code));
+        }
+
+    private:
+        static bool isDead(const SlotEffects &effects, const SlotSet &live, const Function &function) {
+            if (!effects.removable || effects.writes.empty()) return false;
+            for (auto slot: effects.writes) {
+                // the function reference, and the slots a child function can read
+                if (slot == 0 || live[slot] || function.cellSlots.count(slot)) return false;
+            }
+            return true;
+        }
+    };
+
+    //// --- IMPL
+
+    class Optimizer::Impl {
+    public:
+        explicit Impl(int level) {
+            if (level >= 2) {
+                passes.push_back(new ConstantFolding());
+                passes.push_back(new CopyPropagation());
+                passes.push_back(new DeadStores());
+                repeat = true;
+            }
+            if (level >= 1) {
+                passes.push_back(new JumpThreading());
+                passes.push_back(new UnreachableCode());
+            }
+        }
+
+        ~Impl() {
+            for (auto pass: passes) {
+                delete pass;
+            }
+        }
+
+        void addPass(OptimizerPass *pass) {
+            passes.push_back(pass);
+        }
+
+        void optimize(Program *program) {
+            auto before = countInstructions(program);
+            auto count = before;
+            for (int round = 0; round < MAX_ROUNDS; round++) {
+                auto roundBefore = count;
+                for (auto pass: passes) {
+                    pass->run(program);
+                    auto after = countInstructions(program);
+                    removedBy[pass->name()] += count - after;
+                    log.debug("%s: %d -> %d instructions", pass->name().c_str(), (int) count, (int) after);
+                    count = after;
+                }
+                if (!repeat || count == roundBefore) break;
+            }
+            programs++;
+            instructionsBefore += before;
+            instructionsAfter += count;
+        }
+
+        string describe() {
+            string description;
+            for (auto pass: passes) {
+                if (!description.empty()) description += ", ";
+                description += pass->name();
+            }
+            return repeat ? description + " (repeated)" : description;
+        }
+
+        void logStatistics() {
+            log.info("%d programs: %d instructions, %d after the optimizer", (int) programs,
+                     (int) instructionsBefore, (int) instructionsAfter);
+            for (auto pass: passes) {
+                log.info("%s removed %d instructions", pass->name().c_str(), (int) removedBy[pass->name()]);
+            }
+        }
+
+    private:
+        static const int MAX_ROUNDS = 8;
+
+        Logger log = Logger("optimizer");
+        vector<OptimizerPass *> passes;
+        bool repeat = false; // until a round removes nothing
+        map<string, int64_t> removedBy;
+        uint64_t programs = 0;
+        uint64_t instructionsBefore = 0;
+        uint64_t instructionsAfter = 0;
+
+        static uint64_t countInstructions(Program *program) {
+            uint64_t count = 0;
+            for (auto instruction: program->getLabeledInstructions()) {
+                if (!isLabel(instruction)) count++;
+            }
+            return count;
+        }
+    };
+
+    //// --- PUBLIC
+    Optimizer::Optimizer(int level) {
+        impl = new Optimizer::Impl(level);
+    }
+
+    Optimizer::~Optimizer() {
+        delete impl;
+    }
+
+    void Optimizer::addPass(OptimizerPass *pass) {
+        impl->addPass(pass);
+    }
+
+    void Optimizer::optimize(Program *program) {
+        impl->optimize(program);
+    }
+
+    string Optimizer::describe() {
+        return impl->describe();
+    }
+
+    void Optimizer::logStatistics() {
+        impl->logStatistics();
+    }
+}
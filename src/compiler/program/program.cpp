@@ -23,6 +23,26 @@ namespace zero {
                     return "JMP_TRUE";
                 case JMP_FALSE:
                     return "JMP_FALSE";
+                case JMP_EQ:
+                    return "JMP_EQ";
+                case JMP_NEQ:
+                    return "JMP_NEQ";
+                case JMP_GT_INT:
+                    return "JMP_GT_INT";
+                case JMP_GT_DECIMAL:
+                    return "JMP_GT_DECIMAL";
+                case JMP_LT_INT:
+                    return "JMP_LT_INT";
+                case JMP_LT_DECIMAL:
+                    return "JMP_LT_DECIMAL";
+                case JMP_GTE_INT:
+                    return "JMP_GTE_INT";
+                case JMP_GTE_DECIMAL:
+                    return "JMP_GTE_DECIMAL";
+                case JMP_LTE_INT:
+                    return "JMP_LTE_INT";
+                case JMP_LTE_DECIMAL:
+                    return "JMP_LTE_DECIMAL";
                 case MOV:
                     return "MOV";
                 case MOV_INT:
@@ -41,6 +61,8 @@ namespace zero {
                     return "ADD_INT";
                 case ADD_STRING:
                     return "ADD_STRING";
+                case CONCAT_N:
+                    return "CONCAT_N";
                 case ADD_DECIMAL:
                     return "ADD_DECIMAL";
                 case DIV_INT:
@@ -95,12 +117,24 @@ namespace zero {
                     return "PUSH";
                 case POP:
                     return "POP";
-                case ARG_READ:
-                    return "ARG_READ";
-                case GET_IN_PARENT:
-                    return "GET_IN_PARENT";
-                case SET_IN_PARENT:
-                    return "SET_IN_PARENT";
+                case GET_UPVALUE:
+                    return "GET_UPVALUE";
+                case GET_UPVALUE_CELL:
+                    return "GET_UPVALUE_CELL";
+                case SET_UPVALUE_CELL:
+                    return "SET_UPVALUE_CELL";
+                case CAPTURE:
+                    return "CAPTURE";
+                case CAPTURE_CELL:
+                    return "CAPTURE_CELL";
+                case CAPTURE_UPVALUE:
+                    return "CAPTURE_UPVALUE";
+                case MOV_BOX:
+                    return "MOV_BOX";
+                case GET_CELL:
+                    return "GET_CELL";
+                case SET_CELL:
+                    return "SET_CELL";
                 case GET_IN_OBJECT:
                     return "GET_IN_OBJECT";
                 case SET_IN_OBJECT:
@@ -115,14 +149,35 @@ namespace zero {
     private:
         string fileName;
         vector<Instruction *> instructions;
-        vector<uint64_t> data;
+        vector<Instruction *> resolvedInstructions; // label free copies, built once by getInstructions
+        vector<uint64_t> data; // built once by toBytes
+        vector<string *> stringConstants;
+        map<string, uint64_t> stringConstantIndexes;
+        vector<GlobalSymbol> globals;
+
+        // a change to the program makes the copies stale
+        void forgetResolvedInstructions() {
+            for (auto resolved: resolvedInstructions) {
+                delete resolved;
+            }
+            resolvedInstructions.clear();
+        }
 
     public:
         Impl(string fileName) {
             this->fileName = fileName;
         }
 
+        ~Impl() {
+            forgetResolvedInstructions();
+            for (auto instruction: instructions) {
+                delete instruction;
+            }
+        }
+
         void addInstruction(Instruction *instruction, string label = "") {
+            forgetResolvedInstructions();
+            data.clear();
             instructions.push_back(instruction);
         }
 
@@ -140,12 +195,26 @@ namespace zero {
         }
 
         void merge(Program *other) {
+            forgetResolvedInstructions();
+            data.clear();
             for (auto &labelInsPair: other->impl->instructions) {
                 this->instructions.push_back(labelInsPair);
             }
         }
 
+        vector<Instruction *> getLabeledInstructions() {
+            return instructions;
+        }
+
+        void setLabeledInstructions(const vector<Instruction *> &instructions) {
+            forgetResolvedInstructions();
+            data.clear();
+            this->instructions = instructions;
+        }
+
         void addInstructionAt(Instruction *instruction, string labelToFind) {
+            forgetResolvedInstructions();
+            data.clear();
             int i = 0;
             for (const auto &ins: instructions) {
                 i++;
@@ -157,7 +226,39 @@ namespace zero {
             }
         }
 
+        // equal literals share the same constant
+        uint64_t stringConstantIndex(string *value) {
+            auto found = stringConstantIndexes.find(*value);
+            if (found != stringConstantIndexes.end()) {
+                return found->second;
+            }
+            uint64_t index = stringConstants.size();
+            stringConstants.push_back(value);
+            stringConstantIndexes[*value] = index;
+            return index;
+        }
+
+        vector<string *> getStringConstants() {
+            for (auto &ins: instructions) {
+                if (ins->opCode == MOV_STRING) {
+                    stringConstantIndex(ins->operand1AsLabel);
+                }
+            }
+            return stringConstants;
+        }
+
+        void addGlobal(const GlobalSymbol &global) {
+            globals.push_back(global);
+        }
+
+        const vector<GlobalSymbol> &getGlobals() {
+            return globals;
+        }
+
         char *toBytes() {
+            if (!data.empty()) {
+                return reinterpret_cast<char *>(data.data());
+            }
             map<string *, uint64_t> labelPositions;
 
             int i = 0;
@@ -179,8 +280,7 @@ namespace zero {
                     auto labelIndex = labelPositions[ins->operand1AsLabel];
                     data.push_back(labelIndex);
                 } else if (ins->opCode == MOV_STRING) {
-                    //auto cpy = new string(*ins->operand1AsLabel);
-                    data.push_back((uint64_t) ins->operand1AsLabel);
+                    data.push_back(stringConstantIndex(ins->operand1AsLabel));
                 } else if (ins->opCode == MOV_DECIMAL) {
                     double double_value = ins->operand1AsDecimal;
                     char buf[sizeof(double)];
@@ -193,7 +293,7 @@ namespace zero {
 
                 data.push_back(ins->operand2);
 
-                if (ins->opCode == JMP || ins->opCode == JMP_FALSE || ins->opCode == JMP_TRUE) {
+                if (instructionDescriptionTable.find(ins->opCode)->second.destType == IMM_ADDRESS) {
                     auto labelIndex = labelPositions[ins->destinationAsLabel];
                     data.push_back(labelIndex);
                 } else {
@@ -204,8 +304,31 @@ namespace zero {
             return reinterpret_cast<char *>(data.data());
         }
 
+        void moveSlots(uint64_t first, uint64_t to) {
+            forgetResolvedInstructions();
+            data.clear();
+            for (auto &ins: instructions) {
+                if (ins->opCode == LABEL) continue;
+                InstructionDescriptor descriptor = instructionDescriptionTable.find(ins->opCode)->second;
+                // CALL and RET take their slots as plain numbers
+                auto isCall = ins->opCode == CALL;
+                auto isRet = ins->opCode == RET;
+                if ((descriptor.op1Type == INDEX || isCall) && ins->operand1 >= first) {
+                    ins->operand1 = ins->operand1 - first + to;
+                }
+                if (descriptor.op2Type == INDEX && ins->operand2 >= first) {
+                    ins->operand2 = ins->operand2 - first + to;
+                }
+                if ((descriptor.destType == INDEX || isCall || isRet) && ins->destination >= first) {
+                    ins->destination = ins->destination - first + to;
+                }
+            }
+        }
+
         vector<Instruction *> getInstructions() {
-            vector<Instruction*> ret;
+            if (!resolvedInstructions.empty()) {
+                return resolvedInstructions;
+            }
             map<string *, uint64_t> labelPositions;
 
             int i = 0;
@@ -217,28 +340,40 @@ namespace zero {
                 }
             }
 
+            // copies, because the labels of the originals are still needed by toBytes and toString
             for (auto &ins: instructions) {
                 if (ins->opCode == LABEL) continue;
 
+                auto resolved = new Instruction(*ins);
                 InstructionDescriptor  descriptor = instructionDescriptionTable.find(ins->opCode)->second;
                 if (descriptor.op1Type == IMM_ADDRESS) {
-                    ins->operand1 = labelPositions[ins->operand1AsLabel];
+                    resolved->operand1 = labelPositions[ins->operand1AsLabel];
+                } else if (descriptor.op1Type == IMM_STRING) {
+                    resolved->operand1 = stringConstantIndex(ins->operand1AsLabel);
                 }
 
                 if (descriptor.destType == IMM_ADDRESS) {
-                    ins->destination = labelPositions[ins->destinationAsLabel];
+                    resolved->destination = labelPositions[ins->destinationAsLabel];
                 }
-                ret.push_back(ins);
+                resolvedInstructions.push_back(resolved);
             }
 
-            return ret;
+            return resolvedInstructions;
         }
     };
 
+    void Program::moveSlots(uint64_t first, uint64_t to) {
+        impl->moveSlots(first, to);
+    }
+
     Program::Program(string fileName) {
         this->impl = new Impl(fileName);
     }
 
+    Program::~Program() {
+        delete impl;
+    }
+
     void Program::addInstruction(Instruction *instruction) {
         this->impl->addInstruction(instruction);
     }
@@ -251,6 +386,26 @@ namespace zero {
         return impl->addInstruction((new Instruction())->withOpCode(LABEL)->withOp1(label));
     }
 
+    vector<string *> Program::getStringConstants() {
+        return impl->getStringConstants();
+    }
+
+    void Program::addGlobal(const GlobalSymbol &global) {
+        impl->addGlobal(global);
+    }
+
+    const vector<GlobalSymbol> &Program::getGlobals() {
+        return impl->getGlobals();
+    }
+
+    vector<Instruction *> Program::getLabeledInstructions() {
+        return impl->getLabeledInstructions();
+    }
+
+    void Program::setLabeledInstructions(const vector<Instruction *> &instructions) {
+        impl->setLabeledInstructions(instructions);
+    }
+
     void Program::merge(Program *other) {
         impl->merge(other);
     }
@@ -282,7 +437,7 @@ namespace zero {
         return this;
     }
 
-    Instruction *Instruction::withOp1(float decimal) {
+    Instruction *Instruction::withOp1(double decimal) {
         this->operand1AsDecimal = decimal;
         return this;
     }
@@ -321,7 +476,7 @@ namespace zero {
             op1Str = *operand1AsLabel;
         } else if (opCode == MOV_DECIMAL) {
             op1Str = to_string(operand1AsDecimal);
-        } else if (opCode == JMP || opCode == JMP_FALSE || opCode == JMP_TRUE) {
+        } else if (instructionDescriptionTable.find(opCode)->second.destType == IMM_ADDRESS) {
             destinationStr = *destinationAsLabel;
         }
         return "\t" + opcodeStr + ", " + op1Str + ", " + op2Str + ", " + destinationStr + "\t# " + comment +
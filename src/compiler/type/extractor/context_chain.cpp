@@ -14,8 +14,8 @@ namespace zero {
 
         typeInfoRepository->registerType(newContext);
         ast->contextObjectTypeName = newContext->name;
-        if (current() != nullptr)
-            newContext->addProperty("$parent", current());
+        // the function reference that was called, its captures are the variables of the enclosing functions
+        newContext->addProperty("$closure", &TypeInfo::ANY);
         contextStack.push_back(newContext);
     }
 
@@ -1,5 +1,6 @@
 #include <compiler/type_meta.h>
 #include <compiler/op.h>
+#include <vm/vm.h>
 
 #include <vector>
 
@@ -366,13 +367,15 @@ namespace zero {
 
             auto currentContext = contextChain.current();
 
-            currentContext->addProperty("$parent", &TypeInfo::ANY);
-
-            // native print function
-            currentContext->addProperty("print", typeHelper.getFunctionTypeFromFunctionSignature(
-                    {TypeDescriptorAstNode::from(TypeInfo::ANY.name)},
-                    TypeDescriptorAstNode::from(TypeInfo::T_VOID.name),
-                    nullptr, true));
+            // natives, right after the closure slot and in the order the vm puts them there
+            for (auto &native: vm_get_natives()) {
+                auto nativeType = new TypeInfo("fun", true, true);
+                for (auto parameterType: native.parameter_types) {
+                    nativeType->addFunctionArgument(parameterType);
+                }
+                nativeType->addFunctionArgument(native.return_type);
+                currentContext->addProperty(native.name, nativeType);
+            }
 
             visitProgram(program);
         }
@@ -502,4 +505,8 @@ namespace zero {
     TypeInfoExtractor::TypeInfoExtractor() {
         this->impl = new Impl();
     }
+
+    TypeInfoExtractor::~TypeInfoExtractor() {
+        delete impl;
+    }
 }
\ No newline at end of file
@@ -105,7 +105,8 @@ namespace zero {
         }
 
         int getPropertyCount() {
-            return propertiesMap.size();
+            // overloads and removed properties still own their indexes, so count the indexes handed out
+            return indexCounter;
         }
 
         void removeProperty(const string &propertyName) {
@@ -2,13 +2,30 @@
 #include <string>
 
 #include <vm/vm.h>
+#include <vm/bytecode.h>
+#include <vm/executor.h>
 #include <compiler/compiler.h>
 
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
 #include <ctime>
+#include <functional>
+#include <map>
 
 using namespace zero;
 using namespace std;
 
+// the whole text has to be the number, strtoull alone would take "-1", " 12" or "12abc"
+static bool parse_number(const string &text, uint64_t &value) {
+    if (text.empty() || !isdigit((unsigned char) text[0])) return false;
+    char *end = nullptr;
+    errno = 0;
+    value = strtoull(text.c_str(), &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
 int main(int argc, const char *argv[]) {
     Logger main_logger("main");
 
@@ -17,28 +34,170 @@ int main(int argc, const char *argv[]) {
         return 1;
     }
 
-    const char *filename = argv[1];
-    auto program = Compiler().compileFile(string(filename));
-
+    bool emit_bytecode = false;
+    string bytecode_file_name;
     bool interpret_only = false;
-    for (int i = 0; i < argc; i++) {
-        if ("--interpret" == string(argv[i])) {
+    bool compact = false;
+    bool baseline_jit_only = false;
+    bool jit_only = false;
+    uint64_t jit_threshold = 1000;
+    // off unless a directory is given, here or in ZERO_CACHE_DIR
+    string cache_directory = getenv("ZERO_CACHE_DIR") != nullptr ? getenv("ZERO_CACHE_DIR") : "";
+    uint64_t cache_max_size = 64 << 20;
+    bool log_cache_statistics = false;
+    int optimization_level = Optimizer::DEFAULT_LEVEL;
+    bool log_optimizer_statistics = false;
+    uint64_t jobs = 0; // more than one file is run on this many threads
+    vector<string> files;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if ("-O0" == arg || "-O1" == arg || "-O2" == arg) {
+            optimization_level = arg[2] - '0';
+        } else if (arg.find("--") != 0) {
+            files.push_back(arg);
+        } else if ("--jobs" == arg) {
+            if (i + 1 == argc || !parse_number(argv[++i], jobs)) {
+                main_logger.error(" --jobs was expecting the number of threads after it");
+                return 1;
+            }
+        } else if (arg.find("--jobs=") == 0) {
+            if (!parse_number(arg.substr(string("--jobs=").size()), jobs)) {
+                main_logger.error(" --jobs was expecting the number of threads");
+                return 1;
+            }
+        } else if ("--interpret" == arg) {
             main_logger.info("interpret only mode active");
             interpret_only = true;
-            break;
+        } else if ("--baseline-jit" == arg) {
+            main_logger.info("baseline jit mode active");
+            baseline_jit_only = true;
+        } else if ("--jit" == arg) {
+            main_logger.info("jit only mode active");
+            jit_only = true;
+        } else if ("--compact" == arg) {
+            main_logger.info("compact bytecode active, interpreting only");
+            compact = true;
+        } else if ("--line-buffered" == arg) {
+            vm_set_output_line_buffered(true);
+        } else if (arg.find("--jit-threshold=") == 0) {
+            if (!parse_number(arg.substr(string("--jit-threshold=").size()), jit_threshold)) {
+                main_logger.error(" --jit-threshold was expecting a number of calls or loop iterations");
+                return 1;
+            }
+        } else if (arg.find("--cache-dir=") == 0) {
+            cache_directory = arg.substr(string("--cache-dir=").size());
+        } else if (arg.find("--cache-max-size=") == 0) {
+            if (!parse_number(arg.substr(string("--cache-max-size=").size()), cache_max_size)) {
+                main_logger.error(" --cache-max-size was expecting a number of bytes");
+                return 1;
+            }
+        } else if ("--cache-stats" == arg) {
+            log_cache_statistics = true;
+        } else if ("--optimizer-stats" == arg) {
+            log_optimizer_statistics = true;
+        } else if ("--gc-stats" == arg) {
+            vm_set_gc_statistics(true);
+        } else if (arg.find("--emit-bytecode") == 0) {
+            emit_bytecode = true;
+            if (arg.find("--emit-bytecode=") == 0) {
+                bytecode_file_name = arg.substr(string("--emit-bytecode=").size());
+            }
         }
     }
 
-    clock_t begin = clock();
+    if (files.empty()) {
+        main_logger.error(" was expecting a file name as the first arg");
+        return 1;
+    }
+
+    const char *filename = files[0].c_str();
+    string source = filename;
+    Compiler compiler;
+    Optimizer optimizer(optimization_level);
+    compiler.useOptimizer(&optimizer);
+    CompileCache *cache = nullptr;
+    if (!cache_directory.empty()) {
+        cache = new CompileCache(cache_directory, cache_max_size);
+        compiler.useCache(cache);
+    }
+
+    function<void(Program *)> run;
+    if (compact) {
+        run = vm_interpret_compact;
+    }
 #ifdef JIT_AVAILABLE
-    if (interpret_only) {
-        vm_interpret(program);
+    else if (interpret_only) {
+        run = vm_interpret;
+    } else if (baseline_jit_only) {
+        run = [](Program *program) { vm_run(program, JIT_TIER_BASELINE); };
+    } else if (jit_only) {
+        run = [](Program *program) { vm_run(program, JIT_TIER_OPTIMIZING); };
     } else {
-        vm_run(program);
+        run = [jit_threshold](Program *program) { vm_run_tiered(program, jit_threshold); };
     }
 #else
-    vm_interpret(program);
+    else {
+        run = vm_interpret;
+    }
 #endif
+
+    // the bytecode files are already compiled, they run in the same modes as the sources
+    auto load = [&compiler](const string &file) -> Program * {
+        if (file.size() <= 4 || file.compare(file.size() - 4, 4, ".zbc") != 0) {
+            return compiler.compileFile(file);
+        }
+        auto image = bytecode_map_file(file);
+        auto program = bytecode_load_program(image, file);
+        bytecode_unmap_file(image);
+        return program;
+    };
+
+    if (jobs != 0) {
+        // each file is compiled once, however many times it is given
+        map<string, Program *> programs;
+        for (auto &file: files) {
+            if (programs.count(file)) continue;
+            programs[file] = load(file);
+        }
+        if (cache != nullptr && log_cache_statistics) {
+            cache->logStatistics();
+        }
+        if (log_optimizer_statistics) {
+            optimizer.logStatistics();
+        }
+        auto begin = chrono::steady_clock::now();
+        Executor executor(jobs, run);
+        for (auto &file: files) {
+            executor.submit(programs[file]);
+        }
+        executor.wait();
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - begin;
+        executor.logStatistics();
+        main_logger.debug("%d programs took %lf sec(s) to run on %d threads", (int) files.size(), elapsed.count(),
+                          (int) jobs);
+        return 0;
+    }
+
+    auto program = load(source);
+    if (cache != nullptr && log_cache_statistics) {
+        cache->logStatistics();
+    }
+    if (log_optimizer_statistics) {
+        optimizer.logStatistics();
+    }
+
+    if (emit_bytecode) {
+        if (bytecode_file_name.empty()) {
+            auto extension = source.rfind(".ze");
+            bytecode_file_name = (extension == string::npos ? source : source.substr(0, extension)) + ".zbc";
+        }
+        bytecode_write_file(program, bytecode_file_name);
+        main_logger.info("bytecode written to %s", bytecode_file_name.c_str());
+        return 0;
+    }
+
+    clock_t begin = clock();
+    run(program);
     clock_t end = clock();
 
     double elapsedSecs = double(end - begin) / CLOCKS_PER_SEC;
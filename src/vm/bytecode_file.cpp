@@ -0,0 +1,380 @@
+#include <vm/bytecode.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#endif
+
+using namespace std;
+
+namespace zero {
+
+    static void append(vector<char> &image, const void *data, size_t size) {
+        auto bytes = (const char *) data;
+        image.insert(image.end(), bytes, bytes + size);
+        while (image.size() % sizeof(uint64_t) != 0) {
+            image.push_back(0);
+        }
+    }
+
+    static void append_strings(vector<char> &image, const vector<string> &values) {
+        for (auto &value: values) {
+            uint64_t length = value.size();
+            append(image, &length, sizeof(length));
+            append(image, value.data(), value.size());
+        }
+    }
+
+    bool bytecode_try_write_file(Program *program, const string &file_name, const string &key) {
+        auto *bytes = (uint64_t *) program->toBytes();
+        uint64_t instruction_count = bytes[0];
+        auto *instructions = (vm_instruction_t *) (bytes + 1);
+
+        vector<uint64_t> functions;
+        for (uint64_t i = 0; i < instruction_count; i++) {
+            if (instructions[i].opcode == FN_ENTER_HEAP || instructions[i].opcode == FN_ENTER_STACK) {
+                functions.push_back(i);
+            }
+        }
+        vector<string> strings;
+        for (auto value: program->getStringConstants()) {
+            strings.push_back(*value);
+        }
+        vector<string> natives;
+        for (auto &native: vm_get_natives()) {
+            natives.push_back(native.name);
+        }
+
+        zbc_header_t header{};
+        header.magic = ZBC_MAGIC;
+        header.version = ZBC_VERSION;
+        vector<char> image;
+        append(image, &header, sizeof(header));
+
+        header.instruction_count = instruction_count;
+        header.instructions_offset = image.size();
+        append(image, instructions, instruction_count * sizeof(vm_instruction_t));
+        header.function_count = functions.size();
+        header.functions_offset = image.size();
+        append(image, functions.data(), functions.size() * sizeof(uint64_t));
+        header.string_count = strings.size();
+        header.strings_offset = image.size();
+        append_strings(image, strings);
+        header.native_count = natives.size();
+        header.natives_offset = image.size();
+        append_strings(image, natives);
+        header.global_count = program->getGlobals().size();
+        header.globals_offset = image.size();
+        for (auto &global: program->getGlobals()) {
+            uint64_t words[] = {global.index, global.isBoxed ? 1u : 0u};
+            append(image, words, sizeof(words));
+            append_strings(image, {global.name});
+        }
+        header.key_offset = image.size();
+        append_strings(image, {key});
+        header.file_size = image.size();
+        memcpy(image.data(), &header, sizeof(header));
+
+        FILE *file = fopen(file_name.c_str(), "wb");
+        if (file == nullptr) return false;
+        bool written = fwrite(image.data(), 1, image.size(), file) == image.size();
+        written = fclose(file) == 0 && written;
+        if (written) {
+            vm_log.debug("wrote %s, %d instructions, %d bytes", file_name.c_str(), (int) instruction_count,
+                         (int) image.size());
+        }
+        return written;
+    }
+
+    void bytecode_write_file(Program *program, const string &file_name) {
+        if (!bytecode_try_write_file(program, file_name)) {
+            vm_log.error("could not write %s", file_name.c_str());
+            exit(1);
+        }
+    }
+
+    static void *map_file(const string &file_name, uint64_t &size) {
+#ifdef _WIN32
+        FILE *file = fopen(file_name.c_str(), "rb");
+        if (file == nullptr) return nullptr;
+        fseek(file, 0, SEEK_END);
+        size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        void *data = malloc(size);
+        if (data != nullptr && fread(data, 1, size, file) != size) {
+            free(data);
+            data = nullptr;
+        }
+        fclose(file);
+        return data;
+#else
+        int fd = open(file_name.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+        struct stat info{};
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            close(fd);
+            return nullptr;
+        }
+        size = info.st_size;
+        // private, the interpreter writes the handler addresses over the opcodes
+        void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+        return data == MAP_FAILED ? nullptr : data;
+#endif
+    }
+
+    static void unmap_file(void *data, uint64_t size) {
+#ifdef _WIN32
+        free(data);
+#else
+        munmap(data, size);
+#endif
+    }
+
+    // moves the offset past the string
+    static bool read_string(zbc_header_t *image, uint64_t &offset, string &value) {
+        if (offset > image->file_size || image->file_size - offset < sizeof(uint64_t)) return false;
+        uint64_t length = *(uint64_t *) ((char *) image + offset);
+        offset += sizeof(uint64_t);
+        if (length > image->file_size - offset) return false;
+        value.assign((char *) image + offset, length);
+        offset += (length + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+        return true;
+    }
+
+    static bool read_strings(zbc_header_t *image, uint64_t offset, uint64_t count, vector<string> &values) {
+        for (uint64_t i = 0; i < count; i++) {
+            string value;
+            if (!read_string(image, offset, value)) return false;
+            values.push_back(value);
+        }
+        return true;
+    }
+
+    static bool read_globals(zbc_header_t *image, vector<GlobalSymbol> &globals) {
+        uint64_t offset = image->globals_offset;
+        for (uint64_t i = 0; i < image->global_count; i++) {
+            if (offset > image->file_size || image->file_size - offset < 2 * sizeof(uint64_t)) return false;
+            auto words = (uint64_t *) ((char *) image + offset);
+            offset += 2 * sizeof(uint64_t);
+            string name;
+            if (!read_string(image, offset, name)) return false;
+            globals.push_back({name, words[0], words[1] != 0});
+        }
+        return true;
+    }
+
+    static bool is_section_in_file(zbc_header_t *image, uint64_t offset, uint64_t count, uint64_t item_size) {
+        return offset % sizeof(uint64_t) == 0 && offset <= image->file_size &&
+               count <= (image->file_size - offset) / item_size;
+    }
+
+    // whether the slots the instruction reads and writes are in the frame of its function
+    static bool are_slots_in_frame(vm_instruction_t &instruction, const InstructionDescriptor &descriptor,
+                                   uint64_t frame_size) {
+        switch (instruction.opcode) {
+            case CALL:
+                // the header of the callee goes right below the function reference
+                return instruction.op1 >= FRAME_HEADER_SIZE && instruction.op2 < frame_size &&
+                       instruction.op1 < frame_size - instruction.op2 && instruction.destination < frame_size;
+            case CALL_NATIVE:
+                return instruction.op2 < frame_size && instruction.op1 < frame_size - instruction.op2 &&
+                       instruction.destination < frame_size;
+            case CONCAT_N:
+                return instruction.op2 <= frame_size && instruction.op1 <= frame_size - instruction.op2 &&
+                       instruction.destination < frame_size;
+            case RET:
+                return instruction.destination < frame_size;
+            case GET_IN_OBJECT:
+            case SET_IN_OBJECT:
+                // not implemented, the interpreter skips them
+                return true;
+            default:
+                return (descriptor.op1Type != INDEX || instruction.op1 < frame_size) &&
+                       (descriptor.op2Type != INDEX || instruction.op2 < frame_size) &&
+                       (descriptor.destType != INDEX || instruction.destination < frame_size);
+        }
+    }
+
+    // the interpreter follows the jumps and the function addresses, and reads and writes the slots, without
+    // looking, so they are checked here
+    static bool are_instructions_valid(zbc_header_t *image) {
+        auto count = image->instruction_count;
+        auto *instructions = (vm_instruction_t *) bytecode_instructions_of(image);
+        auto *function_table = (uint64_t *) ((char *) image + image->functions_offset);
+        set<uint64_t> functions(function_table, function_table + image->function_count);
+        if (count == 0 || !functions.count(0)) return false;
+        uint64_t frame_size = 0;
+        for (uint64_t i = 0; i < count; i++) {
+            auto &instruction = instructions[i];
+            auto descriptor = instructionDescriptionTable.find(instruction.opcode);
+            if (descriptor == instructionDescriptionTable.end()) return false;
+            if (descriptor->second.destType == IMM_ADDRESS && instruction.destination >= count) return false;
+            if (descriptor->second.op1Type == IMM_ADDRESS && !functions.count(instruction.op1)) return false;
+            if (descriptor->second.op1Type == IMM_STRING && instruction.op1 >= image->string_count) return false;
+            bool is_function = instruction.opcode == FN_ENTER_HEAP || instruction.opcode == FN_ENTER_STACK;
+            if (is_function != (functions.count(i) != 0)) return false;
+            // the code of a function runs until the next one begins
+            if (is_function) {
+                // the function reference and the arguments are copied into the frame
+                if (instruction.op2 >= instruction.op1) return false;
+                frame_size = instruction.op1;
+            } else if (!are_slots_in_frame(instruction, descriptor->second, frame_size)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // what is wrong with the file, or null if this vm can run it
+    static const char *problem_of(zbc_header_t *image, uint64_t size) {
+        if (size < sizeof(zbc_header_t) || image->magic != ZBC_MAGIC) {
+            return "is not a bytecode file";
+        }
+        if (image->version != ZBC_VERSION) {
+            return "was written by another version of the compiler, compile it again";
+        }
+        vector<string> natives;
+        vector<GlobalSymbol> globals;
+        string key;
+        uint64_t key_offset = image->key_offset;
+        if (image->file_size != size ||
+            !is_section_in_file(image, image->instructions_offset, image->instruction_count,
+                                sizeof(vm_instruction_t)) ||
+            !is_section_in_file(image, image->functions_offset, image->function_count, sizeof(uint64_t)) ||
+            !is_section_in_file(image, image->strings_offset, image->string_count, sizeof(uint64_t)) ||
+            !read_strings(image, image->natives_offset, image->native_count, natives) ||
+            image->globals_offset % sizeof(uint64_t) != 0 || !read_globals(image, globals) ||
+            key_offset % sizeof(uint64_t) != 0 || !read_string(image, key_offset, key) ||
+            !are_instructions_valid(image)) {
+            return "is corrupted";
+        }
+        // the root function is the first one, its frame is as big as its first operand says
+        auto root_size = ((vm_instruction_t *) bytecode_instructions_of(image))->op1;
+        // and the natives are copied into it
+        if (natives.size() >= root_size) return "is corrupted";
+        for (auto &global: globals) {
+            if (global.index >= root_size) return "is corrupted";
+        }
+        // the globals come after the natives, so the natives have to be the same ones
+        auto &registered = vm_get_natives();
+        bool same_natives = natives.size() == registered.size();
+        for (uint64_t i = 0; same_natives && i < natives.size(); i++) {
+            same_natives = registered[i].name == natives[i];
+        }
+        if (!same_natives) {
+            return "was compiled against other natives, compile it again";
+        }
+        return nullptr;
+    }
+
+    zbc_header_t *bytecode_map_file(const string &file_name) {
+        uint64_t size = 0;
+        auto image = (zbc_header_t *) map_file(file_name, size);
+        if (image == nullptr) {
+            vm_log.error("could not read %s", file_name.c_str());
+            exit(1);
+        }
+        auto problem = problem_of(image, size);
+        if (problem != nullptr) {
+            vm_log.error("%s %s", file_name.c_str(), problem);
+            exit(1);
+        }
+        return image;
+    }
+
+    zbc_header_t *bytecode_try_map_file(const string &file_name) {
+        uint64_t size = 0;
+        auto image = (zbc_header_t *) map_file(file_name, size);
+        if (image == nullptr) return nullptr;
+        auto problem = problem_of(image, size);
+        if (problem != nullptr) {
+            vm_log.debug("%s %s", file_name.c_str(), problem);
+            unmap_file(image, size);
+            return nullptr;
+        }
+        return image;
+    }
+
+    void bytecode_unmap_file(zbc_header_t *image) {
+        unmap_file(image, image->file_size);
+    }
+
+    vector<string> bytecode_strings_of(zbc_header_t *image) {
+        vector<string> values;
+        if (!read_strings(image, image->strings_offset, image->string_count, values)) {
+            vm_log.error("the strings of the bytecode file are corrupted");
+            exit(1);
+        }
+        return values;
+    }
+
+    string bytecode_key_of(zbc_header_t *image) {
+        uint64_t offset = image->key_offset;
+        string key;
+        read_string(image, offset, key); // checked when it was mapped
+        return key;
+    }
+
+    Program *bytecode_load_program(zbc_header_t *image, const string &file_name) {
+        auto count = image->instruction_count;
+        auto *instructions = (vm_instruction_t *) bytecode_instructions_of(image);
+        auto strings = bytecode_strings_of(image);
+
+        // the addresses become labels again, so the program can be laid out and compiled like a fresh one
+        map<uint64_t, string *> labels;
+        for (uint64_t i = 0; i < count; i++) {
+            auto &descriptor = instructionDescriptionTable.find(instructions[i].opcode)->second;
+            if (descriptor.op1Type == IMM_ADDRESS) {
+                labels[instructions[i].op1] = nullptr;
+            }
+            if (descriptor.destType == IMM_ADDRESS) {
+                labels[instructions[i].destination] = nullptr;
+            }
+        }
+        for (auto &label: labels) {
+            label.second = new string("L" + to_string(label.first));
+        }
+
+        auto program = new Program(file_name);
+        for (uint64_t i = 0; i < count; i++) {
+            auto label = labels.find(i);
+            if (label != labels.end()) {
+                program->addLabel(label->second);
+            }
+            auto &descriptor = instructionDescriptionTable.find(instructions[i].opcode)->second;
+            auto instruction = (new Instruction())->withOpCode(instructions[i].opcode);
+            if (descriptor.op1Type == IMM_ADDRESS) {
+                instruction->operand1AsLabel = labels[instructions[i].op1];
+            } else if (descriptor.op1Type == IMM_STRING) {
+                instruction->operand1AsLabel = new string(strings[instructions[i].op1]);
+            } else {
+                // decimals too, their bits are kept as they are
+                instruction->operand1 = instructions[i].op1;
+            }
+            instruction->operand2 = instructions[i].op2;
+            if (descriptor.destType == IMM_ADDRESS) {
+                instruction->destinationAsLabel = labels[instructions[i].destination];
+            } else {
+                instruction->destination = instructions[i].destination;
+            }
+            program->addInstruction(instruction);
+        }
+        vector<GlobalSymbol> globals;
+        read_globals(image, globals);
+        for (auto &global: globals) {
+            program->addGlobal(global);
+        }
+        return program;
+    }
+}
@@ -0,0 +1,516 @@
+#include <vm/vm.h>
+#include <vm/object_manager.h>
+#include <vm/shared.h>
+
+#include <common/util.h>
+
+#include <cmath>
+#include <cstring>
+
+/**
+ * the same interpreter as the direct threaded one, on a denser encoding of the instructions.
+ * an instruction is a 32 bit word for the offset of its handler from the first handler, followed by a 32 bit word
+ * for each operand the instruction descriptor does not mark as UNUSED, in the order op1, op2, destination.
+ * a decimal takes two words. slots are byte offsets in the context like in the wide encoding, and the jump targets
+ * and the function addresses are word indexes in the code.
+ * most instructions take 12 or 16 bytes instead of 32
+ */
+
+#define FIELD(N) (instruction_ptr[N])
+#define SLOT(N) ((z_value_t*)((uintptr_t)context_object + FIELD(N)))
+
+#define DISPATCH goto *(void *) ((uintptr_t) handler_base + (int32_t) *instruction_ptr)
+#define GOTO_NEXT(SIZE) instruction_ptr += (SIZE); DISPATCH
+#define JUMP_TO(N) instruction_ptr = code + FIELD(N); DISPATCH
+
+#include "vm_shared_inline.cpp"
+
+using namespace std;
+
+namespace zero {
+
+    // set by load_compact_labels
+    static void **compact_labels;
+
+    static uint32_t compact_field(uint64_t value) {
+        if (value > UINT32_MAX) {
+            vm_log.error("operand %llu does not fit the compact encoding", (unsigned long long) value);
+            exit(1);
+        }
+        return (uint32_t) value;
+    }
+
+    static uint64_t compact_size_of(const InstructionDescriptor &descriptor) {
+        uint64_t size = 1;
+        if (descriptor.op1Type != UNUSED) size += descriptor.op1Type == IMM_DECIMAL ? 2 : 1;
+        if (descriptor.op2Type != UNUSED) size++;
+        if (descriptor.destType != UNUSED) size++;
+        return size;
+    }
+
+    static vector<uint32_t> prepare_compact_instructions(Program *program) {
+        auto *bytes = (uint64_t *) program->toBytes();
+        init_string_constants(program);
+        uint64_t count = bytes[0];
+        auto *instructions = (vm_instruction_t *) (bytes + 1);
+
+        // where every instruction begins, for the jumps and the function addresses
+        vector<uint32_t> positions(count + 1);
+        uint64_t size = 0;
+        for (uint64_t i = 0; i < count; i++) {
+            positions[i] = compact_field(size);
+            size += compact_size_of(instructionDescriptionTable.find(instructions[i].opcode)->second);
+        }
+        positions[count] = compact_field(size);
+
+        vector<uint32_t> code;
+        code.reserve(size);
+        for (uint64_t i = 0; i < count; i++) {
+            auto instruction = &instructions[i];
+            auto opcode = instruction->opcode;
+            auto descriptor = instructionDescriptionTable.find(opcode)->second;
+            auto immediate = has_immediate_operands(opcode);
+
+            code.push_back((uint32_t) ((uintptr_t) compact_labels[opcode - 2] - (uintptr_t) compact_labels[0]));
+            if (descriptor.op1Type == IMM_DECIMAL) {
+                code.push_back((uint32_t) instruction->op1);
+                code.push_back((uint32_t) (instruction->op1 >> 32));
+            } else if (descriptor.op1Type == IMM_ADDRESS) {
+                code.push_back(positions[instruction->op1]);
+            } else if (descriptor.op1Type != UNUSED) {
+                code.push_back(compact_field(immediate ? instruction->op1 : instruction->op1 * sizeof(z_value_t)));
+            }
+            if (descriptor.op2Type != UNUSED) {
+                code.push_back(compact_field(immediate ? instruction->op2 : instruction->op2 * sizeof(z_value_t)));
+            }
+            if (is_jump(opcode)) {
+                code.push_back(positions[instruction->destination]);
+            } else if (descriptor.destType != UNUSED) {
+                code.push_back(compact_field(has_destination_offset(opcode)
+                                             ? instruction->destination * sizeof(z_value_t)
+                                             : instruction->destination));
+            }
+        }
+        vm_log.debug("compact encoding takes %d bytes, the wide one %d", (int) (size * sizeof(uint32_t)),
+                     (int) (count * sizeof(vm_instruction_t)));
+        return code;
+    }
+
+    // runs until the root function returns. the first call only hands out the labels
+    static void interpret_compact(const uint32_t *code) {
+        static void *labels[] = {
+                &&FN_ENTER_HEAP, &&FN_ENTER_STACK, &&JMP, &&JMP_TRUE, &&JMP_FALSE,
+                &&JMP_EQ, &&JMP_NEQ, &&JMP_GT_INT, &&JMP_GT_DECIMAL, &&JMP_LT_INT, &&JMP_LT_DECIMAL,
+                &&JMP_GTE_INT, &&JMP_GTE_DECIMAL, &&JMP_LTE_INT, &&JMP_LTE_DECIMAL,
+                &&MOV, &&MOV_FNC, &&MOV_INT, &&MOV_NULL, &&MOV_BOOLEAN,
+                &&MOV_DECIMAL, &&MOV_STRING, &&CALL, &&CALL_NATIVE, &&ADD_INT, &&ADD_STRING, &&CONCAT_N,
+                &&ADD_DECIMAL, &&SUB_INT, &&SUB_DECIMAL, &&DIV_INT, &&DIV_DECIMAL,
+                &&MUL_INT, &&MUL_DECIMAL, &&MOD_INT, &&MOD_DECIMAL, &&CMP_EQ,
+                &&CMP_NEQ, &&CMP_GT_INT, &&CMP_GT_DECIMAL, &&CMP_LT_INT, &&CMP_LT_DECIMAL,
+                &&CMP_GTE_INT, &&CMP_GTE_DECIMAL, &&CMP_LTE_INT, &&CMP_LTE_DECIMAL, &&CAST_DECIMAL,
+                &&NEG_INT, &&NEG_DECIMAL, &&PUSH, &&POP, &&GET_UPVALUE, &&GET_UPVALUE_CELL,
+                &&SET_UPVALUE_CELL, &&CAPTURE, &&CAPTURE_CELL, &&CAPTURE_UPVALUE, &&MOV_BOX, &&GET_CELL, &&SET_CELL,
+                &&GET_IN_OBJECT, &&SET_IN_OBJECT, &&RET
+        };
+        if (code == nullptr) {
+            compact_labels = labels;
+            return;
+        }
+
+        void *handler_base = labels[0];
+        const uint32_t *instruction_ptr = code;
+        z_value_t *context_object = nullptr;
+        int64_t base_pointer = vm_instance->stack_pointer;
+        uint64_t call_depth = 0;
+
+        DISPATCH;
+
+        FN_ENTER_HEAP:
+        {
+            base_pointer = vm_instance->stack_pointer;
+            context_object = enter_heap_frame(FIELD(1), FIELD(2), context_object);
+            object_manager_enter_context(context_object);
+            call_depth++;
+            GOTO_NEXT(3);
+        }
+        FN_ENTER_STACK:
+        {
+            base_pointer = vm_instance->stack_pointer;
+            context_object = enter_stack_frame(FIELD(1));
+            call_depth++;
+            GOTO_NEXT(3);
+        }
+        JMP:
+        {
+            JUMP_TO(1);
+        }
+        JMP_TRUE:
+        {
+            if (SLOT(1)->arithmetic_int_value) {
+                JUMP_TO(2);
+            }
+            GOTO_NEXT(3);
+        }
+        JMP_FALSE:
+        {
+            if (!SLOT(1)->arithmetic_int_value) {
+                JUMP_TO(2);
+            }
+            GOTO_NEXT(3);
+        }
+        JMP_EQ:
+        {
+            if (SLOT(1)->uint_value == SLOT(2)->uint_value) {
+                JUMP_TO(3);
+            }
+            GOTO_NEXT(4);
+        }
+        JMP_NEQ:
+        {
+            if (SLOT(1)->uint_value != SLOT(2)->uint_value) {
+                JUMP_TO(3);
+            }
+            GOTO_NEXT(4);
+        }
+        JMP_GT_INT:
+        {
+            if (SLOT(1)->arithmetic_int_value > SLOT(2)->arithmetic_int_value) {
+                JUMP_TO(3);
+            }
+            GOTO_NEXT(4);
+        }
+        JMP_GT_DECIMAL:
+        {
+            if (decimal_of(SLOT(1)) > decimal_of(SLOT(2))) {
+                JUMP_TO(3);
+            }
+            GOTO_NEXT(4);
+        }
+        JMP_LT_INT:
+        {
+            if (SLOT(1)->arithmetic_int_value < SLOT(2)->arithmetic_int_value) {
+                JUMP_TO(3);
+            }
+            GOTO_NEXT(4);
+        }
+        JMP_LT_DECIMAL:
+        {
+            if (decimal_of(SLOT(1)) < decimal_of(SLOT(2))) {
+                JUMP_TO(3);
+            }
+            GOTO_NEXT(4);
+        }
+        JMP_GTE_INT:
+        {
+            if (SLOT(1)->arithmetic_int_value >= SLOT(2)->arithmetic_int_value) {
+                JUMP_TO(3);
+            }
+            GOTO_NEXT(4);
+        }
+        JMP_GTE_DECIMAL:
+        {
+            if (decimal_of(SLOT(1)) >= decimal_of(SLOT(2))) {
+                JUMP_TO(3);
+            }
+            GOTO_NEXT(4);
+        }
+        JMP_LTE_INT:
+        {
+            if (SLOT(1)->arithmetic_int_value <= SLOT(2)->arithmetic_int_value) {
+                JUMP_TO(3);
+            }
+            GOTO_NEXT(4);
+        }
+        JMP_LTE_DECIMAL:
+        {
+            if (decimal_of(SLOT(1)) <= decimal_of(SLOT(2))) {
+                JUMP_TO(3);
+            }
+            GOTO_NEXT(4);
+        }
+        MOV:
+        {
+            *SLOT(2) = *SLOT(1);
+            GOTO_NEXT(3);
+        }
+        MOV_FNC:
+        {
+            *SLOT(3) = fvalue(FIELD(1), FIELD(2), context_object);
+            GOTO_NEXT(4);
+        }
+        MOV_INT:
+        {
+            *SLOT(2) = ivalue((int32_t) FIELD(1));
+            GOTO_NEXT(3);
+        }
+        MOV_NULL:
+        {
+            *SLOT(1) = nvalue();
+            GOTO_NEXT(2);
+        }
+        MOV_BOOLEAN:
+        {
+            *SLOT(2) = bvalue((int32_t) FIELD(1));
+            GOTO_NEXT(3);
+        }
+        MOV_DECIMAL:
+        {
+            uint64_t bits = FIELD(1) | ((uint64_t) FIELD(2) << 32);
+            double value;
+            memcpy(&value, &bits, sizeof(double));
+            *SLOT(3) = dvalue(value);
+            GOTO_NEXT(4);
+        }
+        MOV_STRING:
+        {
+            *SLOT(2) = svalue(get_string_constant_at(FIELD(1)));
+            GOTO_NEXT(3);
+        }
+        CALL:
+        {
+            z_value_t &callee = context_object[FIELD(1)];
+            auto *fnc_ref = (z_fnc_ref_t *) callee.ptr_value;
+            if (object_manager_is_null(callee)) {
+                vm_log.error("null pointer exception: callee address was null");
+                exit(1);
+            }
+            push_frame(&callee, FIELD(2), (void *) (instruction_ptr + 4), context_object, FIELD(3), base_pointer);
+            instruction_ptr = code + fnc_ref->instruction_index;
+            DISPATCH;
+        }
+        CALL_NATIVE:
+        {
+            auto native = &context_object[FIELD(1)];
+            *SLOT(3) = get_native_fnc_of(*native)(native + 1, FIELD(2));
+            GOTO_NEXT(4);
+        }
+        ADD_INT:
+        {
+            *SLOT(3) = ivalue(SLOT(1)->arithmetic_int_value + SLOT(2)->arithmetic_int_value);
+            GOTO_NEXT(4);
+        }
+        ADD_STRING:
+        {
+            *SLOT(3) = object_manager_concat(SLOT(1), SLOT(2), context_object);
+            GOTO_NEXT(4);
+        }
+        CONCAT_N:
+        {
+            *SLOT(3) = object_manager_concat_n(&context_object[FIELD(1)], FIELD(2), context_object);
+            GOTO_NEXT(4);
+        }
+        ADD_DECIMAL:
+        {
+            *SLOT(3) = dvalue(decimal_of(SLOT(1)) + decimal_of(SLOT(2)));
+            GOTO_NEXT(4);
+        }
+        SUB_INT:
+        {
+            *SLOT(3) = ivalue(SLOT(1)->arithmetic_int_value - SLOT(2)->arithmetic_int_value);
+            GOTO_NEXT(4);
+        }
+        SUB_DECIMAL:
+        {
+            *SLOT(3) = dvalue(decimal_of(SLOT(1)) - decimal_of(SLOT(2)));
+            GOTO_NEXT(4);
+        }
+        DIV_INT:
+        {
+            *SLOT(3) = ivalue(SLOT(1)->arithmetic_int_value / SLOT(2)->arithmetic_int_value);
+            GOTO_NEXT(4);
+        }
+        DIV_DECIMAL:
+        {
+            *SLOT(3) = dvalue(decimal_of(SLOT(1)) / decimal_of(SLOT(2)));
+            GOTO_NEXT(4);
+        }
+        MUL_INT:
+        {
+            *SLOT(3) = ivalue(SLOT(1)->arithmetic_int_value * SLOT(2)->arithmetic_int_value);
+            GOTO_NEXT(4);
+        }
+        MUL_DECIMAL:
+        {
+            *SLOT(3) = dvalue(decimal_of(SLOT(1)) * decimal_of(SLOT(2)));
+            GOTO_NEXT(4);
+        }
+        MOD_INT:
+        {
+            *SLOT(3) = ivalue(SLOT(1)->arithmetic_int_value % SLOT(2)->arithmetic_int_value);
+            GOTO_NEXT(4);
+        }
+        MOD_DECIMAL:
+        {
+            *SLOT(3) = dvalue(fmod(decimal_of(SLOT(1)), decimal_of(SLOT(2))));
+            GOTO_NEXT(4);
+        }
+        CMP_EQ:
+        {
+            *SLOT(3) = bvalue(SLOT(1)->uint_value == SLOT(2)->uint_value);
+            GOTO_NEXT(4);
+        }
+        CMP_NEQ:
+        {
+            *SLOT(3) = bvalue(SLOT(1)->uint_value != SLOT(2)->uint_value);
+            GOTO_NEXT(4);
+        }
+        CMP_GT_INT:
+        {
+            *SLOT(3) = bvalue(SLOT(1)->arithmetic_int_value > SLOT(2)->arithmetic_int_value);
+            GOTO_NEXT(4);
+        }
+        CMP_GT_DECIMAL:
+        {
+            *SLOT(3) = bvalue(decimal_of(SLOT(1)) > decimal_of(SLOT(2)));
+            GOTO_NEXT(4);
+        }
+        CMP_LT_INT:
+        {
+            *SLOT(3) = bvalue(SLOT(1)->arithmetic_int_value < SLOT(2)->arithmetic_int_value);
+            GOTO_NEXT(4);
+        }
+        CMP_LT_DECIMAL:
+        {
+            *SLOT(3) = bvalue(decimal_of(SLOT(1)) < decimal_of(SLOT(2)));
+            GOTO_NEXT(4);
+        }
+        CMP_GTE_INT:
+        {
+            *SLOT(3) = bvalue(SLOT(1)->arithmetic_int_value >= SLOT(2)->arithmetic_int_value);
+            GOTO_NEXT(4);
+        }
+        CMP_GTE_DECIMAL:
+        {
+            *SLOT(3) = bvalue(decimal_of(SLOT(1)) >= decimal_of(SLOT(2)));
+            GOTO_NEXT(4);
+        }
+        CMP_LTE_INT:
+        {
+            *SLOT(3) = bvalue(SLOT(1)->arithmetic_int_value <= SLOT(2)->arithmetic_int_value);
+            GOTO_NEXT(4);
+        }
+        CMP_LTE_DECIMAL:
+        {
+            *SLOT(3) = bvalue(decimal_of(SLOT(1)) <= decimal_of(SLOT(2)));
+            GOTO_NEXT(4);
+        }
+        CAST_DECIMAL:
+        {
+            *SLOT(2) = dvalue((double) SLOT(1)->arithmetic_int_value);
+            GOTO_NEXT(3);
+        }
+        NEG_INT:
+        {
+            *SLOT(2) = ivalue(-1 * SLOT(1)->arithmetic_int_value);
+            GOTO_NEXT(3);
+        }
+        NEG_DECIMAL:
+        {
+            *SLOT(2) = dvalue(-1 * decimal_of(SLOT(1)));
+            GOTO_NEXT(3);
+        }
+        PUSH:
+        {
+            push(*SLOT(1));
+            GOTO_NEXT(2);
+        }
+        POP:
+        {
+            *SLOT(1) = pop();
+            GOTO_NEXT(2);
+        }
+        GET_UPVALUE:
+        {
+            auto closure = (z_fnc_ref_t *) context_object[0].ptr_value;
+            *SLOT(2) = object_manager_captures_of(closure)[FIELD(1)];
+            GOTO_NEXT(3);
+        }
+        GET_UPVALUE_CELL:
+        {
+            auto closure = (z_fnc_ref_t *) context_object[0].ptr_value;
+            *SLOT(2) = *(z_value_t *) object_manager_captures_of(closure)[FIELD(1)].ptr_value;
+            GOTO_NEXT(3);
+        }
+        SET_UPVALUE_CELL:
+        {
+            auto closure = (z_fnc_ref_t *) context_object[0].ptr_value;
+            auto cell = (z_value_t *) object_manager_captures_of(closure)[FIELD(1)].ptr_value;
+            *cell = context_object[FIELD(2)];
+            object_manager_write_barrier(cell, *cell);
+            GOTO_NEXT(3);
+        }
+        CAPTURE:
+        {
+            auto fnc_ref = (z_fnc_ref_t *) SLOT(3)->ptr_value;
+            object_manager_captures_of(fnc_ref)[FIELD(1)] = context_object[FIELD(2)];
+            GOTO_NEXT(4);
+        }
+        CAPTURE_CELL:
+        {
+            auto fnc_ref = (z_fnc_ref_t *) SLOT(3)->ptr_value;
+            object_manager_captures_of(fnc_ref)[FIELD(1)] = pvalue(&context_object[FIELD(2)]);
+            GOTO_NEXT(4);
+        }
+        CAPTURE_UPVALUE:
+        {
+            auto closure = (z_fnc_ref_t *) context_object[0].ptr_value;
+            auto fnc_ref = (z_fnc_ref_t *) SLOT(3)->ptr_value;
+            object_manager_captures_of(fnc_ref)[FIELD(1)] = object_manager_captures_of(closure)[FIELD(2)];
+            GOTO_NEXT(4);
+        }
+        MOV_BOX:
+        {
+            auto box = object_manager_create_box(context_object);
+            *box = *SLOT(1);
+            object_manager_write_barrier(box, *box);
+            *SLOT(1) = pvalue(box);
+            GOTO_NEXT(2);
+        }
+        GET_CELL:
+        {
+            *SLOT(2) = *(z_value_t *) SLOT(1)->ptr_value;
+            GOTO_NEXT(3);
+        }
+        SET_CELL:
+        {
+            auto cell = (z_value_t *) SLOT(2)->ptr_value;
+            *cell = *SLOT(1);
+            object_manager_write_barrier(cell, *cell);
+            GOTO_NEXT(3);
+        }
+        GET_IN_OBJECT:
+        { GOTO_NEXT(4); }
+        SET_IN_OBJECT:
+        { GOTO_NEXT(4); }
+        RET:
+        {
+            call_depth--;
+            if (call_depth == 0) {
+                leave_root_context(context_object);
+                vm_flush_output();
+                return; // this means the root function returned
+            }
+
+            auto return_ip = (const uint32_t *) vm_instance->value_stack[base_pointer - FRAME_HEADER_SIZE +
+                                                                         FRAME_RETURN_IP].ptr_value;
+            context_object = pop_frame(context_object, FIELD(1), base_pointer);
+            instruction_ptr = return_ip;
+            DISPATCH;
+        }
+    }
+
+    // once, runs on other threads wait for it
+    static void load_compact_labels() {
+        static bool loaded = (interpret_compact(nullptr), true);
+        (void) loaded;
+    }
+
+    void vm_interpret_compact(Program *program) {
+        begin_run();
+        load_compact_labels();
+        vector<uint32_t> code = prepare_compact_instructions(program);
+
+        interpret_compact(code.data());
+        object_manager_log_statistics();
+    }
+}
@@ -1,11 +1,16 @@
 #include <vm/vm.h>
 #include <vm/object_manager.h>
 #include <vm/shared.h>
+#include <vm/bytecode.h>
 
 #include <common/util.h>
 
 #include <cmath>
 
+#ifdef JIT_AVAILABLE
+#include <vm/jit.h>
+#endif
+
 #define GOTO_NEXT goto *(++instruction_ptr)->branch_addr
 #define GOTO_CURRENT goto *(instruction_ptr)->branch_addr
 
@@ -27,43 +32,59 @@ using namespace std;
 
 namespace zero {
 
-    vm_instruction_t *prepare_vm_instructions(Program *program, void **labels) {
-        auto *bytes = (uint64_t *) program->toBytes();
-        uint64_t count = bytes[0];
-        bytes++;
+    // set by load_labels
+    static void **opcode_labels;
+
+#ifdef JIT_AVAILABLE
+    static void **tiering_labels;
+
+    enum {
+        TIERING_COUNT_CALL,
+        TIERING_COUNT_BACK_EDGE,
+        TIERING_ENTER_NATIVE
+    };
+
+    typedef struct z_vm_tiering {
+        Program *program;
+        vm_instruction_t *instructions;
+        uint64_t hot_threshold;
+        vector<uint64_t> function_of;       // instruction index -> FN_ENTER_* index of the function containing it
+        vector<uint64_t> counters;          // FN_ENTER_* index -> calls and loop iterations so far
+        vector<void *> handlers;            // original branch address of the counting instructions
+        vector<uint64_t> opcodes;           // original opcode of the counting instructions
+        vector<void *> native_entries;      // FN_ENTER_* index -> compiled code
+        map<uint64_t, void *> osr_entries;  // loop header index -> compiled code starting at that loop
+        uint64_t bridge_target;             // function the interpreter bridge is about to run
+    } vm_tiering_t;
+
+    static void tier_up(uint64_t entry_index);
+
+    static bool is_jump_taken(uint64_t opcode, z_value_t *v1, z_value_t *v2);
+
+    static void *get_osr_entry(uint64_t entry_index, uint64_t loop_header_index);
+#endif
+
+    // turns the instructions, as Program::toBytes lays them out, into the interpreter's in place
+    static vm_instruction_t *prepare_vm_instructions(uint64_t *bytes, uint64_t count, void **labels) {
         auto *instruction = (vm_instruction_t *) bytes;
-        for (int i = 0; i < count; i++) {
+        for (uint64_t i = 0; i < count; i++) {
             auto opcode = instruction->opcode;
-            auto is_immediate = opcode == MOV_STRING ||
-                                opcode == MOV_BOOLEAN ||
-                                opcode == MOV_INT ||
-                                opcode == MOV_DECIMAL ||
-                                opcode == MOV_FNC ||
-                                opcode == FN_ENTER_HEAP ||
-                                opcode == FN_ENTER_STACK ||
-                                opcode == CALL ||
-                                opcode == SET_IN_PARENT ||
-                                opcode == GET_IN_PARENT ||
-                                opcode == SET_IN_OBJECT ||
-                                opcode == GET_IN_OBJECT ||
-                                opcode == ARG_READ ||
-                                opcode == RET;
-
-            auto is_fn_enter = opcode <= FN_ENTER_HEAP;
-            auto is_jmp = !is_fn_enter && opcode <= JMP_FALSE;
-            auto is_using_destination_offset = opcode > JMP_FALSE && opcode < SET_IN_PARENT;
-
-            if (is_jmp) {
+
+            if (opcode == MOV_STRING) {
+                instruction->op1_string = get_string_constant_at(instruction->op1);
+            }
+
+            if (is_jump(opcode)) {
                 // jmp address pre-calculate
                 instruction->destination = (uint64_t) (&((vm_instruction_t *) bytes)[instruction->destination]);
             }
 
-            if (is_using_destination_offset) {
+            if (has_destination_offset(opcode)) {
                 // destination offset pre-calculate
                 instruction->destination *= sizeof(z_value_t);
             }
 
-            if (!is_immediate) {
+            if (!has_immediate_operands(opcode)) {
                 // value offset pre-calculate
                 instruction->op1 *= sizeof(z_value_t);
                 instruction->op2 *= sizeof(z_value_t);
@@ -76,68 +97,78 @@ namespace zero {
         return (vm_instruction_t *) bytes;
     }
 
-    void vm_interpret(Program *program) {
+    // prepares a copy in the instance, so that other instances can run the same program
+    vm_instruction_t *prepare_vm_instructions(Program *program, void **labels, uint64_t *count_out = nullptr) {
+        auto *bytes = (uint64_t *) program->toBytes();
+        uint64_t count = bytes[0];
+        init_string_constants(program);
+        if (count_out) *count_out = count;
+        auto &code = vm_instance->code;
+        code.assign(bytes + 1, bytes + 1 + count * (sizeof(vm_instruction_t) / sizeof(uint64_t)));
+        return prepare_vm_instructions(code.data(), count, labels);
+    }
+
+    // runs until the root function, or the function the run has started with, returns.
+    // the first call only hands out the labels
+    static void interpret(vm_instruction_t *instructions, vm_instruction_t *instruction_ptr, uint64_t call_depth) {
         static void *labels[] = {
                 &&FN_ENTER_HEAP, &&FN_ENTER_STACK, &&JMP, &&JMP_TRUE, &&JMP_FALSE,
+                &&JMP_EQ, &&JMP_NEQ, &&JMP_GT_INT, &&JMP_GT_DECIMAL, &&JMP_LT_INT, &&JMP_LT_DECIMAL,
+                &&JMP_GTE_INT, &&JMP_GTE_DECIMAL, &&JMP_LTE_INT, &&JMP_LTE_DECIMAL,
                 &&MOV, &&MOV_FNC, &&MOV_INT, &&MOV_NULL, &&MOV_BOOLEAN,
-                &&MOV_DECIMAL, &&MOV_STRING, &&CALL, &&CALL_NATIVE, &&ADD_INT, &&ADD_STRING,
+                &&MOV_DECIMAL, &&MOV_STRING, &&CALL, &&CALL_NATIVE, &&ADD_INT, &&ADD_STRING, &&CONCAT_N,
                 &&ADD_DECIMAL, &&SUB_INT, &&SUB_DECIMAL, &&DIV_INT, &&DIV_DECIMAL,
                 &&MUL_INT, &&MUL_DECIMAL, &&MOD_INT, &&MOD_DECIMAL, &&CMP_EQ,
                 &&CMP_NEQ, &&CMP_GT_INT, &&CMP_GT_DECIMAL, &&CMP_LT_INT, &&CMP_LT_DECIMAL,
                 &&CMP_GTE_INT, &&CMP_GTE_DECIMAL, &&CMP_LTE_INT, &&CMP_LTE_DECIMAL, &&CAST_DECIMAL,
-                &&NEG_INT, &&NEG_DECIMAL, &&PUSH, &&POP, &&ARG_READ, &&GET_IN_PARENT,
-                &&GET_IN_OBJECT, &&SET_IN_PARENT, &&SET_IN_OBJECT, &&RET
+                &&NEG_INT, &&NEG_DECIMAL, &&PUSH, &&POP, &&GET_UPVALUE, &&GET_UPVALUE_CELL,
+                &&SET_UPVALUE_CELL, &&CAPTURE, &&CAPTURE_CELL, &&CAPTURE_UPVALUE, &&MOV_BOX, &&GET_CELL, &&SET_CELL,
+                &&GET_IN_OBJECT, &&SET_IN_OBJECT, &&RET
         };
-
-        vm_instruction_t *instructions = prepare_vm_instructions(program, labels);
-        vm_instruction_t *instruction_ptr = instructions;
+#ifdef JIT_AVAILABLE
+        // not opcodes. the tiered execution puts them in place of the instructions it watches
+        static void *tiered_labels[] = {
+                &&COUNT_CALL, &&COUNT_BACK_EDGE, &&ENTER_NATIVE
+        };
+#endif
+        if (instructions == nullptr) {
+#ifdef JIT_AVAILABLE
+            tiering_labels = tiered_labels;
+#endif
+            opcode_labels = labels;
+            return;
+        }
 
         z_value_t *context_object = nullptr; // function local variables are found in here, initially null
+#ifdef JIT_AVAILABLE
+        auto tiering = vm_instance->tiering; // only used in the tiered runs, which have it
+#endif
 
-        int64_t base_pointer = stack_pointer;
-        uint64_t call_depth = 0;
-
-        push(pvalue(nullptr)); // first parent context is null
-        init_native_functions();
+        int64_t base_pointer = vm_instance->stack_pointer;
 
         GOTO_CURRENT;
 
         FN_ENTER_HEAP:
         {
-            unsigned int local_values_size = instruction_ptr->op1;
-            auto parent_context = (z_value_t *) pop().ptr_value;
-            context_object = alloc(local_values_size);
-            init_call_context(context_object, parent_context);
-
             VM_DEBUG(("function enter heap, ip: %d, bp: %d, sp: %d", (instruction_ptr -
-                                                                      instructions), base_pointer, stack_pointer));
-            push(uvalue(base_pointer));
-            base_pointer = stack_pointer;
+                                                                      instructions), base_pointer,
+                    vm_instance->stack_pointer));
+            base_pointer = vm_instance->stack_pointer;
+            context_object = enter_heap_frame(instruction_ptr->op1, instruction_ptr->op2, context_object);
+            object_manager_enter_context(context_object);
             call_depth++;
 
             GOTO_NEXT;
         }
         FN_ENTER_STACK:
         {
-            auto parent_context = (z_value_t *) pop().ptr_value;
             VM_DEBUG(("function enter stack, ip: %d, bp: %d, sp: %d", (instruction_ptr -
-                                                                       instructions), base_pointer, stack_pointer));
-            push(uvalue(base_pointer));
-            base_pointer = stack_pointer;
+                                                                       instructions), base_pointer,
+                    vm_instance->stack_pointer));
+            base_pointer = vm_instance->stack_pointer;
+            context_object = enter_stack_frame(instruction_ptr->op1);
             call_depth++;
-
-            unsigned int local_values_size = instruction_ptr->op1;
-
-            context_object = &value_stack[stack_pointer];
-            init_call_context(context_object, parent_context);
-
-            stack_pointer += local_values_size;
-            if (stack_pointer > STACK_MAX) {
-                vm_log.error("could not allocate local stack frame, stack overflow!");
-                exit(1);
-            }
-
-            VM_DEBUG(("stack allocated %d, sp: %d", local_values_size, stack_pointer));
+            VM_DEBUG(("stack allocated %d, sp: %d", instruction_ptr->op1, vm_instance->stack_pointer));
 
             GOTO_NEXT;
         }
@@ -164,6 +195,86 @@ namespace zero {
             }
             GOTO_NEXT;
         }
+        JMP_EQ:
+        {
+            if (OP1_PTR->uint_value == OP2_PTR->uint_value) {
+                instruction_ptr = (vm_instruction_t *) (instruction_ptr->destination);
+                GOTO_CURRENT;
+            }
+            GOTO_NEXT;
+        }
+        JMP_NEQ:
+        {
+            if (OP1_PTR->uint_value != OP2_PTR->uint_value) {
+                instruction_ptr = (vm_instruction_t *) (instruction_ptr->destination);
+                GOTO_CURRENT;
+            }
+            GOTO_NEXT;
+        }
+        JMP_GT_INT:
+        {
+            if (OP1_PTR->arithmetic_int_value > OP2_PTR->arithmetic_int_value) {
+                instruction_ptr = (vm_instruction_t *) (instruction_ptr->destination);
+                GOTO_CURRENT;
+            }
+            GOTO_NEXT;
+        }
+        JMP_GT_DECIMAL:
+        {
+            if (decimal_of(OP1_PTR) > decimal_of(OP2_PTR)) {
+                instruction_ptr = (vm_instruction_t *) (instruction_ptr->destination);
+                GOTO_CURRENT;
+            }
+            GOTO_NEXT;
+        }
+        JMP_LT_INT:
+        {
+            if (OP1_PTR->arithmetic_int_value < OP2_PTR->arithmetic_int_value) {
+                instruction_ptr = (vm_instruction_t *) (instruction_ptr->destination);
+                GOTO_CURRENT;
+            }
+            GOTO_NEXT;
+        }
+        JMP_LT_DECIMAL:
+        {
+            if (decimal_of(OP1_PTR) < decimal_of(OP2_PTR)) {
+                instruction_ptr = (vm_instruction_t *) (instruction_ptr->destination);
+                GOTO_CURRENT;
+            }
+            GOTO_NEXT;
+        }
+        JMP_GTE_INT:
+        {
+            if (OP1_PTR->arithmetic_int_value >= OP2_PTR->arithmetic_int_value) {
+                instruction_ptr = (vm_instruction_t *) (instruction_ptr->destination);
+                GOTO_CURRENT;
+            }
+            GOTO_NEXT;
+        }
+        JMP_GTE_DECIMAL:
+        {
+            if (decimal_of(OP1_PTR) >= decimal_of(OP2_PTR)) {
+                instruction_ptr = (vm_instruction_t *) (instruction_ptr->destination);
+                GOTO_CURRENT;
+            }
+            GOTO_NEXT;
+        }
+        JMP_LTE_INT:
+        {
+            if (OP1_PTR->arithmetic_int_value <= OP2_PTR->arithmetic_int_value) {
+                instruction_ptr = (vm_instruction_t *) (instruction_ptr->destination);
+                GOTO_CURRENT;
+            }
+            GOTO_NEXT;
+        }
+        JMP_LTE_DECIMAL:
+        {
+            if (decimal_of(OP1_PTR) <= decimal_of(OP2_PTR)) {
+                instruction_ptr = (vm_instruction_t *) (instruction_ptr->destination);
+                GOTO_CURRENT;
+            }
+            GOTO_NEXT;
+        }
         MOV:
         {
             *DESTINATION_PTR = *OP1_PTR;
@@ -171,7 +282,7 @@ namespace zero {
         }
         MOV_FNC:
         {
-            *DESTINATION_PTR = fvalue(instruction_ptr->op1, context_object);
+            *DESTINATION_PTR = fvalue(instruction_ptr->op1, instruction_ptr->op2, context_object);
             GOTO_NEXT;
         }
         MOV_INT:
@@ -197,38 +308,30 @@ namespace zero {
         }
         MOV_STRING:
         {
-            auto *data = instruction_ptr->op1_string;
-            auto *copy = new string(*data);
-            *DESTINATION_PTR = svalue(copy);
+            *DESTINATION_PTR = svalue(instruction_ptr->op1_string);
             GOTO_NEXT;
         }
         CALL:
         {
-            VM_DEBUG(("call, ip: %d, bp: %d, sp: %d", (instruction_ptr - instructions), base_pointer, stack_pointer));
+            VM_DEBUG(("call, ip: %d, bp: %d, sp: %d", (instruction_ptr - instructions), base_pointer,
+                    vm_instance->stack_pointer));
             z_value_t &callee = context_object[instruction_ptr->op1];
             auto *fnc_ref = (z_fnc_ref_t *) callee.ptr_value;
             if (object_manager_is_null(callee)) {
                 vm_log.error("null pointer exception: callee address was null");
                 exit(1);
             }
-            // push number of params pushed to stack
-            push(uvalue(instruction_ptr->op2));
-            // push current instruction pointer
-            push(pvalue(instruction_ptr + 1));
-            // push current context pointer
-            push(pvalue(context_object));
-            // push requested return index
-            push(uvalue(instruction_ptr->destination));
-            // push parent context ptr;
-            push(pvalue(fnc_ref->parent_context_ptr));
+            // the function reference and the arguments are already in place, the callee frame begins with them
+            push_frame(&callee, instruction_ptr->op2, instruction_ptr + 1, context_object,
+                       instruction_ptr->destination, base_pointer);
 
             instruction_ptr = instructions + (fnc_ref->instruction_index);
             GOTO_CURRENT;
         }
         CALL_NATIVE:
         {
-            auto native_handler = get_native_fnc_at(OP1_PTR->uint_value);
-            *DESTINATION_PTR = native_handler();
+            auto native = &context_object[instruction_ptr->op1];
+            *DESTINATION_PTR = get_native_fnc_of(*native)(native + 1, instruction_ptr->op2);
             GOTO_NEXT;
         }
         ADD_INT:
@@ -239,15 +342,19 @@ namespace zero {
         }
         ADD_STRING:
         {
-            auto str1 = OP1_PTR->string_value;
-            auto str2 = OP2_PTR->string_value;
-            *DESTINATION_PTR = svalue(new string(*str1 + *str2));
+            *DESTINATION_PTR = object_manager_concat(OP1_PTR, OP2_PTR, context_object);
+            GOTO_NEXT;
+        }
+        CONCAT_N:
+        {
+            *DESTINATION_PTR = object_manager_concat_n(&context_object[instruction_ptr->op1], instruction_ptr->op2,
+                                                       context_object);
             GOTO_NEXT;
         }
         ADD_DECIMAL:
         {
             *DESTINATION_PTR = dvalue(
-                    OP1_PTR->arithmetic_decimal_value + OP2_PTR->arithmetic_decimal_value);
+                    decimal_of(OP1_PTR) + decimal_of(OP2_PTR));
             GOTO_NEXT;
         }
         SUB_INT:
@@ -259,7 +366,7 @@ namespace zero {
         SUB_DECIMAL:
         {
             *DESTINATION_PTR = dvalue(
-                    OP1_PTR->arithmetic_decimal_value - OP2_PTR->arithmetic_decimal_value);
+                    decimal_of(OP1_PTR) - decimal_of(OP2_PTR));
             GOTO_NEXT;
         }
         DIV_INT:
@@ -271,7 +378,7 @@ namespace zero {
         DIV_DECIMAL:
         {
             *DESTINATION_PTR = dvalue(
-                    OP1_PTR->arithmetic_decimal_value / OP2_PTR->arithmetic_decimal_value);
+                    decimal_of(OP1_PTR) / decimal_of(OP2_PTR));
             GOTO_NEXT;
         }
         MUL_INT:
@@ -284,8 +391,8 @@ namespace zero {
         MUL_DECIMAL:
         {
             *DESTINATION_PTR = dvalue(
-                    OP1_PTR->arithmetic_decimal_value *
-                    OP2_PTR->arithmetic_decimal_value);
+                    decimal_of(OP1_PTR) *
+                    decimal_of(OP2_PTR));
             GOTO_NEXT;
         }
         MOD_INT:
@@ -297,21 +404,21 @@ namespace zero {
         MOD_DECIMAL:
         {
             *DESTINATION_PTR = dvalue(
-                    fmod(OP1_PTR->arithmetic_decimal_value, OP2_PTR->arithmetic_decimal_value));
+                    fmod(decimal_of(OP1_PTR), decimal_of(OP2_PTR)));
             GOTO_NEXT;
         }
         CMP_EQ:
         {
             auto v1 = OP1_PTR;
             auto v2 = OP2_PTR;
-            *DESTINATION_PTR = bvalue(v1->arithmetic_int_value == v2->arithmetic_int_value);
+            *DESTINATION_PTR = bvalue(v1->uint_value == v2->uint_value);
             GOTO_NEXT;
         }
         CMP_NEQ:
         {
             auto v1 = OP1_PTR;
             auto v2 = OP2_PTR;
-            *DESTINATION_PTR = bvalue(v1->arithmetic_int_value != v2->arithmetic_int_value);
+            *DESTINATION_PTR = bvalue(v1->uint_value != v2->uint_value);
             GOTO_NEXT;
         }
         CMP_GT_INT:
@@ -326,7 +433,7 @@ namespace zero {
             auto v1 = OP1_PTR;
             auto v2 = OP2_PTR;
             *DESTINATION_PTR = bvalue(
-                    v1->arithmetic_decimal_value > v2->arithmetic_int_value);
+                    decimal_of(v1) > decimal_of(v2));
             GOTO_NEXT;
         }
         CMP_LT_INT:
@@ -341,7 +448,7 @@ namespace zero {
             auto v1 = OP1_PTR;
             auto v2 = OP2_PTR;
             *DESTINATION_PTR = bvalue(
-                    v1->arithmetic_decimal_value < v2->arithmetic_decimal_value);
+                    decimal_of(v1) < decimal_of(v2));
             GOTO_NEXT;
         }
         CMP_GTE_INT:
@@ -356,7 +463,7 @@ namespace zero {
             auto v1 = OP1_PTR;
             auto v2 = OP2_PTR;
             *DESTINATION_PTR = bvalue(
-                    v1->arithmetic_decimal_value >= v2->arithmetic_decimal_value);
+                    decimal_of(v1) >= decimal_of(v2));
             GOTO_NEXT;
         }
         CMP_LTE_INT:
@@ -371,13 +478,13 @@ namespace zero {
             auto v1 = OP1_PTR;
             auto v2 = OP2_PTR;
             *DESTINATION_PTR = bvalue(
-                    v1->arithmetic_decimal_value <= v2->arithmetic_decimal_value);
+                    decimal_of(v1) <= decimal_of(v2));
             GOTO_NEXT;
         }
         CAST_DECIMAL:
         {
             *DESTINATION_PTR = dvalue(
-                    (float) OP1_PTR->arithmetic_int_value);
+                    (double) OP1_PTR->arithmetic_int_value);
             GOTO_NEXT;
         }
         NEG_INT:
@@ -388,7 +495,7 @@ namespace zero {
         }
         NEG_DECIMAL:
         {
-            *DESTINATION_PTR = dvalue(-1 * OP1_PTR->arithmetic_decimal_value);
+            *DESTINATION_PTR = dvalue(-1 * decimal_of(OP1_PTR));
             GOTO_NEXT;
         }
         PUSH:
@@ -401,65 +508,384 @@ namespace zero {
             *DESTINATION_PTR = pop();
             GOTO_NEXT;
         }
-        ARG_READ:
+        GET_UPVALUE:
         {
-            auto argNumber = instruction_ptr->op1;
-            *DESTINATION_PTR = value_stack[base_pointer - 6 - argNumber]; // 6 is because of the calling convention
+            auto closure = (z_fnc_ref_t *) context_object[0].ptr_value;
+            *DESTINATION_PTR = object_manager_captures_of(closure)[instruction_ptr->op1];
             GOTO_NEXT;
         }
-        GET_IN_PARENT:
+        GET_UPVALUE_CELL:
         {
-            auto depth = instruction_ptr->op1;
-            auto index = instruction_ptr->op2;
-            auto parent_context = context_object;
-            for (int i = 0; i < depth; i++) {
-                parent_context = static_cast<z_value_t *>(parent_context[0].ptr_value);
-            }
-            *DESTINATION_PTR = parent_context[index];
+            auto closure = (z_fnc_ref_t *) context_object[0].ptr_value;
+            *DESTINATION_PTR = *(z_value_t *) object_manager_captures_of(closure)[instruction_ptr->op1].ptr_value;
             GOTO_NEXT;
         }
-        GET_IN_OBJECT:
-        { GOTO_NEXT; }
-        SET_IN_PARENT:
+        SET_UPVALUE_CELL:
         {
-            auto depth = instruction_ptr->op1;
-            auto index = instruction_ptr->op2;
-            auto parent_context = context_object;
-            for (int i = 0; i < depth; i++) {
-                parent_context = static_cast<z_value_t *>(parent_context[0].ptr_value);
-            }
-            parent_context[instruction_ptr->destination] = context_object[index];
+            auto closure = (z_fnc_ref_t *) context_object[0].ptr_value;
+            auto cell = (z_value_t *) object_manager_captures_of(closure)[instruction_ptr->op1].ptr_value;
+            *cell = context_object[instruction_ptr->op2];
+            object_manager_write_barrier(cell, *cell);
+            GOTO_NEXT;
+        }
+        CAPTURE:
+        {
+            auto fnc_ref = (z_fnc_ref_t *) DESTINATION_PTR->ptr_value;
+            object_manager_captures_of(fnc_ref)[instruction_ptr->op1] = context_object[instruction_ptr->op2];
+            GOTO_NEXT;
+        }
+        CAPTURE_CELL:
+        {
+            auto fnc_ref = (z_fnc_ref_t *) DESTINATION_PTR->ptr_value;
+            object_manager_captures_of(fnc_ref)[instruction_ptr->op1] = pvalue(&context_object[instruction_ptr->op2]);
+            GOTO_NEXT;
+        }
+        CAPTURE_UPVALUE:
+        {
+            auto closure = (z_fnc_ref_t *) context_object[0].ptr_value;
+            auto fnc_ref = (z_fnc_ref_t *) DESTINATION_PTR->ptr_value;
+            object_manager_captures_of(fnc_ref)[instruction_ptr->op1] =
+                    object_manager_captures_of(closure)[instruction_ptr->op2];
+            GOTO_NEXT;
+        }
+        MOV_BOX:
+        {
+            auto box = object_manager_create_box(context_object);
+            *box = *DESTINATION_PTR;
+            object_manager_write_barrier(box, *box);
+            *DESTINATION_PTR = pvalue(box);
+            GOTO_NEXT;
+        }
+        GET_CELL:
+        {
+            *DESTINATION_PTR = *(z_value_t *) OP1_PTR->ptr_value;
             GOTO_NEXT;
         }
+        SET_CELL:
+        {
+            auto cell = (z_value_t *) DESTINATION_PTR->ptr_value;
+            *cell = *OP1_PTR;
+            object_manager_write_barrier(cell, *cell);
+            GOTO_NEXT;
+        }
+        GET_IN_OBJECT:
+        { GOTO_NEXT; }
         SET_IN_OBJECT:
         { GOTO_NEXT; }
         RET:
         {
             call_depth--;
             if (call_depth == 0) {
+                leave_root_context(context_object);
+                vm_flush_output();
                 VM_DEBUG(("root function returned, vm exited"));
                 return; // this means the root function returned
             }
 
-            stack_pointer = base_pointer;
-            base_pointer = pop().uint_value;
-
-            auto return_index_in_parent = pop().uint_value;
-            auto return_index_in_current = instruction_ptr->destination;
-            auto current_context_object = context_object;
-            context_object = static_cast<z_value_t *>(pop().ptr_value);
-            instruction_ptr = static_cast<vm_instruction_t *>(pop().ptr_value);
-            auto parent_context_object = context_object;
-            if (return_index_in_current) {
-                // move return value
-                *(z_value_t *) (((uintptr_t) parent_context_object) + return_index_in_parent) =
-                        current_context_object[return_index_in_current];
+            auto return_ip = (vm_instruction_t *) vm_instance->value_stack[base_pointer - FRAME_HEADER_SIZE +
+                                                                           FRAME_RETURN_IP].ptr_value;
+            context_object = pop_frame(context_object, instruction_ptr->destination, base_pointer);
+            instruction_ptr = return_ip;
+            if (instruction_ptr == nullptr) {
+                return; // called from the generated code through the bridge
             }
-            auto number_of_params_pushed_to_stack = pop().uint_value;
-            stack_pointer -= number_of_params_pushed_to_stack;
             VM_DEBUG(
-                    ("ret, next_ip: %d, sp: %d, bp:%d", (instruction_ptr - instructions), stack_pointer, base_pointer));
+                    ("ret, next_ip: %d, sp: %d, bp:%d", (instruction_ptr - instructions), vm_instance->stack_pointer,
+                            base_pointer));
+            GOTO_CURRENT;
+        }
+#ifdef JIT_AVAILABLE
+        COUNT_CALL:
+        {
+            auto index = instruction_ptr - instructions;
+            if (++tiering->counters[index] >= tiering->hot_threshold) {
+                tier_up(index);
+                GOTO_CURRENT;
+            }
+            goto *tiering->handlers[index];
+        }
+        COUNT_BACK_EDGE:
+        {
+            auto index = instruction_ptr - instructions;
+            auto function = tiering->function_of[index];
+            if (++tiering->counters[function] < tiering->hot_threshold) {
+                goto *tiering->handlers[index];
+            }
+            if (tiering->native_entries[function] == nullptr) {
+                tier_up(function);
+            }
+            if (!is_jump_taken(tiering->opcodes[index], OP1_PTR, OP2_PTR)) {
+                GOTO_NEXT;
+            }
+            // on stack replacement: this activation continues in the native code, from the loop header
+            auto loop_header = (vm_instruction_t *) instruction_ptr->destination;
+            auto osr_entry = get_osr_entry(function, loop_header - instructions);
+            if (call_depth == 1) {
+                // the root function, its frame has no header
+                vm_jit_invoke_osr(osr_entry, context_object, base_pointer, 1);
+                return;
+            }
+            // both sides use the same frames, the native RET returns from this one
+            auto header = &vm_instance->value_stack[base_pointer - FRAME_HEADER_SIZE];
+            auto return_ip = (vm_instruction_t *) header[FRAME_RETURN_IP].ptr_value;
+            auto caller_context = (z_value_t *) header[FRAME_CALLER_CONTEXT].ptr_value;
+            auto caller_base_pointer = (int64_t) (header[FRAME_CALLER_POINTERS].uint_value & 0xffffffff);
+
+            vm_jit_invoke_osr(osr_entry, context_object, base_pointer, 2);
+            call_depth--;
+
+            if (return_ip == nullptr) {
+                return; // called from the generated code through the bridge
+            }
+            base_pointer = caller_base_pointer;
+            context_object = caller_context;
+            instruction_ptr = return_ip;
+            GOTO_CURRENT;
+        }
+        ENTER_NATIVE:
+        {
+            // the frame pushed by the interpreter's CALL is entered by the native code as it is
+            auto return_ip = (vm_instruction_t *) vm_instance->value_stack[vm_instance->stack_pointer -
+                                                                           FRAME_HEADER_SIZE +
+                                                                           FRAME_RETURN_IP].ptr_value;
+
+            vm_jit_invoke(tiering->native_entries[instruction_ptr - instructions]);
+
+            if (return_ip == nullptr) {
+                return; // called from the generated code through the bridge
+            }
+            instruction_ptr = return_ip;
             GOTO_CURRENT;
         }
+#endif
+    }
+
+    // once, runs on other threads wait for it
+    static void load_labels() {
+        static bool loaded = (interpret(nullptr, nullptr, 0), true);
+        (void) loaded;
+    }
+
+    void vm_interpret(Program *program) {
+        begin_run();
+        load_labels();
+        vm_instruction_t *instructions = prepare_vm_instructions(program, opcode_labels);
+
+        interpret(instructions, instructions, 0);
+        object_manager_log_statistics();
+    }
+
+    void vm_interpret_bytecode(const string &file_name) {
+        begin_run();
+        load_labels();
+        auto image = bytecode_map_file(file_name);
+        init_string_constants(bytecode_strings_of(image));
+        vm_instruction_t *instructions = prepare_vm_instructions(bytecode_instructions_of(image),
+                                                                 image->instruction_count, opcode_labels);
+
+        // the instructions are prepared in the private mapping of the file, it goes away with the run
+        interpret(instructions, instructions, 0);
+        bytecode_unmap_file(image);
+        object_manager_log_statistics();
+    }
+
+    void free_tiering(z_vm_instance_t *instance) {
+#ifdef JIT_AVAILABLE
+        delete instance->tiering;
+        instance->tiering = nullptr;
+#endif
+    }
+
+#ifdef JIT_AVAILABLE
+
+    static void tier_up(uint64_t entry_index) {
+        auto &tiering = *vm_instance->tiering;
+        vm_log.debug("function at %d is hot, compiling", (int) entry_index);
+        tiering.native_entries[entry_index] = vm_jit_compile_function(tiering.program, entry_index);
+        // its loops keep counting: activations that were already running when it got hot move with OSR
+        tiering.instructions[entry_index].branch_addr = tiering_labels[TIERING_ENTER_NATIVE];
+    }
+
+    static bool is_jump_taken(uint64_t opcode, z_value_t *v1, z_value_t *v2) {
+        switch (opcode) {
+            case JMP:
+                return true;
+            case JMP_TRUE:
+                return v1->arithmetic_int_value;
+            case JMP_FALSE:
+                return !v1->arithmetic_int_value;
+            case JMP_EQ:
+                return v1->uint_value == v2->uint_value;
+            case JMP_NEQ:
+                return v1->uint_value != v2->uint_value;
+            case JMP_GT_INT:
+                return v1->arithmetic_int_value > v2->arithmetic_int_value;
+            case JMP_GT_DECIMAL:
+                return decimal_of(v1) > decimal_of(v2);
+            case JMP_LT_INT:
+                return v1->arithmetic_int_value < v2->arithmetic_int_value;
+            case JMP_LT_DECIMAL:
+                return decimal_of(v1) < decimal_of(v2);
+            case JMP_GTE_INT:
+                return v1->arithmetic_int_value >= v2->arithmetic_int_value;
+            case JMP_GTE_DECIMAL:
+                return decimal_of(v1) >= decimal_of(v2);
+            case JMP_LTE_INT:
+                return v1->arithmetic_int_value <= v2->arithmetic_int_value;
+            default:
+                return decimal_of(v1) <= decimal_of(v2);
+        }
+    }
+
+    static void *get_osr_entry(uint64_t entry_index, uint64_t loop_header_index) {
+        auto &tiering = *vm_instance->tiering;
+        auto existing = tiering.osr_entries.find(loop_header_index);
+        if (existing != tiering.osr_entries.end()) {
+            return existing->second;
+        }
+        auto entry = vm_jit_compile_osr(tiering.program, entry_index, loop_header_index);
+        tiering.osr_entries[loop_header_index] = entry;
+        return entry;
+    }
+
+    // the generated code calls here for the functions that are not compiled yet
+    static void vm_interpreter_bridge() {
+        // the jit's CALL has left no return ip in the frame, so the run ends with this function
+        auto &tiering = *vm_instance->tiering;
+        interpret(tiering.instructions, tiering.instructions + tiering.bridge_target, 1);
+    }
+
+    void *vm_tiered_call_target(uint64_t instruction_index) {
+        auto &tiering = *vm_instance->tiering;
+        auto native = tiering.native_entries[instruction_index];
+        if (native != nullptr) {
+            return native;
+        }
+        tiering.bridge_target = instruction_index;
+        return (void *) vm_interpreter_bridge;
+    }
+
+    void vm_run_tiered(Program *program, uint64_t hot_threshold) {
+        begin_run();
+        load_labels();
+        uint64_t count;
+        vm_instruction_t *instructions = prepare_vm_instructions(program, opcode_labels, &count);
+
+        free_tiering(vm_instance);
+        vm_instance->tiering = new vm_tiering_t();
+        auto &tiering = *vm_instance->tiering;
+        tiering.program = program;
+        tiering.instructions = instructions;
+        tiering.hot_threshold = hot_threshold;
+        tiering.function_of.assign(count, 0);
+        tiering.counters.assign(count, 0);
+        tiering.handlers.assign(count, nullptr);
+        tiering.native_entries.assign(count, nullptr);
+
+        tiering.opcodes.assign(count, NO_OPCODE);
+
+        // watch the function entries and the backward jumps
+        uint64_t current_function = 0;
+        for (uint64_t i = 0; i < count; i++) {
+            auto *instruction = instructions + i;
+            auto branch_addr = instruction->branch_addr;
+            uint64_t opcode = NO_OPCODE;
+            for (uint64_t candidate = FN_ENTER_HEAP; candidate <= JMP_LTE_DECIMAL; candidate++) {
+                if (opcode_labels[candidate - 2] == branch_addr) opcode = candidate;
+            }
+            if (opcode == FN_ENTER_HEAP || opcode == FN_ENTER_STACK) {
+                current_function = i;
+                // the root is entered once and has no frame header to return through, only its loops tier it up
+                if (i != 0) {
+                    tiering.handlers[i] = branch_addr;
+                    tiering.opcodes[i] = opcode;
+                    instruction->branch_addr = tiering_labels[TIERING_COUNT_CALL];
+                }
+            } else if (opcode != NO_OPCODE && (vm_instruction_t *) instruction->destination <= instruction) {
+                tiering.handlers[i] = branch_addr;
+                tiering.opcodes[i] = opcode;
+                instruction->branch_addr = tiering_labels[TIERING_COUNT_BACK_EDGE];
+            }
+            tiering.function_of[i] = current_function;
+        }
+
+        interpret(instructions, instructions, 0);
+        object_manager_log_statistics();
+    }
+
+#endif
+    void vm_load(Program *program, uint64_t hot_threshold) {
+        begin_run();
+        vm_instance->keeps_globals = true;
+#ifdef JIT_AVAILABLE
+        if (hot_threshold != 0) {
+            vm_run_tiered(program, hot_threshold);
+        } else {
+            vm_interpret(program);
+        }
+#else
+        vm_interpret(program);
+#endif
+        vm_instance->keeps_globals = false;
+        // the root context is on the heap, nothing on the stack is needed anymore
+        vm_instance->stack_pointer = 0;
+    }
+
+    z_value_t vm_call(z_value_t function, const z_value_t *arguments, uint64_t argument_count) {
+        auto instance = vm_instance;
+        if (instance == nullptr || instance->globals == nullptr) {
+            vm_log.error("no program is loaded in this instance");
+            exit(1);
+        }
+        if (object_manager_guess_type(function) != VM_VALUE_TYPE_FUNCTION_REF) {
+            vm_log.error("only a function reference can be called");
+            exit(1);
+        }
+        auto *fnc_ref = (z_fnc_ref_t *) function.ptr_value;
+        auto instructions = (vm_instruction_t *) instance->code.data();
+        auto entry = instructions + fnc_ref->instruction_index;
+        if (entry->op2 != argument_count) {
+            vm_log.error("the function takes %d arguments, it was called with %d", (int) entry->op2,
+                         (int) argument_count);
+            exit(1);
+        }
+        // the result is returned into a slot below the frame, where the collector can see it
+        auto result_index = instance->stack_pointer;
+        instance->value_stack[result_index] = nvalue();
+        instance->stack_pointer++;
+        auto frame = &instance->value_stack[instance->stack_pointer + FRAME_HEADER_SIZE];
+        frame[0] = function;
+        for (uint64_t i = 0; i < argument_count; i++) {
+            frame[i + 1] = arguments[i];
+        }
+        // no return ip, the run ends when the function returns. as the bridge from the generated code does it
+        push_frame(frame, argument_count, nullptr, &instance->value_stack[result_index], 0,
+                   instance->stack_pointer);
+        load_labels();
+        interpret(instructions, entry, 1);
+
+        instance->stack_pointer = result_index;
+        vm_flush_output();
+        auto result = instance->value_stack[result_index];
+        if ((result.uint_value >> 48) == 0 && result.ptr_value != nullptr) {
+            // an object, the host holds it until it is released. a young one would be moved by the next collection,
+            // so it is promoted now and old objects never move
+            instance->handles.push_back(result);
+            if (object_manager_is_young(result)) {
+                object_manager_collect_young(nullptr);
+            }
+            result = instance->handles.back();
+        }
+        return result;
+    }
+
+    void vm_release(z_value_t value) {
+        auto &handles = vm_instance->handles;
+        for (auto it = handles.rbegin(); it != handles.rend(); it++) {
+            if (it->uint_value == value.uint_value) {
+                handles.erase(next(it).base());
+                return;
+            }
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,171 @@
+#include <vm/executor.h>
+#include <common/logger.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+namespace zero {
+
+    //// --- IMPL
+
+    class Executor::Impl {
+    public:
+        Impl(uint64_t workerCount, const function<void(Program *)> &run) {
+            this->run = run;
+            if (workerCount == 0) workerCount = 1;
+            for (uint64_t i = 0; i < workerCount; i++) {
+                workers.push_back(new Worker());
+            }
+            for (uint64_t i = 0; i < workerCount; i++) {
+                workers[i]->runner = thread(&Impl::work, this, i);
+            }
+            log.debug("started %d workers", (int) workerCount);
+        }
+
+        ~Impl() {
+            wait();
+            {
+                lock_guard<mutex> guard(idleLock);
+                stopping = true;
+            }
+            idle.notify_all();
+            for (auto worker: workers) {
+                worker->runner.join();
+            }
+            // only after all of them stopped, the others look into its deque until then
+            for (auto worker: workers) {
+                delete worker;
+            }
+        }
+
+        void submit(Program *program) {
+            // laid out once here, the workers only read it
+            program->toBytes();
+            program->getInstructions();
+            program->getStringConstants();
+
+            pending++;
+            auto worker = workers[nextWorker++ % workers.size()];
+            {
+                lock_guard<mutex> guard(worker->lock);
+                worker->jobs.push_back(program);
+            }
+            {
+                lock_guard<mutex> guard(idleLock);
+                queued++;
+            }
+            idle.notify_one();
+        }
+
+        void wait() {
+            unique_lock<mutex> guard(doneLock);
+            done.wait(guard, [this] { return pending == 0; });
+        }
+
+        void logStatistics() {
+            for (uint64_t i = 0; i < workers.size(); i++) {
+                log.info("worker %d ran %d programs, %d of them stolen from the others", (int) i,
+                         (int) workers[i]->ran, (int) workers[i]->stolen);
+            }
+        }
+
+    private:
+        typedef struct {
+            mutex lock;
+            deque<Program *> jobs;
+            thread runner;
+            uint64_t ran = 0;
+            uint64_t stolen = 0;
+        } Worker;
+
+        Logger log = Logger("executor");
+        function<void(Program *)> run;
+        vector<Worker *> workers;
+        uint64_t nextWorker = 0;
+
+        atomic<uint64_t> pending{0}; // submitted and not finished yet
+        mutex doneLock;
+        condition_variable done;
+
+        uint64_t queued = 0; // in the deques, guarded by idleLock
+        bool stopping = false;
+        mutex idleLock;
+        condition_variable idle;
+
+        // its own newest program, or the oldest one of another worker
+        Program *take(uint64_t index) {
+            auto self = workers[index];
+            Program *program = nullptr;
+            {
+                lock_guard<mutex> guard(self->lock);
+                if (!self->jobs.empty()) {
+                    program = self->jobs.back();
+                    self->jobs.pop_back();
+                }
+            }
+            for (uint64_t i = 1; program == nullptr && i < workers.size(); i++) {
+                auto victim = workers[(index + i) % workers.size()];
+                lock_guard<mutex> guard(victim->lock);
+                if (!victim->jobs.empty()) {
+                    program = victim->jobs.front();
+                    victim->jobs.pop_front();
+                    self->stolen++;
+                }
+            }
+            if (program != nullptr) {
+                lock_guard<mutex> guard(idleLock);
+                queued--;
+            }
+            return program;
+        }
+
+        void work(uint64_t index) {
+            auto worker = workers[index];
+            vm_use_instance(vm_create_instance());
+            while (true) {
+                auto program = take(index);
+                if (program == nullptr) {
+                    unique_lock<mutex> guard(idleLock);
+                    idle.wait(guard, [this] { return stopping || queued > 0; });
+                    if (stopping && queued == 0) break;
+                    continue;
+                }
+                vm_hold_output();
+                run(program);
+                vm_release_output();
+                worker->ran++;
+                if (--pending == 0) {
+                    lock_guard<mutex> guard(doneLock);
+                    done.notify_all();
+                }
+            }
+            vm_destroy_instance(vm_instance);
+        }
+    };
+
+    //// --- PUBLIC
+    Executor::Executor(uint64_t workerCount, const function<void(Program *)> &run) {
+        impl = new Executor::Impl(workerCount, run);
+    }
+
+    Executor::~Executor() {
+        delete impl;
+    }
+
+    void Executor::submit(Program *program) {
+        impl->submit(program);
+    }
+
+    void Executor::wait() {
+        impl->wait();
+    }
+
+    void Executor::logStatistics() {
+        impl->logStatistics();
+    }
+}
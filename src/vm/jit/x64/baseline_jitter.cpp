@@ -13,88 +13,88 @@ namespace zero {
                                        x86::Assembler &);
 
     void compile_add_int(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
-        a.mov(x86::edx, x86::dword_ptr(x86::r12, op1 + 4));
-        a.add(x86::edx, x86::dword_ptr(x86::r12, op2 + 4));
+        a.mov(x86::edx, x86::dword_ptr(x86::r12, op1));
+        a.add(x86::edx, x86::dword_ptr(x86::r12, op2));
         if (dest != op1 && dest != op2) {
             // if the destination is one of the operands, it is already "tagged as int". no need to tag again
-            a.mov(x86::dword_ptr(x86::r12, dest), 0x1);
+            a.mov(x86::dword_ptr(x86::r12, dest + 4), VALUE_TAG_INT);
         }
-        a.mov(x86::dword_ptr(x86::r12, dest + 4), x86::edx);
+        a.mov(x86::dword_ptr(x86::r12, dest), x86::edx);
     }
 
     void compile_sub_int(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
-        a.mov(x86::edx, x86::dword_ptr(x86::r12, op1 + 4));
-        a.sub(x86::edx, x86::dword_ptr(x86::r12, op2 + 4));
+        a.mov(x86::edx, x86::dword_ptr(x86::r12, op1));
+        a.sub(x86::edx, x86::dword_ptr(x86::r12, op2));
         if (dest != op1 && dest != op2) {
             // if the destination is one of the operands, it is already "tagged as int". no need to tag again
-            a.mov(x86::dword_ptr(x86::r12, dest), 0x1);
+            a.mov(x86::dword_ptr(x86::r12, dest + 4), VALUE_TAG_INT);
         }
-        a.mov(x86::dword_ptr(x86::r12, dest + 4), x86::edx);
+        a.mov(x86::dword_ptr(x86::r12, dest), x86::edx);
     }
 
     void compile_mod_int(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
-        a.mov(x86::eax, x86::dword_ptr(x86::r12, op1 + 4));
+        a.mov(x86::eax, x86::dword_ptr(x86::r12, op1));
         a.cdq();
-        a.idiv(x86::dword_ptr(x86::r12, op2 + 4));
+        a.idiv(x86::dword_ptr(x86::r12, op2));
         if (dest != op1 && dest != op2) {
             // if the destination is one of the operands, it is already "tagged as int". no need to tag again
-            a.mov(x86::dword_ptr(x86::r12, dest), 0x1);
+            a.mov(x86::dword_ptr(x86::r12, dest + 4), VALUE_TAG_INT);
         }
-        a.mov(x86::dword_ptr(x86::r12, dest + 4), x86::edx);
+        a.mov(x86::dword_ptr(x86::r12, dest), x86::edx);
     }
 
     void compile_cmp_gte_int(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
-        a.mov(x86::eax, x86::dword_ptr(x86::r12, op2 + 4));
-        a.cmp(x86::dword_ptr(x86::r12, op1 + 4), x86::eax);
+        a.mov(x86::eax, x86::dword_ptr(x86::r12, op2));
+        a.cmp(x86::dword_ptr(x86::r12, op1), x86::eax);
         a.setge(x86::al);
         a.movsx(x86::eax, x86::al);
-        a.mov(x86::dword_ptr(x86::r12, dest), 0x3);
-        a.mov(x86::dword_ptr(x86::r12, dest + 4), x86::eax);
+        a.mov(x86::dword_ptr(x86::r12, dest + 4), VALUE_TAG_BOOLEAN);
+        a.mov(x86::dword_ptr(x86::r12, dest), x86::eax);
     }
 
     void compile_cmp_gt_int(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
-        a.mov(x86::eax, x86::dword_ptr(x86::r12, op2 + 4));
-        a.cmp(x86::dword_ptr(x86::r12, op1 + 4), x86::eax);
+        a.mov(x86::eax, x86::dword_ptr(x86::r12, op2));
+        a.cmp(x86::dword_ptr(x86::r12, op1), x86::eax);
         a.setg(x86::al);
         a.movsx(x86::eax, x86::al);
-        a.mov(x86::dword_ptr(x86::r12, dest), 0x3);
-        a.mov(x86::dword_ptr(x86::r12, dest + 4), x86::eax);
+        a.mov(x86::dword_ptr(x86::r12, dest + 4), VALUE_TAG_BOOLEAN);
+        a.mov(x86::dword_ptr(x86::r12, dest), x86::eax);
     }
 
     void compile_cmp_lt_int(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
-        a.mov(x86::eax, x86::dword_ptr(x86::r12, op2 + 4));
-        a.cmp(x86::dword_ptr(x86::r12, op1 + 4), x86::eax);
+        a.mov(x86::eax, x86::dword_ptr(x86::r12, op2));
+        a.cmp(x86::dword_ptr(x86::r12, op1), x86::eax);
         a.setl(x86::al);
         a.movsx(x86::eax, x86::al);
-        a.mov(x86::dword_ptr(x86::r12, dest), 0x3);
-        a.mov(x86::dword_ptr(x86::r12, dest + 4), x86::eax);
+        a.mov(x86::dword_ptr(x86::r12, dest + 4), VALUE_TAG_BOOLEAN);
+        a.mov(x86::dword_ptr(x86::r12, dest), x86::eax);
     }
 
     void compile_cmp_lte_int(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
-        a.mov(x86::eax, x86::dword_ptr(x86::r12, op2 + 4));
-        a.cmp(x86::dword_ptr(x86::r12, op1 + 4), x86::eax);
+        a.mov(x86::eax, x86::dword_ptr(x86::r12, op2));
+        a.cmp(x86::dword_ptr(x86::r12, op1), x86::eax);
         a.setle(x86::al);
         a.movsx(x86::eax, x86::al);
-        a.mov(x86::dword_ptr(x86::r12, dest), 0x3);
-        a.mov(x86::dword_ptr(x86::r12, dest + 4), x86::eax);
+        a.mov(x86::dword_ptr(x86::r12, dest + 4), VALUE_TAG_BOOLEAN);
+        a.mov(x86::dword_ptr(x86::r12, dest), x86::eax);
     }
 
     void compile_cmp_eq(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
-        a.mov(x86::eax, x86::dword_ptr(x86::r12, op2 + 4));
-        a.cmp(x86::dword_ptr(x86::r12, op1 + 4), x86::eax);
+        a.mov(x86::rax, x86::qword_ptr(x86::r12, op2));
+        a.cmp(x86::qword_ptr(x86::r12, op1), x86::rax);
         a.sete(x86::al);
         a.movsx(x86::eax, x86::al);
-        a.mov(x86::dword_ptr(x86::r12, dest), 0x3);
-        a.mov(x86::dword_ptr(x86::r12, dest + 4), x86::eax);
+        a.mov(x86::dword_ptr(x86::r12, dest + 4), VALUE_TAG_BOOLEAN);
+        a.mov(x86::dword_ptr(x86::r12, dest), x86::eax);
     }
 
     void compile_cmp_neq(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
-        a.mov(x86::eax, x86::dword_ptr(x86::r12, op2 + 4));
-        a.cmp(x86::dword_ptr(x86::r12, op1 + 4), x86::eax);
+        a.mov(x86::rax, x86::qword_ptr(x86::r12, op2));
+        a.cmp(x86::qword_ptr(x86::r12, op1), x86::rax);
         a.setne(x86::al);
         a.movsx(x86::eax, x86::al);
-        a.mov(x86::dword_ptr(x86::r12, dest), 0x3);
-        a.mov(x86::dword_ptr(x86::r12, dest + 4), x86::eax);
+        a.mov(x86::dword_ptr(x86::r12, dest + 4), VALUE_TAG_BOOLEAN);
+        a.mov(x86::dword_ptr(x86::r12, dest), x86::eax);
     }
 
     void compile_mov(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
@@ -103,13 +103,13 @@ namespace zero {
     }
 
     void compile_mov_int(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
-        a.mov(x86::dword_ptr(x86::r12, dest), 0x1);
-        a.mov(x86::dword_ptr(x86::r12, dest + 4), op1);
+        a.mov(x86::dword_ptr(x86::r12, dest + 4), VALUE_TAG_INT);
+        a.mov(x86::dword_ptr(x86::r12, dest), op1);
     }
 
     void compile_mov_boolean(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
-        a.mov(x86::dword_ptr(x86::r12, dest), 0x3);
-        a.mov(x86::dword_ptr(x86::r12, dest + 4), op1);
+        a.mov(x86::dword_ptr(x86::r12, dest + 4), VALUE_TAG_BOOLEAN);
+        a.mov(x86::dword_ptr(x86::r12, dest), op1);
     }
 
     void compile_jmp(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
@@ -117,12 +117,45 @@ namespace zero {
         a.jmp(target_label);
     }
 
+    void compile_jmp_eq(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
+        a.mov(x86::rax, x86::qword_ptr(x86::r12, op2));
+        a.cmp(x86::qword_ptr(x86::r12, op1), x86::rax);
+        a.je(labels->at(dest));
+    }
+
+    void compile_jmp_neq(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
+        a.mov(x86::rax, x86::qword_ptr(x86::r12, op2));
+        a.cmp(x86::qword_ptr(x86::r12, op1), x86::rax);
+        a.jne(labels->at(dest));
+    }
+
+    void compile_jmp_gt_int(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
+        a.mov(x86::eax, x86::dword_ptr(x86::r12, op2));
+        a.cmp(x86::dword_ptr(x86::r12, op1), x86::eax);
+        a.jg(labels->at(dest));
+    }
+
+    void compile_jmp_lt_int(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
+        a.mov(x86::eax, x86::dword_ptr(x86::r12, op2));
+        a.cmp(x86::dword_ptr(x86::r12, op1), x86::eax);
+        a.jl(labels->at(dest));
+    }
+
+    void compile_jmp_gte_int(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
+        a.mov(x86::eax, x86::dword_ptr(x86::r12, op2));
+        a.cmp(x86::dword_ptr(x86::r12, op1), x86::eax);
+        a.jge(labels->at(dest));
+    }
+
+    void compile_jmp_lte_int(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
+        a.mov(x86::eax, x86::dword_ptr(x86::r12, op2));
+        a.cmp(x86::dword_ptr(x86::r12, op1), x86::eax);
+        a.jle(labels->at(dest));
+    }
+
     void compile_mov_decimal(uint64_t op1, uint64_t op2, uint64_t dest, vector<Label> *labels, x86::Assembler &a) {
-        a.mov(x86::rax, op1);
-        a.movq(x86::xmm(0), x86::rax);
-        a.cvtsd2ss(x86::xmm(0), x86::xmm(0));
-        a.mov(x86::dword_ptr(x86::r12, dest), 0x2);
-        a.movss(x86::dword_ptr(x86::r12, dest + 4), x86::xmm(0));
+        a.mov(x86::rax, jit_encode_decimal(op1));
+        a.mov(x86::qword_ptr(x86::r12, dest), x86::rax);
     }
 
     // some opcodes are just too simple that we can inline them
@@ -139,6 +172,12 @@ namespace zero {
             {MOV,         compile_mov},
             {MOV_INT,     compile_mov_int},
             {JMP,         compile_jmp},
+            {JMP_EQ,      compile_jmp_eq},
+            {JMP_NEQ,     compile_jmp_neq},
+            {JMP_GT_INT,  compile_jmp_gt_int},
+            {JMP_LT_INT,  compile_jmp_lt_int},
+            {JMP_GTE_INT, compile_jmp_gte_int},
+            {JMP_LTE_INT, compile_jmp_lte_int},
             {MOV_DECIMAL, compile_mov_decimal},
             {MOV_BOOLEAN, compile_mov_boolean}
     };
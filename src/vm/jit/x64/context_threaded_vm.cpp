@@ -5,6 +5,7 @@
 #include <common/util.h>
 
 #include <cmath>
+#include <cstring>
 
 #include <vm/jit.h>
 
@@ -26,38 +27,26 @@ using namespace std;
 
 namespace zero {
 
+    // the registers of the generated code, so they belong to the thread running it
     register z_value_t *context_object asm ("r12");
-    int64_t base_pointer;
-    uint64_t call_depth;
-
-    uint64_t z_handler_FN_ENTER_HEAP(z_op_t local_values_size, z_op_t op2, z_op_t dest) {
-        auto parent_context = (z_value_t *) pop().ptr_value;
-        context_object = alloc(local_values_size.uint_vaLue);
-        init_call_context(context_object, parent_context);
-
-        VM_DEBUG(("function enter heap, bp: %d, sp: %d", base_pointer, stack_pointer));
-        push(uvalue(base_pointer));
-        base_pointer = stack_pointer;
+    static VM_THREAD_LOCAL int64_t base_pointer;
+    static VM_THREAD_LOCAL uint64_t call_depth;
+
+    uint64_t z_handler_FN_ENTER_HEAP(z_op_t local_values_size, z_op_t argument_count, z_op_t dest) {
+        VM_DEBUG(("function enter heap, bp: %d, sp: %d", base_pointer, vm_instance->stack_pointer));
+        base_pointer = vm_instance->stack_pointer;
+        context_object = enter_heap_frame(local_values_size.uint_vaLue, argument_count.uint_vaLue, context_object);
+        object_manager_enter_context(context_object);
         call_depth++;
         return 0;
     }
 
-    uint64_t z_handler_FN_ENTER_STACK(z_op_t local_values_size, z_op_t op2, z_op_t dest) {
-        auto parent_context = (z_value_t *) pop().ptr_value;
-        VM_DEBUG(("function enter stack, bp: %d, sp: %d", base_pointer, stack_pointer));
-        push(uvalue(base_pointer));
-        base_pointer = stack_pointer;
+    uint64_t z_handler_FN_ENTER_STACK(z_op_t local_values_size, z_op_t argument_count, z_op_t dest) {
+        VM_DEBUG(("function enter stack, bp: %d, sp: %d", base_pointer, vm_instance->stack_pointer));
+        base_pointer = vm_instance->stack_pointer;
+        context_object = enter_stack_frame(local_values_size.uint_vaLue);
         call_depth++;
-        context_object = &value_stack[stack_pointer];
-        init_call_context(context_object, parent_context);
-
-        stack_pointer += local_values_size.uint_vaLue;
-        if (stack_pointer > STACK_MAX) {
-            vm_log.error("could not allocate local stack frame, stack overflow!");
-            exit(1);
-        }
-
-        VM_DEBUG(("stack allocated %d, sp: %d", local_values_size, stack_pointer));
+        VM_DEBUG(("stack allocated %d, sp: %d", local_values_size, vm_instance->stack_pointer));
         return 0;
     }
 
@@ -68,13 +57,61 @@ namespace zero {
     uint64_t z_handler_JMP_EQ(z_op_t op1, z_op_t op2, z_op_t dest) {
         auto v1 = OP1_PTR;
         auto v2 = OP2_PTR;
-        return (v1->arithmetic_int_value == v2->arithmetic_int_value);
+        return (v1->uint_value == v2->uint_value);
     }
 
     uint64_t z_handler_JMP_NEQ(z_op_t op1, z_op_t op2, z_op_t dest) {
         auto v1 = OP1_PTR;
         auto v2 = OP2_PTR;
-        return (v1->arithmetic_int_value != v2->arithmetic_int_value);
+        return (v1->uint_value != v2->uint_value);
+    }
+
+    uint64_t z_handler_JMP_GT_INT(z_op_t op1, z_op_t op2, z_op_t dest) {
+        auto v1 = OP1_PTR;
+        auto v2 = OP2_PTR;
+        return (v1->arithmetic_int_value > v2->arithmetic_int_value);
+    }
+
+    uint64_t z_handler_JMP_GT_DECIMAL(z_op_t op1, z_op_t op2, z_op_t dest) {
+        auto v1 = OP1_PTR;
+        auto v2 = OP2_PTR;
+        return (decimal_of(v1) > decimal_of(v2));
+    }
+
+    uint64_t z_handler_JMP_LT_INT(z_op_t op1, z_op_t op2, z_op_t dest) {
+        auto v1 = OP1_PTR;
+        auto v2 = OP2_PTR;
+        return (v1->arithmetic_int_value < v2->arithmetic_int_value);
+    }
+
+    uint64_t z_handler_JMP_LT_DECIMAL(z_op_t op1, z_op_t op2, z_op_t dest) {
+        auto v1 = OP1_PTR;
+        auto v2 = OP2_PTR;
+        return (decimal_of(v1) < decimal_of(v2));
+    }
+
+    uint64_t z_handler_JMP_GTE_INT(z_op_t op1, z_op_t op2, z_op_t dest) {
+        auto v1 = OP1_PTR;
+        auto v2 = OP2_PTR;
+        return (v1->arithmetic_int_value >= v2->arithmetic_int_value);
+    }
+
+    uint64_t z_handler_JMP_GTE_DECIMAL(z_op_t op1, z_op_t op2, z_op_t dest) {
+        auto v1 = OP1_PTR;
+        auto v2 = OP2_PTR;
+        return (decimal_of(v1) >= decimal_of(v2));
+    }
+
+    uint64_t z_handler_JMP_LTE_INT(z_op_t op1, z_op_t op2, z_op_t dest) {
+        auto v1 = OP1_PTR;
+        auto v2 = OP2_PTR;
+        return (v1->arithmetic_int_value <= v2->arithmetic_int_value);
+    }
+
+    uint64_t z_handler_JMP_LTE_DECIMAL(z_op_t op1, z_op_t op2, z_op_t dest) {
+        auto v1 = OP1_PTR;
+        auto v2 = OP2_PTR;
+        return (decimal_of(v1) <= decimal_of(v2));
     }
 
     uint64_t z_handler_JMP_TRUE(z_op_t op1, z_op_t op2, z_op_t dest) {
@@ -93,7 +130,7 @@ namespace zero {
     }
 
     uint64_t z_handler_MOV_FNC(z_op_t op1, z_op_t op2, z_op_t dest) {
-        *DESTINATION_PTR = fvalue(op1.uint_vaLue, context_object);
+        *DESTINATION_PTR = fvalue(op1.uint_vaLue, op2.uint_vaLue, context_object);
         return 0;
     }
 
@@ -120,36 +157,45 @@ namespace zero {
     }
 
     uint64_t z_handler_MOV_STRING(z_op_t op1, z_op_t op2, z_op_t dest) {
-        auto *data = op1.str_value;
-        VM_DEBUG(("mov str, %s", op1.str_value->c_str()));
-        auto *copy = new string(*data);
-        *DESTINATION_PTR = svalue(copy);
+        auto *data = get_string_constant_at(op1.uint_vaLue);
+        VM_DEBUG(("mov str, %s", data->c_str()));
+        *DESTINATION_PTR = svalue(data);
         return 0;
     }
 
     uint64_t z_handler_CALL(z_op_t op1, z_op_t op2, z_op_t dest) {
-        VM_DEBUG(("call, bp: %d, sp: %d", base_pointer, stack_pointer));
+        VM_DEBUG(("call, bp: %d, sp: %d", base_pointer, vm_instance->stack_pointer));
         z_value_t &callee = context_object[op1.uint_vaLue];
         auto *fnc_ref = (z_fnc_ref_t *) callee.ptr_value;
         if (object_manager_is_null(callee)) {
             vm_log.error("null pointer exception: callee address was null");
             exit(1);
         }
-        // push number of params pushed to stack
-        push(uvalue(op2.uint_vaLue));
-        // push current context pointer
-        push(pvalue(context_object));
-        // push requested return index
-        push(uvalue(dest.uint_vaLue));
-        // push parent context ptr;
-        push(pvalue(fnc_ref->parent_context_ptr));
+        // the function reference and the arguments are already in place, the callee frame begins with them.
+        // the generated code returns with the machine's ret, so there is no return ip
+        push_frame(&callee, op2.uint_vaLue, nullptr, context_object, dest.uint_vaLue * sizeof(z_value_t),
+                   base_pointer);
 
         return (uintptr_t) fnc_ref->instruction_index;
     }
 
+    // calls from the generated code in the tiered mode. function refs hold instruction indexes there
+    uint64_t z_handler_CALL_TIERED(z_op_t op1, z_op_t op2, z_op_t dest) {
+        z_value_t &callee = context_object[op1.uint_vaLue];
+        auto *fnc_ref = (z_fnc_ref_t *) callee.ptr_value;
+        if (object_manager_is_null(callee)) {
+            vm_log.error("null pointer exception: callee address was null");
+            exit(1);
+        }
+        push_frame(&callee, op2.uint_vaLue, nullptr, context_object, dest.uint_vaLue * sizeof(z_value_t),
+                   base_pointer);
+
+        return (uintptr_t) vm_tiered_call_target(fnc_ref->instruction_index);
+    }
+
     uint64_t z_handler_CALL_NATIVE(z_op_t op1, z_op_t op2, z_op_t dest) {
-        auto native_handler = get_native_fnc_at(OP1_PTR->uint_value);
-        *DESTINATION_PTR = native_handler();
+        auto native = OP1_PTR;
+        *DESTINATION_PTR = get_native_fnc_of(*native)(native + 1, op2.uint_vaLue);
         return 0;
     }
 
@@ -160,15 +206,18 @@ namespace zero {
     }
 
     uint64_t z_handler_ADD_STRING(z_op_t op1, z_op_t op2, z_op_t dest) {
-        auto str1 = OP1_PTR->string_value;
-        auto str2 = OP2_PTR->string_value;
-        *DESTINATION_PTR = svalue(new string(*str1 + *str2));
+        *DESTINATION_PTR = object_manager_concat(OP1_PTR, OP2_PTR, context_object);
+        return 0;
+    }
+
+    uint64_t z_handler_CONCAT_N(z_op_t op1, z_op_t op2, z_op_t dest) {
+        *DESTINATION_PTR = object_manager_concat_n(OP1_PTR, op2.uint_vaLue, context_object);
         return 0;
     }
 
     uint64_t z_handler_ADD_DECIMAL(z_op_t op1, z_op_t op2, z_op_t dest) {
         *DESTINATION_PTR = dvalue(
-                OP1_PTR->arithmetic_decimal_value + OP2_PTR->arithmetic_decimal_value);
+                decimal_of(OP1_PTR) + decimal_of(OP2_PTR));
         return 0;
     }
 
@@ -180,7 +229,7 @@ namespace zero {
 
     uint64_t z_handler_SUB_DECIMAL(z_op_t op1, z_op_t op2, z_op_t dest) {
         *DESTINATION_PTR = dvalue(
-                OP1_PTR->arithmetic_decimal_value - OP2_PTR->arithmetic_decimal_value);
+                decimal_of(OP1_PTR) - decimal_of(OP2_PTR));
         return 0;
     }
 
@@ -192,7 +241,7 @@ namespace zero {
 
     uint64_t z_handler_DIV_DECIMAL(z_op_t op1, z_op_t op2, z_op_t dest) {
         *DESTINATION_PTR = dvalue(
-                OP1_PTR->arithmetic_decimal_value / OP2_PTR->arithmetic_decimal_value);
+                decimal_of(OP1_PTR) / decimal_of(OP2_PTR));
         return 0;
     }
 
@@ -205,8 +254,8 @@ namespace zero {
 
     uint64_t z_handler_MUL_DECIMAL(z_op_t op1, z_op_t op2, z_op_t dest) {
         *DESTINATION_PTR = dvalue(
-                OP1_PTR->arithmetic_decimal_value *
-                OP2_PTR->arithmetic_decimal_value);
+                decimal_of(OP1_PTR) *
+                decimal_of(OP2_PTR));
         return 0;
     }
 
@@ -218,14 +267,14 @@ namespace zero {
 
     uint64_t z_handler_MOD_DECIMAL(z_op_t op1, z_op_t op2, z_op_t dest) {
         *DESTINATION_PTR = dvalue(
-                fmod(OP1_PTR->arithmetic_decimal_value, OP2_PTR->arithmetic_decimal_value));
+                fmod(decimal_of(OP1_PTR), decimal_of(OP2_PTR)));
         return 0;
     }
 
     uint64_t z_handler_CMP_EQ(z_op_t op1, z_op_t op2, z_op_t dest) {
         auto v1 = OP1_PTR;
         auto v2 = OP2_PTR;
-        auto ret = v1->arithmetic_int_value == v2->arithmetic_int_value;
+        auto ret = v1->uint_value == v2->uint_value;
         *DESTINATION_PTR = bvalue(ret);
         return ret;
     }
@@ -233,7 +282,7 @@ namespace zero {
     uint64_t z_handler_CMP_NEQ(z_op_t op1, z_op_t op2, z_op_t dest) {
         auto v1 = OP1_PTR;
         auto v2 = OP2_PTR;
-        auto ret = v1->arithmetic_int_value != v2->arithmetic_int_value;
+        auto ret = v1->uint_value != v2->uint_value;
         *DESTINATION_PTR = bvalue(ret);
         return ret;
     }
@@ -249,7 +298,7 @@ namespace zero {
     uint64_t z_handler_CMP_GT_DECIMAL(z_op_t op1, z_op_t op2, z_op_t dest) {
         auto v1 = OP1_PTR;
         auto v2 = OP2_PTR;
-        auto ret = v1->arithmetic_decimal_value > v2->arithmetic_int_value;
+        auto ret = decimal_of(v1) > decimal_of(v2);
         *DESTINATION_PTR = bvalue(ret);
         return ret;
     }
@@ -265,7 +314,7 @@ namespace zero {
     uint64_t z_handler_CMP_LT_DECIMAL(z_op_t op1, z_op_t op2, z_op_t dest) {
         auto v1 = OP1_PTR;
         auto v2 = OP2_PTR;
-        auto ret = v1->arithmetic_decimal_value < v2->arithmetic_decimal_value;
+        auto ret = decimal_of(v1) < decimal_of(v2);
         *DESTINATION_PTR = bvalue(ret);
         return ret;
     }
@@ -281,7 +330,7 @@ namespace zero {
     uint64_t z_handler_CMP_GTE_DECIMAL(z_op_t op1, z_op_t op2, z_op_t dest) {
         auto v1 = OP1_PTR;
         auto v2 = OP2_PTR;
-        auto ret = v1->arithmetic_decimal_value >= v2->arithmetic_decimal_value;
+        auto ret = decimal_of(v1) >= decimal_of(v2);
         *DESTINATION_PTR = bvalue(ret);
         return ret;
     }
@@ -297,14 +346,14 @@ namespace zero {
     uint64_t z_handler_CMP_LTE_DECIMAL(z_op_t op1, z_op_t op2, z_op_t dest) {
         auto v1 = OP1_PTR;
         auto v2 = OP2_PTR;
-        auto ret = v1->arithmetic_decimal_value <= v2->arithmetic_decimal_value;
+        auto ret = decimal_of(v1) <= decimal_of(v2);
         *DESTINATION_PTR = bvalue(ret);
         return ret;
     }
 
     uint64_t z_handler_CAST_DECIMAL(z_op_t op1, z_op_t op2, z_op_t dest) {
         *DESTINATION_PTR = dvalue(
-                (float) OP1_PTR->arithmetic_int_value);
+                (double) OP1_PTR->arithmetic_int_value);
         return 0;
     }
 
@@ -315,7 +364,7 @@ namespace zero {
     }
 
     uint64_t z_handler_NEG_DECIMAL(z_op_t op1, z_op_t op2, z_op_t dest) {
-        *DESTINATION_PTR = dvalue(-1 * OP1_PTR->arithmetic_decimal_value);
+        *DESTINATION_PTR = dvalue(-1 * decimal_of(OP1_PTR));
         return 0;
     }
 
@@ -329,35 +378,66 @@ namespace zero {
         return 0;
     }
 
-    uint64_t z_handler_ARG_READ(z_op_t op1, z_op_t op2, z_op_t dest) {
-        auto argNumber = op1.int_value;
-        *DESTINATION_PTR = value_stack[base_pointer - 5 - argNumber]; // 5 is because of the calling convention
+    uint64_t z_handler_GET_UPVALUE(z_op_t op1, z_op_t op2, z_op_t dest) {
+        auto closure = (z_fnc_ref_t *) context_object[0].ptr_value;
+        *DESTINATION_PTR = object_manager_captures_of(closure)[op1.uint_vaLue];
         return 0;
     }
 
-    uint64_t z_handler_GET_IN_PARENT(z_op_t op1, z_op_t op2, z_op_t dest) {
-        auto depth = op1.uint_vaLue;
-        auto index = op2.uint_vaLue;
-        auto parent_context = context_object;
-        for (int i = 0; i < depth; i++) {
-            parent_context = static_cast<z_value_t *>(parent_context[0].ptr_value);
-        }
-        *DESTINATION_PTR = parent_context[index];
+    uint64_t z_handler_GET_UPVALUE_CELL(z_op_t op1, z_op_t op2, z_op_t dest) {
+        auto closure = (z_fnc_ref_t *) context_object[0].ptr_value;
+        *DESTINATION_PTR = *(z_value_t *) object_manager_captures_of(closure)[op1.uint_vaLue].ptr_value;
         return 0;
     }
 
-    uint64_t z_handler_GET_IN_OBJECT(z_op_t op1, z_op_t op2, z_op_t dest) {
+    uint64_t z_handler_SET_UPVALUE_CELL(z_op_t op1, z_op_t op2, z_op_t dest) {
+        auto closure = (z_fnc_ref_t *) context_object[0].ptr_value;
+        auto cell = (z_value_t *) object_manager_captures_of(closure)[op1.uint_vaLue].ptr_value;
+        *cell = *OP2_PTR;
+        object_manager_write_barrier(cell, *cell);
         return 0;
     }
 
-    uint64_t z_handler_SET_IN_PARENT(z_op_t op1, z_op_t op2, z_op_t dest) {
-        auto depth = op1.uint_vaLue;
-        auto index = op2.uint_vaLue;
-        auto parent_context = context_object;
-        for (int i = 0; i < depth; i++) {
-            parent_context = static_cast<z_value_t *>(parent_context[0].ptr_value);
-        }
-        parent_context[dest.uint_vaLue] = context_object[index];
+    uint64_t z_handler_CAPTURE(z_op_t op1, z_op_t op2, z_op_t dest) {
+        auto fnc_ref = (z_fnc_ref_t *) DESTINATION_PTR->ptr_value;
+        object_manager_captures_of(fnc_ref)[op1.uint_vaLue] = *OP2_PTR;
+        return 0;
+    }
+
+    uint64_t z_handler_CAPTURE_CELL(z_op_t op1, z_op_t op2, z_op_t dest) {
+        auto fnc_ref = (z_fnc_ref_t *) DESTINATION_PTR->ptr_value;
+        object_manager_captures_of(fnc_ref)[op1.uint_vaLue] = pvalue(OP2_PTR);
+        return 0;
+    }
+
+    uint64_t z_handler_CAPTURE_UPVALUE(z_op_t op1, z_op_t op2, z_op_t dest) {
+        auto closure = (z_fnc_ref_t *) context_object[0].ptr_value;
+        auto fnc_ref = (z_fnc_ref_t *) DESTINATION_PTR->ptr_value;
+        object_manager_captures_of(fnc_ref)[op1.uint_vaLue] = object_manager_captures_of(closure)[op2.uint_vaLue];
+        return 0;
+    }
+
+    uint64_t z_handler_MOV_BOX(z_op_t op1, z_op_t op2, z_op_t dest) {
+        auto box = object_manager_create_box(context_object);
+        *box = *DESTINATION_PTR;
+        object_manager_write_barrier(box, *box);
+        *DESTINATION_PTR = pvalue(box);
+        return 0;
+    }
+
+    uint64_t z_handler_GET_CELL(z_op_t op1, z_op_t op2, z_op_t dest) {
+        *DESTINATION_PTR = *(z_value_t *) OP1_PTR->ptr_value;
+        return 0;
+    }
+
+    uint64_t z_handler_SET_CELL(z_op_t op1, z_op_t op2, z_op_t dest) {
+        auto cell = (z_value_t *) DESTINATION_PTR->ptr_value;
+        *cell = *OP1_PTR;
+        object_manager_write_barrier(cell, *cell);
+        return 0;
+    }
+
+    uint64_t z_handler_GET_IN_OBJECT(z_op_t op1, z_op_t op2, z_op_t dest) {
         return 0;
     }
 
@@ -368,34 +448,28 @@ namespace zero {
     uint64_t z_handler_RET(z_op_t op1, z_op_t op2, z_op_t dest) {
         call_depth--;
         if (call_depth == 0) {
+            leave_root_context(context_object);
+            vm_flush_output();
             VM_DEBUG(("root function returned, vm exited"));
             return 0;
         }
 
-        stack_pointer = base_pointer;
-        base_pointer = pop().uint_value;
-
-        auto return_index_in_parent = pop().uint_value;
-        auto return_index_in_current = dest.uint_vaLue;
-        auto current_context_object = context_object;
-        context_object = static_cast<z_value_t *>(pop().ptr_value);
-        auto parent_context_object = context_object;
-        if (return_index_in_current) {
-            // move return value
-            parent_context_object[return_index_in_parent] = current_context_object[return_index_in_current];
-        }
-        auto number_of_params_pushed_to_stack = pop().uint_value;
-        stack_pointer -= number_of_params_pushed_to_stack;
+        context_object = pop_frame(context_object, dest.uint_vaLue, base_pointer);
         return 0;
     }
 
     uint64_t (*func_ptrs[])(z_op_t, z_op_t, z_op_t) =
             {z_handler_FN_ENTER_HEAP, z_handler_FN_ENTER_STACK,
              z_handler_JMP, z_handler_JMP_TRUE, z_handler_JMP_FALSE,
+             z_handler_JMP_EQ, z_handler_JMP_NEQ,
+             z_handler_JMP_GT_INT, z_handler_JMP_GT_DECIMAL,
+             z_handler_JMP_LT_INT, z_handler_JMP_LT_DECIMAL,
+             z_handler_JMP_GTE_INT, z_handler_JMP_GTE_DECIMAL,
+             z_handler_JMP_LTE_INT, z_handler_JMP_LTE_DECIMAL,
              z_handler_MOV, z_handler_MOV_FNC, z_handler_MOV_INT, z_handler_MOV_NULL,
              z_handler_MOV_BOOLEAN, z_handler_MOV_DECIMAL, z_handler_MOV_STRING,
              z_handler_CALL, z_handler_CALL_NATIVE,
-             z_handler_ADD_INT, z_handler_ADD_STRING,
+             z_handler_ADD_INT, z_handler_ADD_STRING, z_handler_CONCAT_N,
              z_handler_ADD_DECIMAL, z_handler_SUB_INT,
              z_handler_SUB_DECIMAL, z_handler_DIV_INT,
              z_handler_DIV_DECIMAL,
@@ -409,16 +483,68 @@ namespace zero {
              z_handler_CMP_LTE_INT,
              z_handler_CMP_LTE_DECIMAL, z_handler_CAST_DECIMAL,
              z_handler_NEG_INT, z_handler_NEG_DECIMAL,
-             z_handler_PUSH, z_handler_POP, z_handler_ARG_READ,
-             z_handler_GET_IN_PARENT,
-             z_handler_GET_IN_OBJECT, z_handler_SET_IN_PARENT,
+             z_handler_PUSH, z_handler_POP,
+             z_handler_GET_UPVALUE, z_handler_GET_UPVALUE_CELL, z_handler_SET_UPVALUE_CELL,
+             z_handler_CAPTURE, z_handler_CAPTURE_CELL, z_handler_CAPTURE_UPVALUE,
+             z_handler_MOV_BOX, z_handler_GET_CELL, z_handler_SET_CELL,
+             z_handler_GET_IN_OBJECT,
              z_handler_SET_IN_OBJECT, z_handler_RET};
 
-    void vm_run(Program *program) {
-        base_pointer = stack_pointer;
-        push(pvalue(nullptr));
-        init_native_functions();
-        z_jit_fnc fnc = baseline_jit(program, func_ptrs);
+    static z_opcode_handler *tiered_func_ptrs[sizeof(func_ptrs) / sizeof(func_ptrs[0])];
+
+    static z_opcode_handler **make_tiered_func_ptrs() {
+        memcpy(tiered_func_ptrs, func_ptrs, sizeof(func_ptrs));
+        tiered_func_ptrs[CALL - 2] = z_handler_CALL_TIERED;
+        return tiered_func_ptrs;
+    }
+
+    static z_opcode_handler **get_tiered_func_ptrs() {
+        // made once, even when several threads start tiering at the same time
+        static z_opcode_handler **ptrs = make_tiered_func_ptrs();
+        return ptrs;
+    }
+
+    void *vm_jit_compile_function(Program *program, uint64_t entry_index) {
+        return (void *) optimizing_jit_function(program, entry_index, get_tiered_func_ptrs());
+    }
+
+    void *vm_jit_compile_osr(Program *program, uint64_t entry_index, uint64_t loop_header_index) {
+        return (void *) optimizing_jit_osr(program, entry_index, loop_header_index, get_tiered_func_ptrs());
+    }
+
+    void vm_jit_invoke(void *entry) {
+        // r12 belongs to the caller outside of this file, and the generated code expects its own depth counter
+        auto saved_context_object = context_object;
+        auto saved_base_pointer = base_pointer;
+        auto saved_call_depth = call_depth;
+        base_pointer = vm_instance->stack_pointer;
+        call_depth = 1;
+        ((z_jit_fnc) entry)();
+        call_depth = saved_call_depth;
+        base_pointer = saved_base_pointer;
+        context_object = saved_context_object;
+    }
+
+    void vm_jit_invoke_osr(void *entry, z_value_t *context, int64_t frame_base_pointer, uint64_t frame_call_depth) {
+        auto saved_context_object = context_object;
+        auto saved_base_pointer = base_pointer;
+        auto saved_call_depth = call_depth;
+        context_object = context;
+        base_pointer = frame_base_pointer;
+        call_depth = frame_call_depth;
+        ((z_jit_fnc) entry)();
+        call_depth = saved_call_depth;
+        base_pointer = saved_base_pointer;
+        context_object = saved_context_object;
+    }
+
+    void vm_run(Program *program, JitTier tier) {
+        begin_run();
+        init_string_constants(program);
+        z_jit_fnc fnc = tier == JIT_TIER_BASELINE
+                        ? baseline_jit(program, func_ptrs)
+                        : optimizing_jit(program, func_ptrs);
         fnc();
+        object_manager_log_statistics();
     }
 }
\ No newline at end of file
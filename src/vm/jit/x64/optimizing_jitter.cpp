@@ -0,0 +1,768 @@
+#include <vm/jit.h>
+
+#define ASMJIT_STATIC
+
+#include <asmjit/asmjit.h>
+
+#include <set>
+#include <algorithm>
+
+using namespace std;
+using namespace asmjit;
+
+namespace zero {
+
+    // owned by the baseline jitter, both tiers add their code to the same runtime
+    extern JitRuntime rt;
+
+    static Logger opt_log("optimizing jit");
+
+    // slots that are written by other instructions than these cannot live in a register, because we do not know
+    // what type of value they will be holding
+#define TAG_UNKNOWN 0
+#define TAG_FROM_SOURCE 0xFF
+
+    // callee saved registers, so that they survive the handler calls and the calls into other generated functions
+    static const x86::Gp allocatable_registers[] = {x86::rbx, x86::r13, x86::r14, x86::r15};
+    static const unsigned int allocatable_register_count = 4;
+
+    typedef struct {
+        uint64_t begin;                                 // first instruction of the block
+        uint64_t end;                                   // one past the last instruction of the block
+        unsigned int loop_depth;
+    } opt_basic_block_t;
+
+    typedef struct {
+        uint64_t begin;                                 // FN_ENTER_* of the function
+        uint64_t end;                                   // one past the last instruction of the function
+        vector<opt_basic_block_t> blocks;
+        set<uint64_t> leaders;                          // instructions that start a basic block
+        map<uint64_t, uint32_t> tags;                   // slot -> VALUE_TAG_* every writer agrees on
+        map<uint64_t, int32_t> constants;               // slot -> value, for slots written once before any branch
+        map<uint64_t, x86::Gp> registers;               // slot -> register holding its payload
+        vector<x86::Gp> used_registers;
+        uint64_t label_base;                            // instruction index of the first label
+        bool tiered;                                    // function refs hold instruction indexes, not addresses
+        bool osr;                                       // entered from an interpreted frame, see below
+    } opt_function_t;
+
+    static inline uint64_t slot_offset(uint64_t slot) {
+        return slot * sizeof(z_value_t);
+    }
+
+    static inline uint64_t payload_offset(uint64_t slot) {
+        return slot * sizeof(z_value_t);
+    }
+
+    static inline uint64_t tag_offset(uint64_t slot) {
+        return slot * sizeof(z_value_t) + 4;
+    }
+
+    static bool is_writing_destination(Instruction *instruction, InstructionDescriptor &descriptor) {
+        auto opcode = instruction->opCode;
+        if (opcode == SET_CELL || opcode == SET_IN_OBJECT ||
+            opcode == CAPTURE || opcode == CAPTURE_CELL || opcode == CAPTURE_UPVALUE) {
+            // destination holds the address of what is written
+            return false;
+        }
+        // return value of a call is written into the destination by the callee
+        return descriptor.destType == INDEX || opcode == CALL;
+    }
+
+    static uint32_t produced_tag(uint64_t opcode) {
+        switch (opcode) {
+            case MOV_INT:
+            case ADD_INT:
+            case SUB_INT:
+            case MUL_INT:
+            case DIV_INT:
+            case MOD_INT:
+            case NEG_INT:
+                return VALUE_TAG_INT;
+            case MOV_BOOLEAN:
+            case CMP_EQ:
+            case CMP_NEQ:
+            case CMP_GT_INT:
+            case CMP_GT_DECIMAL:
+            case CMP_LT_INT:
+            case CMP_LT_DECIMAL:
+            case CMP_GTE_INT:
+            case CMP_GTE_DECIMAL:
+            case CMP_LTE_INT:
+            case CMP_LTE_DECIMAL:
+                return VALUE_TAG_BOOLEAN;
+            case MOV:
+                return TAG_FROM_SOURCE;
+            default:
+                return TAG_UNKNOWN;
+        }
+    }
+
+    static bool is_int_comparison(uint64_t opcode) {
+        return opcode == CMP_EQ || opcode == CMP_NEQ
+               || opcode == CMP_GT_INT || opcode == CMP_LT_INT
+               || opcode == CMP_GTE_INT || opcode == CMP_LTE_INT;
+    }
+
+    // the comparison a fused int jump does, or NO_OPCODE
+    static uint64_t int_jump_comparison(uint64_t opcode) {
+        switch (opcode) {
+            case JMP_EQ:
+                return CMP_EQ;
+            case JMP_NEQ:
+                return CMP_NEQ;
+            case JMP_GT_INT:
+                return CMP_GT_INT;
+            case JMP_LT_INT:
+                return CMP_LT_INT;
+            case JMP_GTE_INT:
+                return CMP_GTE_INT;
+            case JMP_LTE_INT:
+                return CMP_LTE_INT;
+            default:
+                return NO_OPCODE;
+        }
+    }
+
+    // opcodes that are compiled to machine code directly, everything else goes through its handler
+    static bool is_inlined(uint64_t opcode) {
+        switch (opcode) {
+            case JMP:
+            case JMP_TRUE:
+            case JMP_FALSE:
+            case MOV:
+            case MOV_INT:
+            case MOV_BOOLEAN:
+            case MOV_DECIMAL:
+            case ADD_INT:
+            case SUB_INT:
+            case MUL_INT:
+            case DIV_INT:
+            case MOD_INT:
+            case NEG_INT:
+                return true;
+            default:
+                return is_int_comparison(opcode) || int_jump_comparison(opcode) != NO_OPCODE;
+        }
+    }
+
+    static InstructionDescriptor describe(Instruction *instruction) {
+        return instructionDescriptionTable.find(instruction->opCode)->second;
+    }
+
+    static void find_basic_blocks(vector<Instruction *> &instructions, opt_function_t &f) {
+        f.leaders.insert(f.begin);
+        for (auto i = f.begin; i < f.end; i++) {
+            auto instruction = instructions[i];
+            if (describe(instruction).opcodeType == JUMP) {
+                f.leaders.insert(instruction->destination);
+                if (i + 1 < f.end) f.leaders.insert(i + 1);
+            } else if (instruction->opCode == RET && i + 1 < f.end) {
+                f.leaders.insert(i + 1);
+            }
+        }
+        for (auto it = f.leaders.begin(); it != f.leaders.end(); it++) {
+            auto next = it;
+            next++;
+            opt_basic_block_t block;
+            block.begin = *it;
+            block.end = next == f.leaders.end() ? f.end : *next;
+            block.loop_depth = 0;
+            f.blocks.push_back(block);
+        }
+        // loops are contiguous in the generated code, so a backward jump covers exactly the blocks of its loop
+        for (auto i = f.begin; i < f.end; i++) {
+            auto instruction = instructions[i];
+            if (describe(instruction).opcodeType != JUMP || instruction->destination > i) continue;
+            for (auto &block: f.blocks) {
+                if (block.begin >= instruction->destination && block.end <= i + 1) {
+                    block.loop_depth++;
+                }
+            }
+        }
+    }
+
+    static void find_slot_types(vector<Instruction *> &instructions, opt_function_t &f,
+                                set<uint64_t> &cell_slots) {
+        map<uint64_t, vector<Instruction *>> writers;
+        for (auto i = f.begin; i < f.end; i++) {
+            auto instruction = instructions[i];
+            auto descriptor = describe(instruction);
+            if (is_writing_destination(instruction, descriptor)) {
+                writers[instruction->destination].push_back(instruction);
+            }
+            if (descriptor.opcodeType == FUNCTION_ENTER) {
+                // the arguments are written by the caller, they can be anything
+                for (uint64_t slot = 1; slot <= instruction->operand2; slot++) {
+                    writers[slot].push_back(instruction);
+                }
+            }
+        }
+        // first the slots written with a known type only, then the slots that are copies of them
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto &entry: writers) {
+                auto slot = entry.first;
+                if (slot == 0 || f.tags.count(slot) || cell_slots.count(slot)) continue;
+                uint32_t tag = TAG_UNKNOWN;
+                bool consistent = true;
+                for (auto writer: entry.second) {
+                    auto writer_tag = produced_tag(writer->opCode);
+                    if (writer_tag == TAG_FROM_SOURCE) {
+                        auto source = f.tags.find(writer->operand1);
+                        writer_tag = source == f.tags.end() ? TAG_UNKNOWN : source->second;
+                    }
+                    if (writer_tag == TAG_UNKNOWN || (tag != TAG_UNKNOWN && tag != writer_tag)) {
+                        consistent = false;
+                        break;
+                    }
+                    tag = writer_tag;
+                }
+                if (consistent) {
+                    f.tags[slot] = tag;
+                    changed = true;
+                }
+            }
+        }
+        // slots written exactly once by an immediate in the entry block can be used as immediates
+        auto &entry_block = f.blocks.front();
+        for (auto i = entry_block.begin; i < entry_block.end; i++) {
+            auto instruction = instructions[i];
+            if (instruction->opCode != MOV_INT && instruction->opCode != MOV_BOOLEAN) continue;
+            auto slot = instruction->destination;
+            if (!f.tags.count(slot) || writers[slot].size() != 1) continue;
+            bool read_before = false;
+            for (auto j = f.begin; j < i; j++) {
+                auto previous = instructions[j];
+                auto descriptor = describe(previous);
+                if ((descriptor.op1Type == INDEX && previous->operand1 == slot)
+                    || (descriptor.op2Type == INDEX && previous->operand2 == slot)) {
+                    read_before = true;
+                }
+            }
+            if (!read_before) {
+                f.constants[slot] = (int32_t) instruction->operand1;
+            }
+        }
+    }
+
+    static void allocate_registers(vector<Instruction *> &instructions, opt_function_t &f) {
+        map<uint64_t, uint64_t> weights;
+        for (auto &block: f.blocks) {
+            uint64_t weight = 1;
+            for (unsigned int d = 0; d < block.loop_depth && d < 6; d++) weight *= 8;
+            for (auto i = block.begin; i < block.end; i++) {
+                auto instruction = instructions[i];
+                if (!is_inlined(instruction->opCode)) continue;
+                auto descriptor = describe(instruction);
+                if (descriptor.op1Type == INDEX) weights[instruction->operand1] += weight;
+                if (descriptor.op2Type == INDEX) weights[instruction->operand2] += weight;
+                if (descriptor.destType == INDEX) weights[instruction->destination] += weight;
+            }
+        }
+        vector<pair<uint64_t, uint64_t>> candidates;
+        for (auto &entry: weights) {
+            if (f.tags.count(entry.first) && !f.constants.count(entry.first)) {
+                candidates.push_back(make_pair(entry.second, entry.first));
+            }
+        }
+        sort(candidates.rbegin(), candidates.rend());
+        for (unsigned int i = 0; i < candidates.size() && i < allocatable_register_count; i++) {
+            auto reg = allocatable_registers[i];
+            f.registers[candidates[i].second] = reg.r32();
+            f.used_registers.push_back(reg);
+        }
+    }
+
+    static void spill(x86::Assembler &a, opt_function_t &f, uint64_t slot) {
+        auto reg = f.registers.find(slot);
+        if (reg == f.registers.end()) return;
+        a.mov(x86::dword_ptr(x86::r12, tag_offset(slot)), f.tags[slot]);
+        a.mov(x86::dword_ptr(x86::r12, payload_offset(slot)), reg->second);
+    }
+
+    static void spill_all(x86::Assembler &a, opt_function_t &f) {
+        for (auto &entry: f.registers) {
+            spill(a, f, entry.first);
+        }
+    }
+
+    static void reload(x86::Assembler &a, opt_function_t &f, uint64_t slot) {
+        auto reg = f.registers.find(slot);
+        if (reg == f.registers.end()) return;
+        a.mov(reg->second, x86::dword_ptr(x86::r12, payload_offset(slot)));
+    }
+
+    static void reload_all(x86::Assembler &a, opt_function_t &f) {
+        for (auto &entry: f.registers) {
+            reload(a, f, entry.first);
+        }
+    }
+
+    static void load_payload(x86::Assembler &a, opt_function_t &f, uint64_t slot, const x86::Gp &target) {
+        auto reg = f.registers.find(slot);
+        auto constant = f.constants.find(slot);
+        if (reg != f.registers.end()) {
+            a.mov(target, reg->second);
+        } else if (constant != f.constants.end()) {
+            a.mov(target, constant->second);
+        } else {
+            a.mov(target, x86::dword_ptr(x86::r12, payload_offset(slot)));
+        }
+    }
+
+    // returns the register the slot lives in, or loads it into the scratch register
+    static x86::Gp payload_register(x86::Assembler &a, opt_function_t &f, uint64_t slot, const x86::Gp &scratch) {
+        auto reg = f.registers.find(slot);
+        if (reg != f.registers.end()) {
+            return reg->second;
+        }
+        load_payload(a, f, slot, scratch);
+        return scratch;
+    }
+
+    static void store_payload(x86::Assembler &a, opt_function_t &f, uint64_t slot, const x86::Gp &source,
+                              uint32_t tag) {
+        auto reg = f.registers.find(slot);
+        if (reg != f.registers.end()) {
+            if (reg->second != source) a.mov(reg->second, source);
+        } else {
+            a.mov(x86::dword_ptr(x86::r12, tag_offset(slot)), tag);
+            a.mov(x86::dword_ptr(x86::r12, payload_offset(slot)), source);
+        }
+    }
+
+    // sets the flags for the comparison. equality compares the whole values, unless both sides are known to be
+    // ints or both booleans, then the payloads are enough
+    static void compile_comparison(x86::Assembler &a, opt_function_t &f, Instruction *instruction) {
+        auto op1 = instruction->operand1;
+        auto op2 = instruction->operand2;
+        auto opcode = instruction->opCode;
+        if (opcode == CMP_EQ || opcode == CMP_NEQ || opcode == JMP_EQ || opcode == JMP_NEQ) {
+            auto tag1 = f.tags.find(op1);
+            auto tag2 = f.tags.find(op2);
+            if (tag1 == f.tags.end() || tag2 == f.tags.end() || tag1->second != tag2->second) {
+                spill(a, f, op1);
+                spill(a, f, op2);
+                a.mov(x86::rax, x86::qword_ptr(x86::r12, slot_offset(op1)));
+                a.cmp(x86::rax, x86::qword_ptr(x86::r12, slot_offset(op2)));
+                return;
+            }
+        }
+        load_payload(a, f, op1, x86::eax);
+        a.cmp(x86::eax, payload_register(a, f, op2, x86::ecx));
+    }
+
+    static void compile_setcc(x86::Assembler &a, uint64_t opcode) {
+        switch (opcode) {
+            case CMP_EQ:
+                a.sete(x86::al);
+                break;
+            case CMP_NEQ:
+                a.setne(x86::al);
+                break;
+            case CMP_GT_INT:
+                a.setg(x86::al);
+                break;
+            case CMP_LT_INT:
+                a.setl(x86::al);
+                break;
+            case CMP_GTE_INT:
+                a.setge(x86::al);
+                break;
+            default:
+                a.setle(x86::al);
+                break;
+        }
+    }
+
+    static void compile_jcc(x86::Assembler &a, uint64_t opcode, bool negate, const Label &target) {
+        if (negate) {
+            switch (opcode) {
+                case CMP_EQ:
+                    opcode = CMP_NEQ;
+                    break;
+                case CMP_NEQ:
+                    opcode = CMP_EQ;
+                    break;
+                case CMP_GT_INT:
+                    opcode = CMP_LTE_INT;
+                    break;
+                case CMP_LT_INT:
+                    opcode = CMP_GTE_INT;
+                    break;
+                case CMP_GTE_INT:
+                    opcode = CMP_LT_INT;
+                    break;
+                default:
+                    opcode = CMP_GT_INT;
+                    break;
+            }
+        }
+        switch (opcode) {
+            case CMP_EQ:
+                a.je(target);
+                break;
+            case CMP_NEQ:
+                a.jne(target);
+                break;
+            case CMP_GT_INT:
+                a.jg(target);
+                break;
+            case CMP_LT_INT:
+                a.jl(target);
+                break;
+            case CMP_GTE_INT:
+                a.jge(target);
+                break;
+            default:
+                a.jle(target);
+                break;
+        }
+    }
+
+    static void compile_arithmetic(x86::Assembler &a, opt_function_t &f, Instruction *instruction) {
+        auto op1 = instruction->operand1;
+        auto op2 = instruction->operand2;
+        auto dest = instruction->destination;
+        if (instruction->opCode == NEG_INT) {
+            load_payload(a, f, op1, x86::eax);
+            a.neg(x86::eax);
+            store_payload(a, f, dest, x86::eax, VALUE_TAG_INT);
+            return;
+        }
+        load_payload(a, f, op1, x86::eax);
+        auto rhs = payload_register(a, f, op2, x86::ecx);
+        switch (instruction->opCode) {
+            case ADD_INT:
+                a.add(x86::eax, rhs);
+                break;
+            case SUB_INT:
+                a.sub(x86::eax, rhs);
+                break;
+            case MUL_INT:
+                a.imul(x86::eax, rhs);
+                break;
+            default:
+                a.cdq();
+                a.idiv(rhs);
+                if (instruction->opCode == MOD_INT) a.mov(x86::eax, x86::edx);
+                break;
+        }
+        store_payload(a, f, dest, x86::eax, VALUE_TAG_INT);
+    }
+
+    static void compile_mov(x86::Assembler &a, opt_function_t &f, Instruction *instruction) {
+        auto source = instruction->operand1;
+        auto dest = instruction->destination;
+        auto dest_reg = f.registers.find(dest);
+        if (dest_reg != f.registers.end()) {
+            load_payload(a, f, source, dest_reg->second);
+        } else if (f.registers.count(source) || f.constants.count(source)) {
+            // the source is not in the memory, it has to be tagged while storing
+            store_payload(a, f, dest, payload_register(a, f, source, x86::eax), f.tags[source]);
+        } else {
+            a.mov(x86::rdx, x86::ptr(x86::r12, slot_offset(source), 8));
+            a.mov(x86::ptr(x86::r12, slot_offset(dest), 8), x86::rdx);
+        }
+    }
+
+    static void compile_conditional_jump(x86::Assembler &a, opt_function_t &f, Instruction *instruction,
+                                         const Label &target) {
+        auto slot = instruction->operand1;
+        auto reg = f.registers.find(slot);
+        auto constant = f.constants.find(slot);
+        if (constant != f.constants.end()) {
+            if ((constant->second != 0) == (instruction->opCode == JMP_TRUE)) a.jmp(target);
+            return;
+        }
+        if (reg != f.registers.end()) {
+            a.test(reg->second, reg->second);
+        } else {
+            a.cmp(x86::dword_ptr(x86::r12, payload_offset(slot)), 0);
+        }
+        if (instruction->opCode == JMP_TRUE)
+            a.jne(target);
+        else
+            a.je(target);
+    }
+
+    static void compile_prologue(x86::Assembler &a, opt_function_t &f) {
+        a.push(x86::rbp);
+        a.mov(x86::rbp, x86::rsp);
+        for (auto &reg: f.used_registers) {
+            a.push(reg.r64());
+        }
+        // keep the stack 16 bytes aligned for the handler calls
+        a.sub(x86::rsp, sizeof(uint64_t) * (4 + f.used_registers.size() % 2));
+    }
+
+    static void compile_epilogue(x86::Assembler &a, opt_function_t &f) {
+        a.add(x86::rsp, sizeof(uint64_t) * (4 + f.used_registers.size() % 2));
+        for (auto it = f.used_registers.rbegin(); it != f.used_registers.rend(); it++) {
+            a.pop(it->r64());
+        }
+        a.pop(x86::rbp);
+        a.ret();
+    }
+
+    static void compile_handler_call(x86::Assembler &a, opt_function_t &f, Instruction *instruction,
+                                     vector<Label> &labels, z_opcode_handler **handlers) {
+#ifdef linux
+        auto op1_reg = x86::rdi;
+        auto op2_reg = x86::rsi;
+        auto dest_reg = x86::rdx;
+#else
+        auto op1_reg = x86::rcx;
+        auto op2_reg = x86::rdx;
+        auto dest_reg = x86::r8;
+#endif
+        auto opcode = instruction->opCode;
+        auto descriptor = describe(instruction);
+
+        // the handler works on the memory, so the register copies of its operands must be written back first.
+        // callees may read any slot
+        if (opcode == CALL || opcode == RET) {
+            spill_all(a, f);
+        } else {
+            if (descriptor.op1Type == INDEX) spill(a, f, instruction->operand1);
+            if (descriptor.op2Type == INDEX) spill(a, f, instruction->operand2);
+        }
+        if (opcode == CONCAT_N || opcode == CALL_NATIVE) {
+            // op1 is followed by more operands, op2 of them for CONCAT_N and op2 arguments for CALL_NATIVE
+            auto last = instruction->operand1 + instruction->operand2 - (opcode == CONCAT_N ? 1 : 0);
+            for (auto slot = instruction->operand1 + 1; slot <= last; slot++) {
+                spill(a, f, slot);
+            }
+        }
+
+        auto op1 = instruction->operand1;
+        auto op2 = instruction->operand2;
+        auto destination = instruction->destination;
+        if (descriptor.destType == INDEX) destination = slot_offset(destination);
+        if (descriptor.op1Type == INDEX) op1 = slot_offset(op1);
+        if (descriptor.op2Type == INDEX) op2 = slot_offset(op2);
+
+        if (descriptor.op1Type == IMM_ADDRESS && !f.tiered) {
+            a.lea(op1_reg, x86::ptr(labels.at(instruction->operand1 - f.label_base)));
+        } else if (descriptor.op1Type != UNUSED) {
+            a.mov(op1_reg, op1);
+        }
+        if (descriptor.op2Type != UNUSED) {
+            a.mov(op2_reg, op2);
+        }
+        if (descriptor.destType != UNUSED) {
+            a.mov(dest_reg, destination);
+        }
+        a.call((uintptr_t) handlers[opcode - 2]);
+
+        if (descriptor.opcodeType == JUMP) {
+            a.cmp(x86::rax, 0);
+            a.jne(labels[instruction->destination - f.label_base]);
+        } else if (opcode == CALL) {
+            a.call(x86::rax);
+        } else if (opcode == RET) {
+            compile_epilogue(a, f);
+            return;
+        } else if (descriptor.opcodeType == FUNCTION_ENTER) {
+            reload_all(a, f);
+            return;
+        }
+        if (is_writing_destination(instruction, descriptor)) {
+            reload(a, f, instruction->destination);
+        }
+    }
+
+    static void compile_function(vector<Instruction *> &instructions, opt_function_t &f, vector<Label> &labels,
+                                 x86::Assembler &a, z_opcode_handler **handlers) {
+        for (auto i = f.begin; i < f.end; i++) {
+            auto instruction = instructions[i];
+            auto opcode = instruction->opCode;
+            a.bind(labels[i - f.label_base]);
+
+            if (i == f.begin) {
+                compile_prologue(a, f);
+            }
+
+            if (!is_inlined(opcode)) {
+                compile_handler_call(a, f, instruction, labels, handlers);
+                continue;
+            }
+
+            switch (opcode) {
+                case JMP:
+                    a.jmp(labels[instruction->destination - f.label_base]);
+                    break;
+                case JMP_TRUE:
+                case JMP_FALSE:
+                    compile_conditional_jump(a, f, instruction, labels[instruction->destination - f.label_base]);
+                    break;
+                case MOV:
+                    compile_mov(a, f, instruction);
+                    break;
+                case MOV_INT:
+                case MOV_BOOLEAN:
+                    if (f.registers.count(instruction->destination)) {
+                        a.mov(f.registers[instruction->destination], (int32_t) instruction->operand1);
+                    } else {
+                        a.mov(x86::dword_ptr(x86::r12, tag_offset(instruction->destination)),
+                              opcode == MOV_INT ? VALUE_TAG_INT : VALUE_TAG_BOOLEAN);
+                        a.mov(x86::dword_ptr(x86::r12, payload_offset(instruction->destination)),
+                              (int32_t) instruction->operand1);
+                    }
+                    break;
+                case MOV_DECIMAL:
+                    a.mov(x86::rax, jit_encode_decimal(instruction->operand1));
+                    a.mov(x86::qword_ptr(x86::r12, slot_offset(instruction->destination)), x86::rax);
+                    break;
+                case ADD_INT:
+                case SUB_INT:
+                case MUL_INT:
+                case DIV_INT:
+                case MOD_INT:
+                case NEG_INT:
+                    compile_arithmetic(a, f, instruction);
+                    break;
+                case JMP_EQ:
+                case JMP_NEQ:
+                case JMP_GT_INT:
+                case JMP_LT_INT:
+                case JMP_GTE_INT:
+                case JMP_LTE_INT:
+                    compile_comparison(a, f, instruction);
+                    compile_jcc(a, int_jump_comparison(opcode), false, labels[instruction->destination - f.label_base]);
+                    break;
+                default: {
+                    // int comparison
+                    compile_comparison(a, f, instruction);
+                    compile_setcc(a, opcode);
+                    a.movzx(x86::eax, x86::al);
+                    store_payload(a, f, instruction->destination, x86::eax, VALUE_TAG_BOOLEAN);
+                    // neither setcc nor mov touch the flags, a conditional jump on the result can use them directly
+                    if (i + 1 < f.end && !f.leaders.count(i + 1)) {
+                        auto next = instructions[i + 1];
+                        if ((next->opCode == JMP_TRUE || next->opCode == JMP_FALSE)
+                            && next->operand1 == instruction->destination) {
+                            i++;
+                            a.bind(labels[i - f.label_base]);
+                            compile_jcc(a, opcode, next->opCode == JMP_FALSE,
+                                        labels[next->destination - f.label_base]);
+                        }
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    // a child function can overwrite these slots of its parent through the captured address, with any type
+    static set<uint64_t> find_cell_slots(vector<Instruction *> &instructions) {
+        set<uint64_t> slots;
+        for (auto instruction: instructions) {
+            if (instruction->opCode == CAPTURE_CELL) {
+                slots.insert(instruction->operand2);
+            }
+        }
+        return slots;
+    }
+
+    // every function is a contiguous range that starts with its FN_ENTER_*
+    static uint64_t find_function_end(vector<Instruction *> &instructions, uint64_t begin) {
+        auto end = begin + 1;
+        while (end < instructions.size() && describe(instructions[end]).opcodeType != FUNCTION_ENTER) end++;
+        return end;
+    }
+
+    static void analyze_function(vector<Instruction *> &instructions, opt_function_t &f,
+                                 set<uint64_t> &cell_slots) {
+        find_basic_blocks(instructions, f);
+        find_slot_types(instructions, f, cell_slots);
+        allocate_registers(instructions, f);
+        opt_log.debug("function at %d: %d blocks, %d slots in registers, %d constant slots",
+                      (int) f.begin, (int) f.blocks.size(), (int) f.registers.size(), (int) f.constants.size());
+    }
+
+    static z_jit_fnc add_to_runtime(CodeHolder &code) {
+        z_jit_fnc fn;
+        Error err = rt.add(&fn, &code);
+        if (err) {
+            opt_log.error("could not add the generated code to the runtime");
+            exit(1);
+        }
+        return fn;
+    }
+
+    z_jit_fnc optimizing_jit(Program *program, z_opcode_handler **handlers) {
+        CodeHolder code;
+        code.init(rt.environment());
+        x86::Assembler a(&code);
+
+        auto instructions = program->getInstructions();
+        uint64_t count = instructions.size();
+
+        vector<Label> labels;
+        for (int i = 0; i < count; i++) {
+            labels.push_back(a.newLabel());
+        }
+
+        auto cell_slots = find_cell_slots(instructions);
+        uint64_t begin = 0;
+        while (begin < count) {
+            opt_function_t f;
+            f.begin = begin;
+            f.end = find_function_end(instructions, begin);
+            f.label_base = 0;
+            f.tiered = false;
+            f.osr = false;
+            analyze_function(instructions, f, cell_slots);
+            compile_function(instructions, f, labels, a, handlers);
+            begin = f.end;
+        }
+        return add_to_runtime(code);
+    }
+
+    static z_jit_fnc compile_single_function(Program *program, uint64_t entry_index, int64_t osr_entry_index,
+                                             z_opcode_handler **handlers) {
+        CodeHolder code;
+        code.init(rt.environment());
+        x86::Assembler a(&code);
+
+        auto instructions = program->getInstructions();
+        auto cell_slots = find_cell_slots(instructions);
+
+        opt_function_t f;
+        f.begin = entry_index;
+        f.end = find_function_end(instructions, entry_index);
+        f.label_base = entry_index;
+        f.tiered = true;
+        f.osr = osr_entry_index >= 0;
+
+        vector<Label> labels;
+        for (auto i = f.begin; i < f.end; i++) {
+            labels.push_back(a.newLabel());
+        }
+
+        analyze_function(instructions, f, cell_slots);
+        if (f.osr) {
+            // the code starts in the middle of the function: the interpreter has already set up the context,
+            // so only the native frame is built and the register slots are loaded before jumping to the loop
+            compile_prologue(a, f);
+            reload_all(a, f);
+            a.jmp(labels[osr_entry_index - f.label_base]);
+        }
+        compile_function(instructions, f, labels, a, handlers);
+        return add_to_runtime(code);
+    }
+
+    z_jit_fnc optimizing_jit_function(Program *program, uint64_t entry_index, z_opcode_handler **handlers) {
+        return compile_single_function(program, entry_index, -1, handlers);
+    }
+
+    z_jit_fnc optimizing_jit_osr(Program *program, uint64_t entry_index, uint64_t loop_header_index,
+                                 z_opcode_handler **handlers) {
+        opt_log.debug("on stack replacement of function at %d, loop at %d", (int) entry_index,
+                      (int) loop_header_index);
+        return compile_single_function(program, entry_index, loop_header_index, handlers);
+    }
+}
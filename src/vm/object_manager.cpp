@@ -1,6 +1,9 @@
 #include <vm/object_manager.h>
 
-#include <map>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <new>
 
 using namespace std;
 
@@ -8,36 +11,612 @@ namespace zero {
 
     Logger object_man_log("object_manager");
 
-    map<uintptr_t, z_object_type_info> type_knowledge_map;
+    static const uint64_t GC_INITIAL_THRESHOLD = 1 << 20; // bytes
+    static const uint64_t NURSERY_SIZE = 1 << 19; // bytes
+    static const uint32_t CONTEXTS_PER_SLAB = 32;
+    static const uint64_t ROPE_MIN_LENGTH = 64; // shorter concatenations are copied right away
 
-    z_fnc_ref_t *object_manager_create_fn_ref(uint64_t instruction_index, z_value_t *context_object) {
-        auto fun_ref = (z_fnc_ref_t *) malloc(sizeof(z_fnc_ref_t));
+    static z_object_header_t *allocate_old(z_object_type_info type, size_t size) {
+        auto heap = vm_instance->heap;
+        heap->bytes_since_collection += sizeof(z_object_header_t) + size;
+        // malloc is at least 8 byte aligned and so is the header, so the object stays distinguishable from primitives
+        auto header = (z_object_header_t *) malloc(sizeof(z_object_header_t) + size);
+        if (header == nullptr) {
+            return nullptr;
+        }
+        header->type = (uint16_t) type;
+        header->flags = 0;
+        header->size = 0;
+        header->next = heap->all_objects;
+        heap->all_objects = header;
+        heap->object_count++;
+        return header;
+    }
+
+    static size_t fn_ref_size(uint32_t capture_count) {
+        return sizeof(z_fnc_ref_t) + capture_count * sizeof(z_value_t);
+    }
+
+    static size_t young_object_size(z_object_header_t *header) {
+        size_t size;
+        switch (header->type) {
+            case VM_VALUE_TYPE_STRING:
+                size = sizeof(string);
+                break;
+            case VM_VALUE_TYPE_ROPE:
+                size = sizeof(z_rope_t);
+                break;
+            default:
+                size = fn_ref_size(header->size);
+                break;
+        }
+        return sizeof(z_object_header_t) + ((size + 7) & ~7);
+    }
+
+    // the references in an object that may point to the nursery
+    static z_value_t *young_slots_of(z_object_header_t *header) {
+        if (header->type == VM_VALUE_TYPE_FUNCTION_REF) {
+            return object_manager_captures_of((z_fnc_ref_t *) (header + 1));
+        }
+        return (z_value_t *) (header + 1);
+    }
+
+    static void *allocate_young(z_object_type_info type, size_t size, z_value_t *context_object) {
+        auto heap = vm_instance->heap;
+        size_t total = sizeof(z_object_header_t) + ((size + 7) & ~7);
+        if (heap->nursery_top + total > heap->nursery_end) {
+            if (heap->nursery_start == 0) {
+                heap->nursery_start = (uintptr_t) malloc(NURSERY_SIZE);
+                heap->nursery_object_starts = (uint64_t *) calloc(NURSERY_SIZE / sizeof(uint64_t) / 64,
+                                                                  sizeof(uint64_t));
+                if (heap->nursery_start == 0 || heap->nursery_object_starts == nullptr) {
+                    return nullptr;
+                }
+                heap->nursery_top = heap->nursery_start;
+                heap->nursery_end = heap->nursery_start + NURSERY_SIZE;
+            } else {
+                object_manager_collect_young(context_object);
+                if (heap->bytes_since_collection > heap->collection_threshold) {
+                    object_manager_collect_garbage(context_object);
+                }
+            }
+        }
+        auto header = (z_object_header_t *) heap->nursery_top;
+        heap->nursery_top += total;
+        header->type = (uint16_t) type;
+        header->flags = 0;
+        header->size = 0;
+        header->next = nullptr;
+        uint64_t word = ((uintptr_t) (header + 1) - heap->nursery_start) / sizeof(uint64_t);
+        heap->nursery_object_starts[word / 64] |= 1ull << (word % 64);
+        return header + 1;
+    }
+
+    // stale stack words and uninitialized slots may point anywhere in the nursery
+    static bool is_young_object(z_value_t value) {
+        auto heap = vm_instance->heap;
+        if (!object_manager_is_young(value) || value.uint_value >= heap->nursery_top) {
+            return false;
+        }
+        uint64_t word = (value.uint_value - heap->nursery_start) / sizeof(uint64_t);
+        return (heap->nursery_object_starts[word / 64] >> (word % 64)) & 1;
+    }
+
+    // the captures are filled by the CAPTURE_* instructions that follow MOV_FNC
+    z_fnc_ref_t *object_manager_create_fn_ref(uint64_t instruction_index, uint32_t capture_count,
+                                              z_value_t *context_object) {
+        auto fun_ref = (z_fnc_ref_t *) allocate_young(VM_VALUE_TYPE_FUNCTION_REF, fn_ref_size(capture_count),
+                                                      context_object);
         if (fun_ref == nullptr) {
             object_man_log.error("could not allocate memory for a function reference");
             exit(1);
         }
-        fun_ref->parent_context_ptr = context_object;
+        object_manager_header_of(fun_ref)->size = capture_count;
         fun_ref->instruction_index = instruction_index;
-
-        type_knowledge_map[(uintptr_t) fun_ref] = VM_VALUE_TYPE_FUNCTION_REF;
+        auto captures = object_manager_captures_of(fun_ref);
+        for (uint32_t i = 0; i < capture_count; i++) {
+            captures[i].uint_value = (uint64_t) VALUE_TAG_NULL << 32;
+        }
         return fun_ref;
     }
 
-    void object_manager_register_string(z_value_t value) {
-        type_knowledge_map[(uintptr_t) value.uint_value] = VM_VALUE_TYPE_STRING;
+    string *object_manager_create_string(string value, z_value_t *context_object) {
+        void *memory = allocate_young(VM_VALUE_TYPE_STRING, sizeof(string), context_object);
+        if (memory == nullptr) {
+            object_man_log.error("could not allocate memory for a string");
+            exit(1);
+        }
+        return new(memory) string(std::move(value));
+    }
+
+    static bool is_rope(z_value_t value) {
+        return object_manager_header_of(value.ptr_value)->type == VM_VALUE_TYPE_ROPE;
+    }
+
+    static uint64_t string_length(z_value_t value) {
+        return is_rope(value) ? ((z_rope_t *) value.ptr_value)->length : value.string_value->size();
+    }
+
+    z_value_t object_manager_concat(z_value_t *left, z_value_t *right, z_value_t *context_object) {
+        z_value_t result;
+        uint64_t length = string_length(*left) + string_length(*right);
+        if (length < ROPE_MIN_LENGTH) {
+            // no rope is that short, so both are flat
+            result.string_value = object_manager_create_string(*left->string_value + *right->string_value,
+                                                               context_object);
+            return result;
+        }
+        auto rope = (z_rope_t *) allocate_young(VM_VALUE_TYPE_ROPE, sizeof(z_rope_t), context_object);
+        if (rope == nullptr) {
+            object_man_log.error("could not allocate memory for a rope");
+            exit(1);
+        }
+        object_manager_header_of(rope)->size = 2;
+        rope->left = *left;
+        rope->right = *right;
+        rope->length = length;
+        result.ptr_value = rope;
+        return result;
+    }
+
+    z_value_t object_manager_concat_n(z_value_t *values, uint64_t count, z_value_t *context_object) {
+        // a long first piece is usually the string being built, as in s = s + ... in a loop. it is linked, not copied
+        uint64_t first = string_length(values[0]) >= ROPE_MIN_LENGTH ? 1 : 0;
+        uint64_t length = 0;
+        for (uint64_t i = first; i < count; i++) {
+            length += object_manager_flatten(&values[i], context_object)->size();
+        }
+        // no allocations from here on, the flattened ropes are only read
+        string joined;
+        joined.reserve(length);
+        for (uint64_t i = first; i < count; i++) {
+            joined += *object_manager_flatten(&values[i], context_object);
+        }
+        z_value_t result;
+        result.string_value = object_manager_create_string(std::move(joined), context_object);
+        if (first == 0) {
+            return result;
+        }
+        // the rest takes the place of the second piece, to stay in the roots while the rope is allocated
+        values[1] = result;
+        return object_manager_concat(&values[0], &values[1], context_object);
+    }
+
+    string *object_manager_flatten(z_value_t *value, z_value_t *context_object) {
+        if (!is_rope(*value)) {
+            return value->string_value;
+        }
+        auto rope = (z_rope_t *) value->ptr_value;
+        if (object_manager_is_null(rope->right)) {
+            return rope->left.string_value; // flattened before
+        }
+        string flat;
+        flat.reserve(rope->length);
+        // left to right, without recursion. ropes built in a loop are as deep as the loop is long
+        vector<z_value_t> pieces = {rope->right, rope->left};
+        while (!pieces.empty()) {
+            z_value_t piece = pieces.back();
+            pieces.pop_back();
+            if (is_rope(piece)) {
+                auto node = (z_rope_t *) piece.ptr_value;
+                if (!object_manager_is_null(node->right)) {
+                    pieces.push_back(node->right);
+                }
+                pieces.push_back(node->left);
+            } else {
+                flat += *piece.string_value;
+            }
+        }
+        string *result = object_manager_create_string(std::move(flat), context_object);
+        // the collection may have moved the rope
+        rope = (z_rope_t *) value->ptr_value;
+        rope->left.string_value = result;
+        rope->right.uint_value = (uint64_t) VALUE_TAG_NULL << 32;
+        object_manager_write_barrier(&rope->left, rope->left);
+        return result;
+    }
+
+    string *object_manager_create_constant_string(const string &value) {
+        auto header = (z_object_header_t *) malloc(sizeof(z_object_header_t) + sizeof(string));
+        if (header == nullptr) {
+            object_man_log.error("could not allocate memory for a string constant");
+            exit(1);
+        }
+        header->type = VM_VALUE_TYPE_STRING;
+        header->flags = 0;
+        header->size = 0;
+        header->next = nullptr;
+        return new(header + 1) string(value);
+    }
+
+    void object_manager_free_constant_string(string *value) {
+        value->~string();
+        free(object_manager_header_of(value));
+    }
+
+    static void refill_context_pool(uint32_t size) {
+        auto heap = vm_instance->heap;
+        size_t object_size = sizeof(z_object_header_t) + size * sizeof(z_value_t);
+        auto slab = (uint8_t *) malloc(object_size * CONTEXTS_PER_SLAB);
+        if (slab == nullptr) {
+            return;
+        }
+        for (uint32_t i = 0; i < CONTEXTS_PER_SLAB; i++) {
+            auto header = (z_object_header_t *) (slab + i * object_size);
+            header->next = heap->context_free_lists[size];
+            heap->context_free_lists[size] = header;
+        }
+        heap->context_slabs.push_back(slab);
+        heap->context_slab_refills++;
+    }
+
+    static void release_context(z_object_header_t *header) {
+        auto heap = vm_instance->heap;
+        if (header->size > MAX_POOLED_CONTEXT_SIZE) {
+            free(header);
+            return;
+        }
+        header->next = heap->context_free_lists[header->size];
+        heap->context_free_lists[header->size] = header;
+    }
+
+    /**
+     * contexts come from the pool and are never known to the collector, the only references to them are the frames
+     * of their functions. the variables that the closures keep alive are moved to boxes instead
+     */
+    z_value_t *object_manager_create_context(unsigned int size, z_value_t *context_object) {
+        auto heap = vm_instance->heap;
+        if (heap->bytes_since_collection > heap->collection_threshold) {
+            object_manager_collect_garbage(context_object);
+        }
+        heap->context_allocations++;
+        z_object_header_t *header;
+        if (size > MAX_POOLED_CONTEXT_SIZE) {
+            header = (z_object_header_t *) malloc(sizeof(z_object_header_t) + size * sizeof(z_value_t));
+        } else {
+            if (heap->context_free_lists[size] != nullptr) {
+                heap->context_pool_hits++;
+            } else {
+                refill_context_pool(size);
+            }
+            header = heap->context_free_lists[size];
+            if (header != nullptr) {
+                heap->context_free_lists[size] = header->next;
+            }
+        }
+        if (header == nullptr) {
+            object_man_log.error("could not allocate %d size frame!", size);
+            exit(1);
+        }
+        header->type = VM_VALUE_TYPE_CONTEXT;
+        header->flags = 0;
+        header->size = size;
+        header->next = nullptr;
+        return (z_value_t *) (header + 1);
+    }
+
+    z_value_t *object_manager_create_box(z_value_t *context_object) {
+        auto heap = vm_instance->heap;
+        if (heap->bytes_since_collection > heap->collection_threshold) {
+            object_manager_collect_garbage(context_object);
+        }
+        z_object_header_t *header = allocate_old(VM_VALUE_TYPE_BOX, sizeof(z_value_t));
+        if (header == nullptr) {
+            object_man_log.error("could not allocate memory for a box");
+            exit(1);
+        }
+        header->size = 1;
+        auto box = (z_value_t *) (header + 1);
+        box->uint_value = (uint64_t) VALUE_TAG_NULL << 32;
+        return box;
+    }
+
+    void object_manager_enter_context(z_value_t *context_object) {
+        auto heap = vm_instance->heap;
+        heap->active_contexts.push_back(context_object);
+    }
+
+    void object_manager_leave_context(z_value_t *context_object) {
+        auto heap = vm_instance->heap;
+        if (heap->active_contexts.empty() || heap->active_contexts.back() != context_object) {
+            return; // stack allocated
+        }
+        heap->active_contexts.pop_back();
+        release_context(object_manager_header_of(context_object));
+        heap->contexts_released_on_return++;
+    }
+
+    void object_manager_remember(z_value_t *cell) {
+        auto heap = vm_instance->heap;
+        if (cell >= vm_instance->value_stack && cell < vm_instance->value_stack + STACK_MAX) {
+            return; // the value stack is always scanned
+        }
+        if ((uintptr_t) cell >= heap->nursery_start && (uintptr_t) cell < heap->nursery_end) {
+            return; // a young rope, it is copied with its references
+        }
+        z_object_header_t *header = object_manager_header_of(cell);
+        if (!(header->flags & OBJECT_FLAG_REMEMBERED)) {
+            header->flags |= OBJECT_FLAG_REMEMBERED;
+            heap->remembered_objects.push_back(cell);
+        }
+    }
+
+    // moves a young object to the old space, once
+    static void evacuate(z_value_t &slot) {
+        auto heap = vm_instance->heap;
+        z_object_header_t *header = object_manager_header_of(slot.ptr_value);
+        if (!(header->flags & OBJECT_FLAG_FORWARDED)) {
+            z_object_header_t *copy;
+            if (header->type == VM_VALUE_TYPE_STRING) {
+                auto young_string = (string *) (header + 1);
+                copy = allocate_old(VM_VALUE_TYPE_STRING, sizeof(string));
+                heap->bytes_since_collection += young_string->capacity();
+                if (copy != nullptr) {
+                    new(copy + 1) string(std::move(*young_string));
+                }
+            } else {
+                size_t size = young_object_size(header) - sizeof(z_object_header_t);
+                copy = allocate_old(header->type, size);
+                if (copy != nullptr) {
+                    memcpy(copy + 1, header + 1, size);
+                    copy->size = header->size;
+                    heap->promoted_objects.push_back(copy);
+                }
+            }
+            if (copy == nullptr) {
+                object_man_log.error("could not promote a young object");
+                exit(1);
+            }
+            header->flags |= OBJECT_FLAG_FORWARDED;
+            header->next = copy;
+        }
+        slot.ptr_value = header->next + 1;
+    }
+
+    static void evacuate_slots(z_value_t *values, uint64_t count) {
+        for (uint64_t i = 0; i < count; i++) {
+            if (is_young_object(values[i])) {
+                evacuate(values[i]);
+            }
+        }
+    }
+
+    static void evacuate_object(z_value_t *object) {
+        evacuate_slots(object, object_manager_header_of(object)->size);
+    }
+
+    /**
+     * copies the young objects that are referenced from the roots, then the ones that the captures of the copied
+     * function references and the pieces of the copied ropes point to. strings are leaves, and captures are never
+     * written after the creation, so the old space can only point to the nursery through the roots.
+     * the roots are the value stack, the active contexts, the boxes and ropes written by the write barrier, and the
+     * objects the host holds
+     */
+    void object_manager_collect_young(z_value_t *context_object) {
+        auto heap = vm_instance->heap;
+        if (heap->nursery_top == heap->nursery_start) {
+            return;
+        }
+        uint64_t promoted_before = heap->object_count;
+        evacuate_slots(vm_instance->value_stack, (uint64_t) vm_instance->stack_pointer);
+        evacuate_slots(vm_instance->handles.data(), vm_instance->handles.size());
+        for (auto active : heap->active_contexts) {
+            evacuate_object(active);
+        }
+        for (auto remembered : heap->remembered_objects) {
+            evacuate_object(remembered);
+            object_manager_header_of(remembered)->flags &= ~OBJECT_FLAG_REMEMBERED;
+        }
+        heap->remembered_objects.clear();
+        while (!heap->promoted_objects.empty()) {
+            z_object_header_t *header = heap->promoted_objects.back();
+            heap->promoted_objects.pop_back();
+            evacuate_slots(young_slots_of(header), header->size);
+        }
+
+        // string buffers live outside of the nursery, the copies took over the buffers of the survivors
+        for (uintptr_t object = heap->nursery_start; object < heap->nursery_top;) {
+            auto header = (z_object_header_t *) object;
+            if (header->type == VM_VALUE_TYPE_STRING) {
+                ((string *) (header + 1))->~string();
+            }
+            object += young_object_size(header);
+        }
+        uint64_t used_words = (heap->nursery_top - heap->nursery_start) / sizeof(uint64_t);
+        memset(heap->nursery_object_starts, 0, (used_words + 63) / 64 * sizeof(uint64_t));
+        heap->nursery_top = heap->nursery_start;
+        object_man_log.debug("minor collection promoted %d objects", (int) (heap->object_count - promoted_before));
+    }
+
+    /**
+     * the value stack also holds untagged words like saved base pointers and argument counts,
+     * so a word is only taken as a reference if it is the address of a live object
+     */
+    static z_object_header_t *find_object(const vector<uintptr_t> &addresses, uint64_t word) {
+        if ((word & 7) != 0) return nullptr;
+        if (!binary_search(addresses.begin(), addresses.end(), (uintptr_t) word)) return nullptr;
+        return object_manager_header_of((void *) word);
+    }
+
+    static void mark(const vector<uintptr_t> &addresses, vector<z_object_header_t *> &gray, uint64_t word) {
+        z_object_header_t *header = find_object(addresses, word);
+        if (header != nullptr && !(header->flags & OBJECT_FLAG_MARKED)) {
+            header->flags |= OBJECT_FLAG_MARKED;
+            gray.push_back(header);
+        }
+    }
+
+    static void trace(const vector<uintptr_t> &addresses, vector<z_object_header_t *> &gray) {
+        while (!gray.empty()) {
+            z_object_header_t *header = gray.back();
+            gray.pop_back();
+            switch (header->type) {
+                case VM_VALUE_TYPE_BOX:
+                case VM_VALUE_TYPE_ROPE: {
+                    auto slots = (z_value_t *) (header + 1);
+                    for (uint32_t i = 0; i < header->size; i++) {
+                        mark(addresses, gray, slots[i].uint_value);
+                    }
+                    break;
+                }
+                case VM_VALUE_TYPE_FUNCTION_REF: {
+                    // the cells on the stack are not in the address list, so they are skipped
+                    auto captures = object_manager_captures_of((z_fnc_ref_t *) (header + 1));
+                    for (uint32_t i = 0; i < header->size; i++) {
+                        mark(addresses, gray, captures[i].uint_value);
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    }
+
+    static void free_object(z_object_header_t *header) {
+        if (header->type == VM_VALUE_TYPE_STRING) {
+            ((string *) (header + 1))->~string();
+        }
+        free(header);
+    }
+
+    // what the object took when it was allocated, strings with what they hold
+    static uint64_t old_object_size(z_object_header_t *header) {
+        if (header->type == VM_VALUE_TYPE_STRING) {
+            return sizeof(z_object_header_t) + sizeof(string) + ((string *) (header + 1))->capacity();
+        }
+        return sizeof(z_object_header_t) + header->size * sizeof(z_value_t);
+    }
+
+    static uint64_t sweep() {
+        auto heap = vm_instance->heap;
+        uint64_t live_bytes = 0;
+        z_object_header_t **link = &heap->all_objects;
+        while (*link != nullptr) {
+            z_object_header_t *header = *link;
+            if (header->flags & OBJECT_FLAG_MARKED) {
+                header->flags &= ~OBJECT_FLAG_MARKED;
+                live_bytes += old_object_size(header);
+                link = &header->next;
+            } else {
+                *link = header->next;
+                free_object(header);
+                heap->object_count--;
+            }
+        }
+        return live_bytes;
+    }
+
+    void object_manager_collect_garbage(z_value_t *context_object) {
+        auto heap = vm_instance->heap;
+        // empty the nursery first, so that only the old space has to be traced
+        object_manager_collect_young(context_object);
+
+        vector<uintptr_t> addresses;
+        addresses.reserve(heap->object_count);
+        for (z_object_header_t *header = heap->all_objects; header != nullptr; header = header->next) {
+            addresses.push_back((uintptr_t) (header + 1));
+        }
+        sort(addresses.begin(), addresses.end());
+
+        vector<z_object_header_t *> gray;
+        for (auto active : heap->active_contexts) {
+            // not known to the collector, only its slots are
+            z_object_header_t *header = object_manager_header_of(active);
+            for (uint32_t i = 0; i < header->size; i++) {
+                mark(addresses, gray, active[i].uint_value);
+            }
+        }
+        for (int64_t i = 0; i < vm_instance->stack_pointer; i++) {
+            mark(addresses, gray, vm_instance->value_stack[i].uint_value);
+        }
+        for (auto handle : vm_instance->handles) {
+            mark(addresses, gray, handle.uint_value);
+        }
+        trace(addresses, gray);
+
+        uint64_t objects_before = heap->object_count;
+        uint64_t live_bytes = sweep();
+        heap->collection_threshold = max(GC_INITIAL_THRESHOLD, live_bytes * 2);
+        heap->bytes_since_collection = 0;
+        object_man_log.debug("collected %d of %d objects", (int) (objects_before - heap->object_count),
+                             (int) objects_before);
+    }
+
+    z_heap_t *object_manager_create_heap() {
+        auto heap = new z_heap_t();
+        heap->collection_threshold = GC_INITIAL_THRESHOLD;
+        return heap;
+    }
+
+    void object_manager_destroy_heap(z_heap_t *heap) {
+        for (auto header = heap->all_objects; header != nullptr;) {
+            auto next = header->next;
+            free_object(header);
+            header = next;
+        }
+        for (uintptr_t object = heap->nursery_start; object < heap->nursery_top;) {
+            auto header = (z_object_header_t *) object;
+            if (header->type == VM_VALUE_TYPE_STRING) {
+                ((string *) (header + 1))->~string();
+            }
+            object += young_object_size(header);
+        }
+        free((void *) heap->nursery_start);
+        free(heap->nursery_object_starts);
+        for (auto slab: heap->context_slabs) {
+            free(slab);
+        }
+        delete heap;
+    }
+
+    // set before the programs run, the instances only read it
+    static bool statistics_enabled = false;
+
+    void object_manager_log_statistics() {
+        auto heap = vm_instance->heap;
+        char message[256];
+        snprintf(message, sizeof(message), "context pool: %d of %d allocations served from the free lists "
+                                           "(%.1f%% hit rate), %d slab refills, %d contexts released on return",
+                 (int) heap->context_pool_hits, (int) heap->context_allocations,
+                 heap->context_allocations == 0 ? 0.0 : 100.0 * heap->context_pool_hits / heap->context_allocations,
+                 (int) heap->context_slab_refills, (int) heap->contexts_released_on_return);
+        if (statistics_enabled) {
+            object_man_log.info("%s", message);
+        } else {
+            object_man_log.debug("%s", message);
+        }
+    }
+
+    void object_manager_enable_statistics(bool enabled) {
+        statistics_enabled = enabled;
     }
 
     z_object_type_info object_manager_guess_type(z_value_t value) {
-        uint64_t type = value.uint_value & 7;
-        if (type == 0) { // because pointers are 8 byte aligned, it means this is a pointer and not a primitive
-            if (type_knowledge_map.find(value.uint_value) != type_knowledge_map.end()) {
-                return type_knowledge_map[value.uint_value];
-            } else return -1;
+        switch (value.tag) {
+            case VALUE_TAG_INT:
+                return VM_VALUE_TYPE_INT;
+            case VALUE_TAG_BOOLEAN:
+                return VM_VALUE_TYPE_BOOLEAN;
+            case VALUE_TAG_NULL:
+                return VM_VALUE_TYPE_NULL;
+            case VALUE_TAG_NATIVE:
+                return VM_VALUE_TYPE_NATIVE_REF;
+            default:
+                break;
+        }
+        if ((value.uint_value >> 48) != 0) {
+            return VM_VALUE_TYPE_DECIMAL;
+        }
+        // the function reference of the root function
+        if (value.ptr_value == nullptr) {
+            return -1;
         }
-        return type;
+        auto object_type = object_manager_header_of(value.ptr_value)->type;
+        return object_type == VM_VALUE_TYPE_ROPE ? VM_VALUE_TYPE_STRING : object_type;
     }
 
     bool object_manager_is_null(z_value_t value) {
-        return (value.uint_value & 7) == VM_VALUE_TYPE_NULL;
+        return value.tag == VALUE_TAG_NULL;
     }
 }
\ No newline at end of file
@@ -3,7 +3,26 @@
 #include <vm/object_manager.h>
 
 #include <common/util.h>
-#include <iostream>
+#include <compiler/type.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+
+#else
+
+#include <csignal>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#endif
 
 #include "vm_shared_inline.cpp"
 
@@ -13,55 +32,449 @@ namespace zero {
 
     Logger vm_log = Logger("vm");
 
-    // for parameter passing, return address etc
-    int64_t stack_pointer;
-    z_value_t value_stack[STACK_MAX];
+    VM_THREAD_LOCAL z_vm_instance_t *vm_instance = nullptr;
+
+    vector<z_native_fnc_info_t> native_functions = {
+            {"print", {&TypeInfo::ANY}, &TypeInfo::T_VOID, native_print}
+    };
+
+    // print writes to the buffer of the instance, it goes out when it is full, when the root function returns,
+    // or at exit
+    static const size_t OUTPUT_BUFFER_SIZE = 1 << 16;
+
+    static void flush_output(z_vm_instance_t *instance) {
+        if (instance == nullptr || instance->output_length == 0) return;
+        // one write, the output of the other instances does not get in between
+        fwrite(instance->output_buffer, 1, instance->output_length, stdout);
+        fflush(stdout);
+        instance->output_length = 0;
+    }
+
+    static void flush_at_exit() {
+        // the errors leave with exit(1), what the failing instance printed before them still goes out
+        flush_output(vm_instance);
+    }
+
+    /**
+     * the value stack is reserved with a guard zone on both sides, and only its beginning is mapped. a push past the
+     * mapped part faults, and the handler maps more of it in place, so the frames and cells on the stack keep their
+     * addresses. a fault in a guard zone is an overflow or an underflow. this replaces the checks on every push, pop
+     * and frame, except for a frame bigger than the guard zone, which could jump over it. posix systems get a signal
+     * handler for it, windows a vectored exception handler
+     */
+    static const uint64_t STACK_INITIAL_SIZE = 1 << 13; // values
+
+#ifdef _WIN32
+
+    static void write_fault_output(int stream, const char *data, size_t length) {
+        (void) _write(stream, data, (unsigned int) length);
+    }
+
+    static bool commit_stack(char *begin, size_t length) {
+        return VirtualAlloc(begin, length, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+    }
+
+#else
+
+    static void write_fault_output(int stream, const char *data, size_t length) {
+        (void) write(stream, data, length);
+    }
+
+    static bool commit_stack(char *begin, size_t length) {
+        return mprotect(begin, length, PROT_READ | PROT_WRITE) == 0;
+    }
+
+#endif
+
+    // only what can be called from a fault handler. what the instance printed goes out before the error, the
+    // buffers of stdio are left alone as the fault may be in the middle of them
+    static void exit_on_fault(z_vm_instance_t *instance, const char *error) {
+        if (instance->output_length != 0) {
+            write_fault_output(1, instance->output_buffer, instance->output_length);
+        }
+        // one write, like the lines of the logger
+        static const char prefix[] = "vm, [ERROR]: ";
+        char line[128];
+        size_t length = min(strlen(error), sizeof(line) - sizeof(prefix));
+        memcpy(line, prefix, sizeof(prefix) - 1);
+        memcpy(line + sizeof(prefix) - 1, error, length);
+        line[sizeof(prefix) - 1 + length] = '\n';
+        write_fault_output(2, line, sizeof(prefix) + length);
+        _exit(1);
+    }
+
+    // true if the fault was in the part of the stack that is not mapped yet and it is mapped now, false if it is not
+    // in the stack at all. a fault in a guard zone, or a stack that can not grow, ends the process
+    static bool grow_stack_over(z_vm_instance_t *instance, char *address) {
+        auto begin = (char *) instance->value_stack;
+        auto end = (char *) (instance->value_stack + STACK_MAX);
+        if (address >= begin - STACK_GUARD_SIZE && address < begin) {
+            exit_on_fault(instance, "stack underflow!");
+        }
+        if (address >= end && address < end + STACK_GUARD_SIZE) {
+            exit_on_fault(instance, "stack overflow!");
+        }
+        auto mapped_end = (char *) (instance->value_stack + instance->stack_mapped);
+        if (address < mapped_end || address >= end) return false;
+        // doubled, or up to the fault if it is further
+        uint64_t needed = (address - begin) / sizeof(z_value_t) + 1;
+        uint64_t mapped = max(instance->stack_mapped * 2, (needed + STACK_INITIAL_SIZE - 1) /
+                                                          STACK_INITIAL_SIZE * STACK_INITIAL_SIZE);
+        mapped = min(mapped, (uint64_t) STACK_MAX);
+        if (!commit_stack(mapped_end, (mapped - instance->stack_mapped) * sizeof(z_value_t))) {
+            exit_on_fault(instance, "could not grow the stack, stack overflow!");
+        }
+        instance->stack_mapped = mapped;
+        return true;
+    }
+
+#ifdef _WIN32
+
+    static LONG CALLBACK on_stack_fault(EXCEPTION_POINTERS *exception) {
+        auto record = exception->ExceptionRecord;
+        auto instance = vm_instance;
+        if (instance == nullptr || record->ExceptionCode != EXCEPTION_ACCESS_VIOLATION ||
+            record->NumberParameters < 2) {
+            return EXCEPTION_CONTINUE_SEARCH;
+        }
+        // the second parameter is the address that was accessed
+        auto address = (char *) record->ExceptionInformation[1];
+        return grow_stack_over(instance, address) ? EXCEPTION_CONTINUE_EXECUTION : EXCEPTION_CONTINUE_SEARCH;
+    }
+
+    // the exception handler runs on the stack of the thread, there is nothing to set up for it
+    static void ensure_signal_stack() {
+    }
+
+    static z_value_t *map_value_stack(z_vm_instance_t *instance) {
+        // first, so it sees the faults before the handlers of the host
+        static bool handler_installed = AddVectoredExceptionHandler(1, on_stack_fault) != nullptr;
+        if (!handler_installed) return nullptr;
+
+        // nothing is committed until it is made accessible
+        auto base = (char *) VirtualAlloc(nullptr, STACK_GUARD_SIZE * 2 + STACK_MAX * sizeof(z_value_t),
+                                          MEM_RESERVE, PAGE_NOACCESS);
+        if (base == nullptr) return nullptr;
+        auto value_stack = (z_value_t *) (base + STACK_GUARD_SIZE);
+        if (!commit_stack((char *) value_stack, STACK_INITIAL_SIZE * sizeof(z_value_t))) {
+            VirtualFree(base, 0, MEM_RELEASE);
+            return nullptr;
+        }
+        instance->stack_mapped = STACK_INITIAL_SIZE;
+        return value_stack;
+    }
+
+    static void unmap_value_stack(z_vm_instance_t *instance) {
+        VirtualFree((char *) instance->value_stack - STACK_GUARD_SIZE, 0, MEM_RELEASE);
+    }
+
+#else
+
+    static struct sigaction previous_segv_action;
+    static struct sigaction previous_bus_action;
+
+    static const size_t SIGNAL_STACK_SIZE = 1 << 16; // bytes
+
+    static pthread_key_t signal_stack_key;
+    static VM_THREAD_LOCAL bool signal_stack_ready = false;
+
+    static void on_stack_fault(int signal, siginfo_t *info, void *context) {
+        auto instance = vm_instance;
+        if (instance != nullptr && grow_stack_over(instance, (char *) info->si_addr)) return;
+        // not ours, it goes to the handler that was there before, and this one stays installed
+        auto &previous = signal == SIGSEGV ? previous_segv_action : previous_bus_action;
+        if (previous.sa_flags & SA_SIGINFO) {
+            previous.sa_sigaction(signal, info, context);
+            return;
+        }
+        if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN) {
+            previous.sa_handler(signal);
+            return;
+        }
+        // an ignored signal that was sent stays ignored. a real fault can not be ignored, it would come back forever
+        if (previous.sa_handler == SIG_IGN && info->si_code <= 0) return;
+        struct sigaction default_action{};
+        default_action.sa_handler = SIG_DFL;
+        sigemptyset(&default_action.sa_mask);
+        sigaction(signal, &default_action, nullptr);
+        raise(signal);
+    }
+
+    // at the exit of a thread that had one
+    static void free_signal_stack(void *memory) {
+        stack_t disabled{};
+        disabled.ss_flags = SS_DISABLE;
+        sigaltstack(&disabled, nullptr);
+        munmap(memory, SIGNAL_STACK_SIZE);
+    }
+
+    // the handler runs on a stack of its own, a thread that ran out of its stack can still report it. every thread
+    // that runs an instance gets one, unless the host has already given it one
+    static void ensure_signal_stack() {
+        if (signal_stack_ready) return;
+        signal_stack_ready = true;
+        stack_t current{};
+        if (sigaltstack(nullptr, &current) == 0 && !(current.ss_flags & SS_DISABLE)) return;
+        void *memory = mmap(nullptr, SIGNAL_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) return;
+        stack_t stack{};
+        stack.ss_sp = memory;
+        stack.ss_size = SIGNAL_STACK_SIZE;
+        if (sigaltstack(&stack, nullptr) != 0) {
+            munmap(memory, SIGNAL_STACK_SIZE);
+            return;
+        }
+        pthread_setspecific(signal_stack_key, memory);
+    }
+
+    static bool install_stack_fault_handler() {
+        if (pthread_key_create(&signal_stack_key, free_signal_stack) != 0) return false;
+        struct sigaction action{};
+        action.sa_sigaction = on_stack_fault;
+        action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        sigemptyset(&action.sa_mask);
+        // some systems raise SIGBUS for a protected page
+        return sigaction(SIGSEGV, &action, &previous_segv_action) == 0 &&
+               sigaction(SIGBUS, &action, &previous_bus_action) == 0;
+    }
+
+    static z_value_t *map_value_stack(z_vm_instance_t *instance) {
+        static bool handler_installed = install_stack_fault_handler();
+        if (!handler_installed) return nullptr;
 
-    vector<z_native_fnc_t> native_function_map;
+        // nothing is committed until it is made accessible
+        auto base = (char *) mmap(nullptr, STACK_GUARD_SIZE * 2 + STACK_MAX * sizeof(z_value_t), PROT_NONE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED) return nullptr;
+        auto value_stack = (z_value_t *) (base + STACK_GUARD_SIZE);
+        if (!commit_stack((char *) value_stack, STACK_INITIAL_SIZE * sizeof(z_value_t))) {
+            munmap(base, STACK_GUARD_SIZE * 2 + STACK_MAX * sizeof(z_value_t));
+            return nullptr;
+        }
+        instance->stack_mapped = STACK_INITIAL_SIZE;
+        return value_stack;
+    }
 
-    void init_native_functions() {
-        native_function_map.push_back(native_print);
+    static void unmap_value_stack(z_vm_instance_t *instance) {
+        munmap((char *) instance->value_stack - STACK_GUARD_SIZE,
+               STACK_GUARD_SIZE * 2 + STACK_MAX * sizeof(z_value_t));
     }
 
-    z_native_fnc_t get_native_fnc_at(uint64_t index) {
-        return native_function_map[index];
+#endif
+
+    z_vm_instance_t *vm_create_instance() {
+        static bool flush_registered = atexit(flush_at_exit) == 0;
+        (void) flush_registered;
+
+        auto instance = new z_vm_instance_t();
+        instance->value_stack = map_value_stack(instance);
+        instance->output_buffer = (char *) malloc(OUTPUT_BUFFER_SIZE);
+        instance->output_capacity = OUTPUT_BUFFER_SIZE;
+        if (instance->value_stack == nullptr || instance->output_buffer == nullptr) {
+            vm_log.error("could not allocate a vm instance");
+            exit(1);
+        }
+        instance->heap = object_manager_create_heap();
+        for (auto &native: native_functions) {
+            instance->natives.push_back(native.handler);
+        }
+        return instance;
     }
 
-    vector<z_native_fnc_t> get_native_functions() {
-        return native_function_map;
+    static void free_string_constants(z_vm_instance_t *instance) {
+        for (auto value: instance->string_constants) {
+            object_manager_free_constant_string(value);
+        }
+        instance->string_constants.clear();
+    }
+
+    void vm_destroy_instance(z_vm_instance_t *instance) {
+        flush_output(instance);
+        if (vm_instance == instance) {
+            vm_instance = nullptr;
+        }
+        free_string_constants(instance);
+        object_manager_destroy_heap(instance->heap);
+        free_tiering(instance);
+        unmap_value_stack(instance);
+        free(instance->output_buffer);
+        delete instance;
+    }
+
+    void vm_use_instance(z_vm_instance_t *instance) {
+        vm_instance = instance;
+        if (instance != nullptr) {
+            ensure_signal_stack();
+        }
     }
 
-    z_value_t native_print() {
-        z_value_t z_value = pop();
+    void begin_run() {
+        if (vm_instance == nullptr) {
+            vm_instance = vm_create_instance();
+        }
+        ensure_signal_stack();
+        vm_instance->stack_pointer = 0;
+        vm_instance->value_stack[0] = pvalue(nullptr); // the root function is not called through a function reference
+    }
+
+    void vm_register_native(const string &name, const vector<TypeInfo *> &parameter_types, TypeInfo *return_type,
+                            z_native_fnc_t handler) {
+        native_functions.push_back({name, parameter_types, return_type, handler});
+    }
+
+    const vector<z_native_fnc_info_t> &vm_get_natives() {
+        return native_functions;
+    }
+
+    void leave_root_context(z_value_t *context_object) {
+        if (vm_instance->keeps_globals) {
+            // still entered, so the collector keeps it and what it points at
+            vm_instance->globals = context_object;
+        } else {
+            object_manager_leave_context(context_object);
+        }
+    }
+
+    z_native_fnc_t get_native_fnc_of(z_value_t native) {
+        return vm_instance->natives[(uint32_t) native.uint_value];
+    }
+
+    // the literals are created once per program, MOV_STRING only hands out pointers to them
+    void init_string_constants(Program *program) {
+        vector<string> values;
+        for (auto value: program->getStringConstants()) {
+            values.push_back(*value);
+        }
+        init_string_constants(values);
+    }
+
+    void init_string_constants(const vector<string> &values) {
+        free_string_constants(vm_instance);
+        for (auto &value: values) {
+            vm_instance->string_constants.push_back(object_manager_create_constant_string(value));
+        }
+    }
+
+    string *get_string_constant_at(uint64_t index) {
+        return vm_instance->string_constants[index];
+    }
+
+    void vm_set_output_line_buffered(bool line_buffered) {
+        if (vm_instance == nullptr) {
+            vm_instance = vm_create_instance();
+        }
+        vm_instance->output_line_buffered = line_buffered;
+    }
+
+    void vm_set_gc_statistics(bool enabled) {
+        object_manager_enable_statistics(enabled);
+    }
+
+    void vm_flush_output() {
+        if (vm_instance != nullptr && !vm_instance->output_held) {
+            flush_output(vm_instance);
+        }
+    }
+
+    void vm_hold_output() {
+        if (vm_instance == nullptr) {
+            vm_instance = vm_create_instance();
+        }
+        vm_instance->output_held = true;
+    }
+
+    void vm_release_output() {
+        vm_instance->output_held = false;
+        flush_output(vm_instance);
+    }
+
+    static void output_write(const char *data, size_t size) {
+        auto instance = vm_instance;
+        if (instance->output_length + size > instance->output_capacity) {
+            if (instance->output_held) {
+                auto capacity = max(instance->output_capacity * 2, instance->output_length + size);
+                auto buffer = (char *) realloc(instance->output_buffer, capacity);
+                if (buffer == nullptr) {
+                    vm_log.error("could not grow the output buffer");
+                    exit(1);
+                }
+                instance->output_buffer = buffer;
+                instance->output_capacity = capacity;
+            } else {
+                flush_output(instance);
+                if (size > instance->output_capacity) {
+                    fwrite(data, 1, size, stdout);
+                    return;
+                }
+            }
+        }
+        memcpy(instance->output_buffer + instance->output_length, data, size);
+        instance->output_length += size;
+    }
+
+    // writes the digits backwards, ending at the given position. gives the first character
+    static char *format_int(int32_t value, char *end) {
+        uint32_t magnitude = value < 0 ? 0u - (uint32_t) value : (uint32_t) value;
+        do {
+            *--end = (char) ('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude != 0);
+        if (value < 0) {
+            *--end = '-';
+        }
+        return end;
+    }
+
+    z_value_t native_print(z_value_t *arguments, uint64_t argument_count) {
+        z_value_t z_value = arguments[0];
         z_object_type_info type = object_manager_guess_type(z_value);
-        string str_value;
+        char formatted[320]; // %f of the largest double is 317 characters
+        const char *text;
+        size_t length;
         switch (type) {
             case VM_VALUE_TYPE_INT:
-                str_value = to_string(z_value.arithmetic_int_value);
+                text = format_int(z_value.arithmetic_int_value, formatted + sizeof(formatted));
+                length = formatted + sizeof(formatted) - text;
                 break;
             case VM_VALUE_TYPE_DECIMAL:
-                str_value = to_string(z_value.arithmetic_decimal_value);
+                // the same digits as to_string
+                length = snprintf(formatted, sizeof(formatted), "%f", decimal_of(&z_value));
+                text = formatted;
                 break;
+            case VM_VALUE_TYPE_STRING: {
+                // flattened in the frame of the caller, where the collector can see it
+                auto str = object_manager_flatten(&arguments[0], nullptr);
+                text = str->data();
+                length = str->size();
+                break;
+            }
             case VM_VALUE_TYPE_BOOLEAN:
-                str_value = z_value.arithmetic_int_value ? "true" : "false";
+                text = z_value.arithmetic_int_value ? "true" : "false";
+                length = strlen(text);
                 break;
             case VM_VALUE_TYPE_NULL:
-                str_value = "null";
-                break;
-            case VM_VALUE_TYPE_STRING:
-                str_value = *z_value.string_value;
+                text = "null";
+                length = strlen(text);
                 break;
             case VM_VALUE_TYPE_FUNCTION_REF:
-                str_value = "[function ref]";
+            case VM_VALUE_TYPE_NATIVE_REF:
+                text = "[function ref]";
+                length = strlen(text);
                 break;
             case VM_VALUE_TYPE_TYPE_OBJECT:
-                str_value = "[object ref]";
+                text = "[object ref]";
+                length = strlen(text);
                 break;
             default:
-                str_value = "[?]";
+                text = "[?]";
+                length = strlen(text);
                 break;
         }
-        cout << str_value << endl;
+        output_write(text, length);
+        output_write("\n", 1);
+        if (vm_instance->output_line_buffered) {
+            vm_flush_output();
+        }
         return ivalue(0);
     }
 }
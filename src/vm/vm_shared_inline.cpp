@@ -4,17 +4,14 @@
 
 #include <common/util.h>
 
+#include <cstring>
+
 using namespace std;
 
 namespace zero {
 
-    inline z_value_t *alloc(unsigned int size) {
-        auto *ptr = static_cast<z_value_t *>(malloc_aligned(size * sizeof(z_value_t)));
-        if (ptr == nullptr) {
-            vm_log.error("could not allocate %d size frame!", size);
-            exit(1);
-        }
-        return ptr;
+    inline z_value_t *alloc(unsigned int size, z_value_t *context_object) {
+        return object_manager_create_context(size, context_object);
     }
 
     inline z_value_t uvalue(uint64_t _val) {
@@ -25,29 +22,47 @@ namespace zero {
 
     inline z_value_t ivalue(int32_t _val) {
         z_value_t val;
-        val.uint_value = PRIMITIVE_TYPE_INT | (((uint64_t) _val) << 32);
+        val.uint_value = ((uint64_t) VALUE_TAG_INT << 32) | (uint32_t) _val;
         return val;
     }
 
     inline z_value_t nvalue() {
         z_value_t val;
-        val.uint_value = PRIMITIVE_TYPE_NULL;
+        val.uint_value = (uint64_t) VALUE_TAG_NULL << 32;
+        return val;
+    }
+
+    inline z_value_t nfvalue(uint32_t native_index) {
+        z_value_t val;
+        val.uint_value = ((uint64_t) VALUE_TAG_NATIVE << 32) | native_index;
         return val;
     }
 
     inline z_value_t bvalue(int32_t _val) {
         z_value_t val;
-        val.uint_value = PRIMITIVE_TYPE_BOOLEAN | (((uint64_t) _val) << 32);
+        val.uint_value = ((uint64_t) VALUE_TAG_BOOLEAN << 32) | (uint32_t) _val;
         return val;
     }
 
-    inline z_value_t dvalue(float _val) {
+    inline z_value_t dvalue(double _val) {
         z_value_t val;
-        val.arithmetic_decimal_value = _val;
-        val.primitive_type = PRIMITIVE_TYPE_DOUBLE;
+        if (_val != _val) {
+            // every nan is the same nan, the others would collide with the tags
+            val.uint_value = 0x7ff8000000000000ull + DOUBLE_ENCODE_OFFSET;
+        } else {
+            memcpy(&val.uint_value, &_val, sizeof(double));
+            val.uint_value += DOUBLE_ENCODE_OFFSET;
+        }
         return val;
     }
 
+    inline double decimal_of(z_value_t *value) {
+        uint64_t bits = value->uint_value - DOUBLE_ENCODE_OFFSET;
+        double decimal;
+        memcpy(&decimal, &bits, sizeof(double));
+        return decimal;
+    }
+
     inline z_value_t pvalue(void *_val) {
         z_value_t val;
         val.ptr_value = _val;
@@ -56,44 +71,147 @@ namespace zero {
 
     inline z_value_t svalue(string *_val) {
         z_value_t val;
-        val.string_value = _val;
-        object_manager_register_string(val);
+        val.string_value = _val; // must come from object_manager_create_string, or be a string constant
         return val;
     }
 
-    inline z_value_t fvalue(uint64_t instruction_index, z_value_t *context_object) {
+    inline z_value_t fvalue(uint64_t instruction_index, uint32_t capture_count, z_value_t *context_object) {
         z_value_t val;
-        val.ptr_value = object_manager_create_fn_ref(instruction_index, context_object);
+        val.ptr_value = object_manager_create_fn_ref(instruction_index, capture_count, context_object);
         return val;
     }
 
+    // the operands of these opcodes are used as they are. the operands of the others are slots, and are turned
+    // into byte offsets in the context when the instructions are loaded
+    inline bool has_immediate_operands(uint64_t opcode) {
+        return opcode == MOV_STRING ||
+               opcode == MOV_BOOLEAN ||
+               opcode == MOV_INT ||
+               opcode == MOV_DECIMAL ||
+               opcode == MOV_FNC ||
+               opcode == FN_ENTER_HEAP ||
+               opcode == FN_ENTER_STACK ||
+               opcode == CALL ||
+               opcode == CALL_NATIVE ||
+               opcode == GET_UPVALUE ||
+               opcode == GET_UPVALUE_CELL ||
+               opcode == SET_UPVALUE_CELL ||
+               opcode == CAPTURE ||
+               opcode == CAPTURE_CELL ||
+               opcode == CAPTURE_UPVALUE ||
+               opcode == SET_IN_OBJECT ||
+               opcode == GET_IN_OBJECT ||
+               opcode == CONCAT_N ||
+               opcode == RET;
+    }
+
+    inline bool is_jump(uint64_t opcode) {
+        return opcode > FN_ENTER_STACK && opcode <= JMP_LTE_DECIMAL;
+    }
+
+    // same for the destination
+    inline bool has_destination_offset(uint64_t opcode) {
+        return opcode > JMP_LTE_DECIMAL && opcode < SET_IN_OBJECT;
+    }
+
+    // the bounds are guarded by the pages around the stack, see vm_create_instance
     inline void push(z_value_t value) {
-        if (stack_pointer > STACK_MAX) {
-            vm_log.error("stack overflow!", stack_pointer);
-            exit(1);
-        }
-        value_stack[stack_pointer] = value;
-        stack_pointer++;
+        auto instance = vm_instance;
+        instance->value_stack[instance->stack_pointer] = value;
+        instance->stack_pointer++;
     }
 
     inline z_value_t pop() {
-        stack_pointer--;
-        if (stack_pointer < 0) {
-            vm_log.error("stack underflow!", stack_pointer);
+        auto instance = vm_instance;
+        instance->stack_pointer--;
+        auto ret = instance->value_stack[instance->stack_pointer];
+        return ret;
+    }
+
+    // the words of the frame header, right below the context of the callee
+    enum {
+        FRAME_RETURN_IP,        // null when the caller is the generated code, or the run started with the callee
+        FRAME_CALLER_CONTEXT,
+        FRAME_RETURN_OFFSET,    // in bytes, in the caller context
+        FRAME_CALLER_POINTERS   // base pointer of the caller in the low half, its stack pointer in the high half
+    };
+
+    static inline bool is_on_stack(z_value_t *context_object) {
+        auto value_stack = vm_instance->value_stack;
+        return context_object >= value_stack && context_object < value_stack + STACK_MAX;
+    }
+
+    // the caller has put the function reference and the arguments into the frame, which begins in its own frame.
+    // a caller that lives on the heap has them copied to the top of the stack
+    inline void push_frame(z_value_t *frame, uint64_t argument_count, void *return_ip, z_value_t *caller_context,
+                           uint64_t return_offset, int64_t caller_base_pointer) {
+        auto instance = vm_instance;
+        if (!is_on_stack(frame)) {
+            auto stack_frame = &instance->value_stack[instance->stack_pointer + FRAME_HEADER_SIZE];
+            for (uint64_t i = 0; i <= argument_count; i++) {
+                stack_frame[i] = frame[i];
+            }
+            frame = stack_frame;
+        }
+        auto header = frame - FRAME_HEADER_SIZE;
+        header[FRAME_RETURN_IP] = pvalue(return_ip);
+        header[FRAME_CALLER_CONTEXT] = pvalue(caller_context);
+        header[FRAME_RETURN_OFFSET] = uvalue(return_offset);
+        header[FRAME_CALLER_POINTERS] = uvalue(((uint64_t) instance->stack_pointer << 32) |
+                                               (uint32_t) caller_base_pointer);
+        instance->stack_pointer = frame - instance->value_stack;
+    }
+
+    // moves the return value into the caller and restores its pointers. gives the caller context back
+    inline z_value_t *pop_frame(z_value_t *context_object, uint64_t return_index, int64_t &base_pointer) {
+        auto instance = vm_instance;
+        auto header = &instance->value_stack[base_pointer - FRAME_HEADER_SIZE];
+        auto caller_context = (z_value_t *) header[FRAME_CALLER_CONTEXT].ptr_value;
+        if (return_index) {
+            *(z_value_t *) ((uintptr_t) caller_context + header[FRAME_RETURN_OFFSET].uint_value) =
+                    context_object[return_index];
+        }
+        // after the return value is moved, since a context that was not captured goes back to the pool here
+        object_manager_leave_context(context_object);
+        auto pointers = header[FRAME_CALLER_POINTERS].uint_value;
+        base_pointer = (int64_t) (pointers & 0xffffffff);
+        instance->stack_pointer = (int64_t) (pointers >> 32);
+        return caller_context;
+    }
+
+    // the frame at the stack pointer becomes the context, it already holds the function reference and the arguments
+    inline z_value_t *enter_stack_frame(uint64_t local_values_size) {
+        auto instance = vm_instance;
+        // a frame this big could jump over the guard zone, the end of the stack is checked instead
+        if (local_values_size > STACK_GUARD_SIZE / sizeof(z_value_t) &&
+            instance->stack_pointer + local_values_size > STACK_MAX) {
+            vm_log.error("stack overflow!");
             exit(1);
         }
-        auto ret = value_stack[stack_pointer];
-        return ret;
+        auto context_object = &instance->value_stack[instance->stack_pointer];
+        instance->stack_pointer += local_values_size;
+        return context_object;
     }
 
-    inline void init_call_context(z_value_t *context_object, z_value_t *parent_context) {
-        context_object[0] = pvalue(parent_context); // 0th index is a pointer to parent
-        if (parent_context == nullptr) {
-            vector<z_native_fnc_t> functions = get_native_functions();
-            // init native functions
-            for (unsigned int i = 0; i < functions.size(); i++) {
-                context_object[i + 1] = uvalue(i);
+    // same for a context on the heap, the function reference and the arguments are copied into it
+    inline z_value_t *enter_heap_frame(uint64_t local_values_size, uint64_t argument_count,
+                                       z_value_t *context_object) {
+        auto instance = vm_instance;
+        auto frame = &instance->value_stack[instance->stack_pointer];
+        // they stay below the stack pointer while allocating, where the collector can see them
+        instance->stack_pointer += argument_count + 1;
+        auto new_context = alloc(local_values_size, context_object);
+        instance->stack_pointer -= argument_count + 1;
+        for (uint64_t i = 0; i <= argument_count; i++) {
+            new_context[i] = frame[i];
+        }
+        if (new_context[0].ptr_value == nullptr) {
+            // the root function is not called through a function reference, it holds the natives instead
+            auto native_count = instance->natives.size();
+            for (uint64_t i = 0; i < native_count; i++) {
+                new_context[i + 1] = nfvalue((uint32_t) i);
             }
         }
+        return new_context;
     }
 }
\ No newline at end of file
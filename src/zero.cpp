@@ -0,0 +1,209 @@
+#include <zero.h>
+#include <compiler/compiler.h>
+#include <vm/object_manager.h>
+
+#include "vm/vm_shared_inline.cpp"
+
+using namespace std;
+
+namespace zero {
+
+    //// --- IMPL
+
+    class Script::Impl {
+    public:
+        Program *program;
+
+        const GlobalSymbol *lookup(const string &name) {
+            for (auto &global: program->getGlobals()) {
+                if (global.name == name) {
+                    return &global;
+                }
+            }
+            return nullptr;
+        }
+    };
+
+    class ScriptInstance::Impl {
+    public:
+        Impl(Script *script, uint64_t jitThreshold) {
+            instance = vm_create_instance();
+            Using scope(instance);
+            vm_load(script->getProgram(), jitThreshold);
+        }
+
+        ~Impl() {
+            vm_destroy_instance(instance);
+        }
+
+        z_value_t call(const GlobalSymbol *function, const vector<z_value_t> &arguments) {
+            Using scope(instance);
+            return vm_call(valueOf(function), arguments.data(), arguments.size());
+        }
+
+        void release(z_value_t result) {
+            Using scope(instance);
+            vm_release(result);
+        }
+
+        z_value_t get(const GlobalSymbol *global) {
+            return valueOf(global);
+        }
+
+        void setLineBuffered(bool lineBuffered) {
+            Using scope(instance);
+            vm_set_output_line_buffered(lineBuffered);
+        }
+
+        string stringOf(z_value_t value) {
+            Using scope(instance);
+            switch (object_manager_guess_type(value)) {
+                case VM_VALUE_TYPE_INT:
+                    return to_string(value.arithmetic_int_value);
+                case VM_VALUE_TYPE_DECIMAL:
+                    return to_string(decimal_of(&value));
+                case VM_VALUE_TYPE_BOOLEAN:
+                    return value.arithmetic_int_value ? "true" : "false";
+                case VM_VALUE_TYPE_NULL:
+                    return "null";
+                case VM_VALUE_TYPE_STRING: {
+                    // flattening may allocate, so the value goes to the stack where the collector sees it
+                    push(value);
+                    string result = *object_manager_flatten(&instance->value_stack[instance->stack_pointer - 1],
+                                                            nullptr);
+                    pop();
+                    return result;
+                }
+                case VM_VALUE_TYPE_FUNCTION_REF:
+                case VM_VALUE_TYPE_NATIVE_REF:
+                    return "[function ref]";
+                case VM_VALUE_TYPE_TYPE_OBJECT:
+                    return "[object ref]";
+                default:
+                    return "[?]";
+            }
+        }
+
+    private:
+        z_vm_instance_t *instance;
+
+        // the instance of the calling thread, until the scope ends
+        class Using {
+        public:
+            explicit Using(z_vm_instance_t *instance) {
+                previous = vm_instance;
+                vm_use_instance(instance);
+            }
+
+            ~Using() {
+                vm_use_instance(previous);
+            }
+
+        private:
+            z_vm_instance_t *previous;
+        };
+
+        z_value_t valueOf(const GlobalSymbol *global) {
+            if (global == nullptr) {
+                vm_log.error("there is no such global, lookup returned null for it");
+                exit(1);
+            }
+            auto value = instance->globals[global->index];
+            if (global->isBoxed) {
+                value = *(z_value_t *) value.ptr_value;
+            }
+            return value;
+        }
+    };
+
+    //// --- PUBLIC
+    Script::Script(Program *program) {
+        impl = new Script::Impl();
+        impl->program = program;
+        // laid out once here, the instances only read it
+        program->toBytes();
+        program->getInstructions();
+        program->getStringConstants();
+    }
+
+    Script::~Script() {
+        delete impl->program;
+        delete impl;
+    }
+
+    Script *Script::compileFile(const string &fileName) {
+        return new Script(Compiler().compileFile(fileName));
+    }
+
+    Script *Script::compileSource(const string &source, const string &fileName) {
+        return new Script(Compiler().compileSource(source, fileName));
+    }
+
+    const GlobalSymbol *Script::lookup(const string &name) {
+        return impl->lookup(name);
+    }
+
+    Program *Script::getProgram() {
+        return impl->program;
+    }
+
+    ScriptInstance::ScriptInstance(Script *script, uint64_t jitThreshold) {
+        impl = new ScriptInstance::Impl(script, jitThreshold);
+    }
+
+    ScriptInstance::~ScriptInstance() {
+        delete impl;
+    }
+
+    z_value_t ScriptInstance::call(const GlobalSymbol *function, const vector<z_value_t> &arguments) {
+        return impl->call(function, arguments);
+    }
+
+    void ScriptInstance::release(z_value_t result) {
+        impl->release(result);
+    }
+
+    z_value_t ScriptInstance::get(const GlobalSymbol *global) {
+        return impl->get(global);
+    }
+
+    string ScriptInstance::stringOf(z_value_t value) {
+        return impl->stringOf(value);
+    }
+
+    void ScriptInstance::setLineBuffered(bool lineBuffered) {
+        impl->setLineBuffered(lineBuffered);
+    }
+
+    z_value_t int_value(int32_t value) {
+        return ivalue(value);
+    }
+
+    z_value_t decimal_value(double value) {
+        return dvalue(value);
+    }
+
+    z_value_t boolean_value(bool value) {
+        return bvalue(value);
+    }
+
+    z_value_t null_value() {
+        return nvalue();
+    }
+
+    int32_t value_as_int(z_value_t value) {
+        return value.arithmetic_int_value;
+    }
+
+    double value_as_decimal(z_value_t value) {
+        return decimal_of(&value);
+    }
+
+    bool value_as_boolean(z_value_t value) {
+        return value.arithmetic_int_value != 0;
+    }
+
+    bool value_is_null(z_value_t value) {
+        return object_manager_is_null(value);
+    }
+}
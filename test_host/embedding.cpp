@@ -0,0 +1,67 @@
+#include <zero.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace zero;
+
+// a host that calls the functions of a script, the output is compared like the one of the test files
+static const char *SOURCE = R"(
+var greeting = "hello from the script"
+
+fun square(num: int): int {
+    return num * num
+}
+
+fun average(a: decimal, b: decimal): decimal {
+    return (a + b) / 2
+}
+
+fun stars(count: int): String {
+    var result = ""
+    for (var i = 0; i < count; i = i + 1) {
+        result = result + "*"
+    }
+    return result
+}
+)";
+
+int main(int argc, const char *argv[]) {
+    uint64_t jitThreshold = argc > 1 ? strtoull(argv[1], nullptr, 10) : 0;
+    auto script = Script::compileSource(SOURCE, "embedding");
+    auto square = script->lookup("square");
+    auto average = script->lookup("average");
+    auto stars = script->lookup("stars");
+    {
+        ScriptInstance instance(script, jitThreshold);
+
+        long long sum = 0;
+        for (int i = 0; i < 1000; i++) {
+            sum += value_as_int(instance.call(square, {int_value(i)}));
+        }
+        printf("%lld\n", sum);
+
+        double averages = 0;
+        for (int i = 0; i < 1000; i++) {
+            averages += value_as_decimal(instance.call(average, {decimal_value(i), decimal_value(0.5)}));
+        }
+        printf("%.2f\n", averages);
+
+        // kept while the next calls allocate and collect
+        auto held = instance.call(stars, {int_value(20)});
+        size_t length = 0;
+        for (int i = 0; i < 2000; i++) {
+            auto result = instance.call(stars, {int_value(i % 50)});
+            length += instance.stringOf(result).size();
+            instance.release(result);
+        }
+        printf("%zu\n", length);
+        printf("%s\n", instance.stringOf(held).c_str());
+        instance.release(held);
+
+        printf("%s\n", instance.stringOf(instance.get(script->lookup("greeting"))).c_str());
+        printf("%s\n", script->lookup("missing") == nullptr ? "no missing" : "missing");
+    }
+    delete script;
+    return 0;
+}